@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Checkpoint.hpp"
+
+Checkpoint::Checkpoint()
+    : Fd(-1)
+    , MappedSize(0)
+    , Header(nullptr)
+    , Slots(nullptr)
+    , SessionIdBase(0)
+{
+}
+
+Checkpoint::~Checkpoint()
+{
+    // The file is kept for the next run
+    if (Header != nullptr) {
+        munmap(Header, MappedSize);
+    }
+    if (Fd != -1) {
+        close(Fd);
+    }
+}
+
+bool Checkpoint::Open(const char* path, uint32_t sessionIdBase)
+{
+    const size_t fileSize = sizeof(CheckpointHeader) + sizeof(CheckpointSlot) * MAX_SESSION;
+
+    const int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        std::cerr << "Failed to open checkpoint: " << path << ". errno: " << errno << std::endl;
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1) {
+        std::cerr << "Failed to stat checkpoint. errno: " << errno << std::endl;
+        close(fd);
+        return false;
+    }
+
+    // A new file is zero-filled by ftruncate. (No live slot)
+    const bool bNewFile = (fileStat.st_size == 0);
+    if (bNewFile && ftruncate(fd, fileSize) == -1) {
+        std::cerr << "Failed to size checkpoint. errno: " << errno << std::endl;
+        close(fd);
+        return false;
+    }
+    if (!bNewFile && (size_t)fileStat.st_size != fileSize) {
+        std::cerr << "Checkpoint " << path << " has another layout. (Size " << fileStat.st_size << ", expected " << fileSize << ") Remove it to start over." << std::endl;
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map checkpoint. errno: " << errno << std::endl;
+        close(fd);
+        return false;
+    }
+    CheckpointHeader* header = static_cast<CheckpointHeader*>(mapped);
+
+    if (bNewFile) {
+        header->Version = CHECKPOINT_VERSION;
+        header->SnapshotVersion = SESSION_SNAPSHOT_VERSION;
+        header->SlotSize = sizeof(CheckpointSlot);
+        header->NumSlots = MAX_SESSION;
+        header->SessionIdBase = sessionIdBase;
+        std::atomic_thread_fence(std::memory_order_release);
+        header->Magic = CHECKPOINT_MAGIC;
+    }
+    else if (header->Magic != CHECKPOINT_MAGIC
+             || header->Version != CHECKPOINT_VERSION
+             || header->SnapshotVersion != SESSION_SNAPSHOT_VERSION
+             || header->SlotSize != sizeof(CheckpointSlot)
+             || header->NumSlots != MAX_SESSION) {
+        std::cerr << "Checkpoint " << path << " has another layout or version. Remove it to start over." << std::endl;
+        munmap(mapped, fileSize);
+        close(fd);
+        return false;
+    }
+    else if (header->SessionIdBase != sessionIdBase) {
+        std::cerr << "Checkpoint " << path << " belongs to another shard. (Session ID base " << header->SessionIdBase << ")" << std::endl;
+        munmap(mapped, fileSize);
+        close(fd);
+        return false;
+    }
+
+    Fd = fd;
+    MappedSize = fileSize;
+    Header = header;
+    Slots = reinterpret_cast<CheckpointSlot*>(header + 1);
+    SessionIdBase = sessionIdBase;
+
+    bSlotLive.reset(new bool[MAX_SESSION]);
+    for (uint32_t i = 0; i < MAX_SESSION; i++) {
+        bSlotLive[i] = (Slots[i].bLive.load(std::memory_order_acquire) != 0);
+    }
+
+    std::cout << "[LOG] Session checkpoint: " << path << (bNewFile ? " (New)" : "") << std::endl;
+    return true;
+}
+
+bool Checkpoint::Load(uint32_t sessionID, Session::Snapshot& snapshot) const
+{
+    const uint32_t index = sessionID - SessionIdBase;
+    if (index >= MAX_SESSION || !bSlotLive[index]) {
+        return false;
+    }
+    const CheckpointSlot& slot = Slots[index];
+
+    // The copy of the last complete save. The other one may be torn by the crash.
+    const uint32_t sequence = slot.Sequence.load(std::memory_order_acquire);
+    const CheckpointCopy& copy = slot.Copies[sequence & 1];
+    if (sequence == 0 || copy.End.load(std::memory_order_acquire) != sequence || copy.Begin.load(std::memory_order_relaxed) != sequence) {
+        return false;
+    }
+    memcpy(&snapshot, &copy.Snapshot, sizeof(snapshot));
+    return snapshot.Version == SESSION_SNAPSHOT_VERSION;
+}
+
+void Checkpoint::Sweep(uint32_t idPartition)
+{
+    // Only the slots of the partition. The workers of the other reactors save into theirs meanwhile.
+    const uint32_t begin = std::min(idPartition * Session::GetSessionIdPartitionSize(), (uint32_t)MAX_SESSION);
+    const uint32_t end = std::min(begin + Session::GetSessionIdPartitionSize(), (uint32_t)MAX_SESSION);
+    for (uint32_t i = begin; i < end; i++) {
+        if (!bSlotLive[i] || Session::FindSession(SessionIdBase + i) != nullptr) {
+            continue;
+        }
+        bSlotLive[i] = false;
+        Slots[i].bLive.store(0, std::memory_order_release);
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+
+#include "config.hpp"
+#include "Session.hpp"
+
+/**
+ * Memory-mapped checkpoint of the sessions for crash recovery. (`--checkpoint <path>`)
+ *
+ * The file has one slot per session ID. Every tick, the workers save the sessions they ticked into their slots,
+ * and the reactor saves the idle ones when they change, and frees the slots of sessions that are gone.
+ * The mapping is shared, so everything stored before a crash of the process is in the page cache and survives it.
+ * (A crash of the host only keeps what the kernel wrote back)
+ *
+ * A slot holds two copies of the snapshot. A save overwrites the older one between two stores of its sequence number,
+ * so a save interrupted by the crash leaves the other copy complete.
+ *
+ * The server restarting on the file resumes the sessions at their last saved tick under the same session IDs.
+ * They have no owner until a client reclaims them. (See ReclaimSession_v1)
+ * */
+struct CheckpointCopy
+{
+    std::atomic<uint32_t> Begin; //< Sequence number of the save. Stored before the snapshot
+    Session::Snapshot     Snapshot;
+    std::atomic<uint32_t> End;   //< Stored after the snapshot. Complete if Begin == End
+};
+
+struct alignas(CACHE_LINE) CheckpointSlot
+{
+    std::atomic<uint32_t> bLive;    //< A session of the ID was saved, and is not gone
+    std::atomic<uint32_t> Sequence; //< Number of the last complete save. Copies[Sequence & 1] holds it
+    CheckpointCopy        Copies[2];
+};
+
+struct alignas(CACHE_LINE) CheckpointHeader
+{
+    uint32_t Magic;           //< CHECKPOINT_MAGIC
+    uint32_t Version;         //< CHECKPOINT_VERSION
+    uint32_t SnapshotVersion; //< SESSION_SNAPSHOT_VERSION
+    uint32_t SlotSize;        //< sizeof(CheckpointSlot)
+    uint32_t NumSlots;        //< MAX_SESSION
+    uint32_t SessionIdBase;   //< Session ID of slot 0 (Encodes the shard)
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Slot sequence numbers are read by the next process");
+
+class Checkpoint
+{
+public:
+    Checkpoint();
+
+    ~Checkpoint();
+
+    // Map the file, or create it. false if it can't be mapped, or holds another layout or shard. (The file is left as is)
+    bool Open(const char* path, uint32_t sessionIdBase);
+
+    inline bool IsOpen() const { return Header != nullptr; }
+
+    // Session ID of the first slot
+    inline uint32_t GetSessionIdBase() const { return SessionIdBase; }
+
+    // Load the last complete save of the session ID. false if no live session of the ID was saved.
+    bool Load(uint32_t sessionID, Session::Snapshot& snapshot) const;
+
+    // Save the session into its slot. Call between ticks of the session, from the thread owning its partition.
+    inline void Save(const Session& session)
+    {
+        const uint32_t index = session.GetSessionID() - SessionIdBase;
+        CheckpointSlot& slot = Slots[index];
+
+        // Write the copy not holding the last complete save
+        uint32_t sequence = slot.Sequence.load(std::memory_order_relaxed) + 1;
+        if (sequence == 0) {
+            sequence = 2; //< 0 is "Never saved". (Keeps the copies alternating)
+        }
+        CheckpointCopy& copy = slot.Copies[sequence & 1];
+        copy.Begin.store(sequence, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        session.SaveSnapshot(copy.Snapshot, session.GetLastTickUpdateTime()); //< Resumes at the saved tick
+        copy.End.store(sequence, std::memory_order_release);
+        slot.Sequence.store(sequence, std::memory_order_release);
+
+        if (!bSlotLive[index]) {
+            bSlotLive[index] = true;
+            slot.bLive.store(1, std::memory_order_release);
+        }
+    }
+
+    // Free the slots of the partition whose session is gone. (Aborted, ended, disconnected or migrated to another server) O(partition size)
+    void Sweep(uint32_t idPartition);
+
+private:
+    int                        Fd;
+    size_t                     MappedSize;
+    CheckpointHeader*          Header;
+    CheckpointSlot*            Slots;
+    uint32_t                   SessionIdBase;
+    std::unique_ptr<bool[]>    bSlotLive; //< Process side copy of CheckpointSlot::bLive. (Sweep without touching the file)
+};
@@ -1,26 +1,74 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/select.h>
-#include <arpa/inet.h> 
+#include <arpa/inet.h>
+
+#include "config.hpp"
 
 class Session;
+struct Subscription;
+
+static_assert(MAX_REACTOR <= 32, "Client::subscribedReactorMask has a bit per reactor");
+
+// What to do when a client doesn't read its responses and the queued bytes exceed CLIENT_SEND_BUFFER_LIMIT
+enum class SendOverflowPolicy : uint8_t
+{
+    CoalesceAcks = 0, //< An input ack identical to the last queued ack is not queued again
+    DropAcks = 1,     //< Input acks are not queued. Other responses and round results are kept
+    Disconnect = 2    //< Close the connection
+};
 
 struct Client {
     int socket;
     sockaddr_in address;
     socklen_t   addressLen;
 
-    std::vector<Session*> sessions;
-    
+    uint32_t protocolVersion; //< Framing of the API queries. (1: Implicit size, 2: Length prefixed)
+
+    // Sessions owned by the client. Intrusive list through the sessions (Session::GetNextOwnedSession), kept by Session::SetOwnerClient()
+    Session* ownedSessions;
+
+    // Subscriptions of the client to sessions of each reactor. Intrusive lists, kept by Session::Subscribe() and Session::Unsubscribe()
+    // List r is only touched by reactor r. (Session ID partition r)
+    Subscription* subscriptions[MAX_REACTOR];
+    uint32_t      subscribedReactorMask; //< Reactors the client subscribed on, to unsubscribe on disconnect. Only touched by the reactor of the client
+
+    // Queries forwarded to the reactor owning the session. Parsing pauses until they are answered to keep responses in order.
+    uint32_t numPendingForwards;
+    bool     bClosing; //< Disconnected, deleted once numPendingForwards drops to 0
+
     // recv/send buffer (for partial recv/send)
     std::vector<char> recvBuffer;
     std::vector<char> sendBuffer;
-    
+    size_t sendBufferOffset; //< Bytes at the front of sendBuffer already sent
+
+    // Backpressure
+    SendOverflowPolicy sendOverflowPolicy;
+    bool     bSendOverflowed; //< Over the limit with the Disconnect policy, or over the hard limit. Closed by the main loop
+    size_t   lastAckEnd;      //< sendBuffer size right after the last queued input ack (For coalescing)
+    size_t   peakQueuedBytes;
+    uint64_t numDroppedAcks;
+    uint64_t numCoalescedAcks;
+
     inline Client()
         : addressLen(sizeof(sockaddr_in))
+        , protocolVersion(1)
+        , ownedSessions(nullptr)
+        , subscriptions{}
+        , subscribedReactorMask(0)
+        , numPendingForwards(0)
+        , bClosing(false)
+        , sendBufferOffset(0)
+        , sendOverflowPolicy(SendOverflowPolicy::CoalesceAcks)
+        , bSendOverflowed(false)
+        , lastAckEnd(0)
+        , peakQueuedBytes(0)
+        , numDroppedAcks(0)
+        , numCoalescedAcks(0)
     {
         recvBuffer.reserve(4096);
         sendBuffer.reserve(4096);
@@ -30,21 +78,42 @@ struct Client {
         : socket(src.socket)
         , address(src.address)
         , addressLen(src.addressLen)
-        , sessions(std::move(src.sessions))
+        , protocolVersion(src.protocolVersion)
+        , ownedSessions(nullptr) //< The sessions point to their owner. They stay with the source
+        , subscriptions{}        //< So do the subscriptions
+        , subscribedReactorMask(0)
+        , numPendingForwards(src.numPendingForwards)
+        , bClosing(src.bClosing)
         , recvBuffer(std::move(src.recvBuffer))
         , sendBuffer(std::move(src.sendBuffer))
+        , sendBufferOffset(src.sendBufferOffset)
+        , sendOverflowPolicy(src.sendOverflowPolicy)
+        , bSendOverflowed(src.bSendOverflowed)
+        , lastAckEnd(src.lastAckEnd)
+        , peakQueuedBytes(src.peakQueuedBytes)
+        , numDroppedAcks(src.numDroppedAcks)
+        , numCoalescedAcks(src.numCoalescedAcks)
     {
         src.socket = -1;
     }
 
-    inline Client& operator=(Client&& rhs) 
+    inline Client& operator=(Client&& rhs)
     {
         socket = rhs.socket;
         address = rhs.address;
         addressLen = rhs.addressLen;
-        sessions = std::move(rhs.sessions);
+        protocolVersion = rhs.protocolVersion;
+        numPendingForwards = rhs.numPendingForwards;
+        bClosing = rhs.bClosing;
         recvBuffer = std::move(rhs.recvBuffer);
         sendBuffer = std::move(rhs.sendBuffer);
+        sendBufferOffset = rhs.sendBufferOffset;
+        sendOverflowPolicy = rhs.sendOverflowPolicy;
+        bSendOverflowed = rhs.bSendOverflowed;
+        lastAckEnd = rhs.lastAckEnd;
+        peakQueuedBytes = rhs.peakQueuedBytes;
+        numDroppedAcks = rhs.numDroppedAcks;
+        numCoalescedAcks = rhs.numCoalescedAcks;
 
         return *this;
     }
@@ -53,4 +122,25 @@ struct Client {
     {
         close(socket);
     }
+
+    inline size_t GetQueuedBytes() const { return sendBuffer.size() - sendBufferOffset; }
+
+    inline const char* GetQueuedData() const { return sendBuffer.data() + sendBufferOffset; }
+
+    // Mark n queued bytes as sent.
+    // The sent prefix is only erased once it is large, instead of memmoving the backlog on every partial send.
+    inline void ConsumeSendBuffer(size_t n)
+    {
+        sendBufferOffset += n;
+        if (sendBufferOffset == sendBuffer.size()) {
+            sendBuffer.clear();
+            sendBufferOffset = 0;
+            lastAckEnd = 0;
+        }
+        else if (sendBufferOffset >= CLIENT_SEND_BUFFER_COMPACT_SIZE && sendBufferOffset * 2 >= sendBuffer.size()) {
+            sendBuffer.erase(sendBuffer.begin(), sendBuffer.begin() + sendBufferOffset);
+            lastAckEnd = (lastAckEnd >= sendBufferOffset) ? lastAckEnd - sendBufferOffset : 0;
+            sendBufferOffset = 0;
+        }
+    }
 };
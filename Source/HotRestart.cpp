@@ -0,0 +1,718 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "HotRestart.hpp"
+#include "Reactor.hpp"
+#include "ShmChannel.hpp"
+#include "Recorder.hpp"
+
+namespace
+{
+    struct __attribute__((packed)) Handoff_Request
+    {
+        uint32_t Magic;
+        uint32_t Version;
+        uint32_t NumReactors;
+        int32_t  ShardID;
+        uint16_t Port;
+    };
+
+    struct __attribute__((packed)) Handoff_Response
+    {
+        uint32_t Magic;
+        uint8_t  Result;    //< 0: Success, 1: Other configuration, 2: Busy (No quiet tick boundary)
+        uint32_t NumFds;    //< Sent next, HOT_RESTART_FDS_PER_MESSAGE per message
+        uint32_t ImageSize; //< Sent after the descriptors
+    };
+
+    struct __attribute__((packed)) Handoff_Ack
+    {
+        uint32_t Magic;
+        uint8_t  Result; //< 0: Taken over
+    };
+
+    /**
+     * Image layout
+     *  Image_Header
+     *  Image_Client + bytes             Shared memory channel (If ShmFd != -1)
+     *  Image_Reactor + Image_Client[]   Per reactor, clients with bytes. Clients are numbered across the reactors.
+     *  uint32 NumSessions + Image_Session[] with Image_Subscriber[]   Per reactor
+     * */
+    struct __attribute__((packed)) Image_Header
+    {
+        uint32_t NumReactors;
+        int32_t  UdpStreamFd; //< Index in the descriptors. -1: None
+        int32_t  UnixListenerFd;
+        int32_t  ShmFd;
+    };
+
+    struct __attribute__((packed)) Image_Reactor
+    {
+        int32_t  ListenFd;
+        int32_t  UdpInputFd;
+        uint32_t NumClients;
+    };
+
+    struct __attribute__((packed)) Image_Client
+    {
+        int32_t  Fd;
+        uint32_t Addr; //< Network byte order
+        uint16_t Port; //< Network byte order
+        uint8_t  ProtocolVersion;
+        uint8_t  OverflowPolicy;
+        uint32_t NumRecvBytes; //< Unparsed queries
+        uint32_t NumSendBytes; //< Unsent responses
+    };
+
+    constexpr int32_t imageOwner_None = -1;
+    constexpr int32_t imageOwner_Shm = -2;
+
+    struct __attribute__((packed)) Image_Session
+    {
+        int32_t           OwnerClient; //< Client number. imageOwner_None: Server owned, imageOwner_Shm: Shared memory channel
+        uint32_t          SessionID;
+        uint32_t          NumSubscribers;
+        Session::Snapshot Snapshot;
+    };
+
+    struct __attribute__((packed)) Image_Subscriber
+    {
+        int32_t  Client;
+        uint16_t RecvPort; //< Network byte order
+    };
+
+    template <typename T>
+    inline void Append(std::vector<char>& image, const T& value)
+    {
+        const char* const bytes = reinterpret_cast<const char*>(&value);
+        image.insert(image.end(), bytes, bytes + sizeof(T));
+    }
+
+    class ImageReader
+    {
+    public:
+        explicit ImageReader(const std::vector<char>& image) : Image(image), Offset(0) {}
+
+        bool Read(void* dest, size_t size)
+        {
+            if (Image.size() - Offset < size) {
+                return false;
+            }
+            memcpy(dest, Image.data() + Offset, size);
+            Offset += size;
+            return true;
+        }
+
+        template <typename T>
+        inline bool Read(T& value) { return Read(&value, sizeof(T)); }
+
+        bool ReadBytes(std::vector<char>& dest, size_t size)
+        {
+            if (Image.size() - Offset < size) {
+                return false;
+            }
+            dest.assign(Image.data() + Offset, Image.data() + Offset + size);
+            Offset += size;
+            return true;
+        }
+
+    private:
+        const std::vector<char>& Image;
+        size_t                   Offset;
+    };
+
+    bool SendAll(int sock, const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size != 0) {
+            const ssize_t nBytesSent = send(sock, bytes, size, MSG_NOSIGNAL);
+            if (nBytesSent <= 0) {
+                if (nBytesSent == -1 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            bytes += nBytesSent;
+            size -= (size_t)nBytesSent;
+        }
+        return true;
+    }
+
+    bool RecvAll(int sock, void* data, size_t size)
+    {
+        char* bytes = static_cast<char*>(data);
+        while (size != 0) {
+            const ssize_t nBytesRecv = recv(sock, bytes, size, 0);
+            if (nBytesRecv <= 0) {
+                if (nBytesRecv == -1 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            bytes += nBytesRecv;
+            size -= (size_t)nBytesRecv;
+        }
+        return true;
+    }
+
+    // One byte of payload carries the descriptors, so that they never ride along with the image bytes
+    bool SendFds(int sock, const int* fds, size_t numFds)
+    {
+        char payload = 0;
+        iovec iov = { &payload, sizeof(payload) };
+        char control[CMSG_SPACE(sizeof(int) * HOT_RESTART_FDS_PER_MESSAGE)];
+        memset(control, 0, sizeof(control));
+
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+
+        cmsghdr* const controlHeader = CMSG_FIRSTHDR(&message);
+        controlHeader->cmsg_level = SOL_SOCKET;
+        controlHeader->cmsg_type = SCM_RIGHTS;
+        controlHeader->cmsg_len = CMSG_LEN(sizeof(int) * numFds);
+        memcpy(CMSG_DATA(controlHeader), fds, sizeof(int) * numFds);
+
+        return sendmsg(sock, &message, MSG_NOSIGNAL) == (ssize_t)sizeof(payload);
+    }
+
+    bool RecvFds(int sock, std::vector<int>& fds)
+    {
+        char payload;
+        iovec iov = { &payload, sizeof(payload) };
+        char control[CMSG_SPACE(sizeof(int) * HOT_RESTART_FDS_PER_MESSAGE)];
+
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        if (recvmsg(sock, &message, 0) != (ssize_t)sizeof(payload) || (message.msg_flags & MSG_CTRUNC) != 0) {
+            return false;
+        }
+        for (cmsghdr* controlHeader = CMSG_FIRSTHDR(&message); controlHeader != nullptr; controlHeader = CMSG_NXTHDR(&message, controlHeader)) {
+            if (controlHeader->cmsg_level == SOL_SOCKET && controlHeader->cmsg_type == SCM_RIGHTS) {
+                const size_t numFds = (controlHeader->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                const size_t begin = fds.size();
+                fds.resize(begin + numFds);
+                memcpy(fds.data() + begin, CMSG_DATA(controlHeader), sizeof(int) * numFds);
+            }
+        }
+        return true;
+    }
+
+    void SetTimeout(int sock, uint32_t timeoutMs)
+    {
+        timeval timeout = { (time_t)(timeoutMs / 1000), (suseconds_t)(timeoutMs % 1000) * 1000 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    bool MakeUnixAddress(const std::string& path, sockaddr_un& address)
+    {
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Hot restart socket path too long" << std::endl;
+            return false;
+        }
+        strcpy(address.sun_path, path.c_str());
+        return true;
+    }
+
+    void SaveClient(std::vector<char>& image, std::vector<int>& fds, const Client& client)
+    {
+        Image_Client entry;
+        entry.Fd = -1;
+        if (client.socket != -1) {
+            entry.Fd = (int32_t)fds.size();
+            fds.push_back(client.socket);
+        }
+        entry.Addr = client.address.sin_addr.s_addr;
+        entry.Port = client.address.sin_port;
+        entry.ProtocolVersion = (uint8_t)client.protocolVersion;
+        entry.OverflowPolicy = (uint8_t)client.sendOverflowPolicy;
+        entry.NumRecvBytes = (uint32_t)client.recvBuffer.size();
+        entry.NumSendBytes = (uint32_t)client.GetQueuedBytes();
+        Append(image, entry);
+        image.insert(image.end(), client.recvBuffer.begin(), client.recvBuffer.end());
+        image.insert(image.end(), client.GetQueuedData(), client.GetQueuedData() + client.GetQueuedBytes());
+    }
+
+    bool RestoreClient(ImageReader& reader, const std::vector<int>& fds, Client& client)
+    {
+        Image_Client entry;
+        if (!reader.Read(entry) || entry.Fd >= (int32_t)fds.size()) {
+            return false;
+        }
+        client.socket = (entry.Fd < 0) ? -1 : fds[entry.Fd];
+        memset(&client.address, 0, sizeof(client.address));
+        client.address.sin_family = AF_INET;
+        client.address.sin_addr.s_addr = entry.Addr;
+        client.address.sin_port = entry.Port;
+        client.protocolVersion = entry.ProtocolVersion;
+        client.sendOverflowPolicy = (SendOverflowPolicy)entry.OverflowPolicy;
+        return reader.ReadBytes(client.recvBuffer, entry.NumRecvBytes)
+            && reader.ReadBytes(client.sendBuffer, entry.NumSendBytes);
+    }
+}
+
+HotRestart::HotRestart(const char* path)
+    : Path(path)
+    , ListenSocket(-1)
+    , Shm(nullptr)
+    , UdpStreamSocket(-1)
+    , UnixListenerSocket(-1)
+    , bFreezeRequested(false)
+    , NumFrozen(0)
+    , FreezeGeneration(0)
+    , Connection(-1)
+    , InheritedUdpStreamSocket(-1)
+    , InheritedUnixListenerSocket(-1)
+    , InheritedShmFd(-1)
+{
+}
+
+HotRestart::~HotRestart()
+{
+    if (Connection != -1) {
+        close(Connection);
+    }
+    if (ListenSocket != -1) {
+        close(ListenSocket);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                 New Process                                */
+/* -------------------------------------------------------------------------- */
+bool HotRestart::Connect(uint32_t numReactors, int32_t shardID, uint16_t port, bool& bTakeOver)
+{
+    bTakeOver = false;
+
+    sockaddr_un address;
+    if (!MakeUnixAddress(Path, address)) {
+        return false;
+    }
+    const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) {
+        return false;
+    }
+    if (connect(sock, (const struct sockaddr*)&address, sizeof(address)) == -1) {
+        // Nobody to take over from
+        close(sock);
+        return true;
+    }
+    SetTimeout(sock, HOT_RESTART_FREEZE_TIMEOUT_MS + HOT_RESTART_ACK_TIMEOUT_MS);
+
+    const Handoff_Request request = { HOT_RESTART_MAGIC, HOT_RESTART_VERSION, numReactors, shardID, port };
+    Handoff_Response response;
+    if (!SendAll(sock, &request, sizeof(request)) || !RecvAll(sock, &response, sizeof(response)) || response.Magic != HOT_RESTART_MAGIC) {
+        std::cerr << "Hot restart handshake failed" << std::endl;
+        close(sock);
+        return false;
+    }
+    if (response.Result != 0) {
+        std::cerr << "Hot restart refused by the running process: "
+                  << (response.Result == 1 ? "Other configuration (--reactors, --shard, --port) or version" : "No quiet tick boundary") << std::endl;
+        close(sock);
+        return false;
+    }
+
+    while (InheritedFds.size() < response.NumFds) {
+        if (!RecvFds(sock, InheritedFds)) {
+            std::cerr << "Failed to receive the sockets of the running process" << std::endl;
+            close(sock);
+            return false;
+        }
+    }
+    InheritedImage.resize(response.ImageSize);
+    Image_Header header;
+    if (!RecvAll(sock, InheritedImage.data(), InheritedImage.size())
+        || !ImageReader(InheritedImage).Read(header)
+        || header.NumReactors != numReactors) {
+        std::cerr << "Failed to receive the image of the running process" << std::endl;
+        close(sock);
+        return false;
+    }
+
+    const auto inheritedFd = [this](int32_t index) -> int {
+        return (index >= 0 && index < (int32_t)InheritedFds.size()) ? InheritedFds[index] : -1;
+    };
+    InheritedUdpStreamSocket = inheritedFd(header.UdpStreamFd);
+    InheritedUnixListenerSocket = inheritedFd(header.UnixListenerFd);
+    InheritedShmFd = inheritedFd(header.ShmFd);
+
+    Connection = sock;
+    bTakeOver = true;
+    return true;
+}
+
+bool HotRestart::Restore(const std::vector<Reactor*>& reactors, ShmChannel* shmChannel)
+{
+    const std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+    ImageReader reader(InheritedImage);
+
+    Image_Header header;
+    reader.Read(header);
+
+    // Sessions of the shared memory channel are dropped if the new process doesn't serve it
+    Client shmClientDiscarded;
+    shmClientDiscarded.socket = -1;
+    Client* const shmClient = (shmChannel != nullptr) ? &shmChannel->GetClient() : &shmClientDiscarded;
+    if (header.ShmFd != -1 && !RestoreClient(reader, InheritedFds, *shmClient)) {
+        return false;
+    }
+
+    // Clients
+    std::vector<Client*> clients;
+    for (Reactor* reactor : reactors)
+    {
+        Image_Reactor reactorEntry;
+        if (!reader.Read(reactorEntry)
+            || reactorEntry.ListenFd < 0 || reactorEntry.ListenFd >= (int32_t)InheritedFds.size()
+            || reactorEntry.UdpInputFd < 0 || reactorEntry.UdpInputFd >= (int32_t)InheritedFds.size()) {
+            return false;
+        }
+        reactor->ListenSocket = InheritedFds[reactorEntry.ListenFd];
+        reactor->UdpSocket_PlayerInput = InheritedFds[reactorEntry.UdpInputFd];
+        FD_SET(reactor->ListenSocket, &reactor->GlobalFdSet);
+        FD_SET(reactor->UdpSocket_PlayerInput, &reactor->GlobalFdSet);
+        reactor->GlobalFdSet_MaxFd = std::max({ reactor->GlobalFdSet_MaxFd, reactor->ListenSocket, reactor->UdpSocket_PlayerInput });
+
+        for (uint32_t i = 0; i < reactorEntry.NumClients; i++) {
+            Client* client = new Client;
+            if (!RestoreClient(reader, InheritedFds, *client) || client->socket == -1) {
+                delete client;
+                return false;
+            }
+            FD_SET(client->socket, &reactor->GlobalFdSet);
+            reactor->GlobalFdSet_MaxFd = std::max(reactor->GlobalFdSet_MaxFd, client->socket);
+            reactor->Clients.push_back(client);
+            clients.push_back(client);
+        }
+    }
+
+    // Sessions under their IDs in the old process
+    size_t numSessions = 0;
+    size_t numDroppedSessions = 0;
+    for (uint32_t reactorIndex = 0; reactorIndex < reactors.size(); reactorIndex++)
+    {
+        Reactor* const reactor = reactors[reactorIndex];
+        uint32_t numReactorSessions;
+        if (!reader.Read(numReactorSessions)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < numReactorSessions; i++)
+        {
+            Image_Session entry;
+            if (!reader.Read(entry) || entry.OwnerClient >= (int32_t)clients.size() || entry.Snapshot.Version != SESSION_SNAPSHOT_VERSION) {
+                return false;
+            }
+            std::vector<Image_Subscriber> subscribers(entry.NumSubscribers);
+            if (!reader.Read(subscribers.data(), sizeof(Image_Subscriber) * subscribers.size())) {
+                return false;
+            }
+            if (entry.OwnerClient == imageOwner_Shm && shmChannel == nullptr) {
+                numDroppedSessions += 1;
+                continue;
+            }
+            if (Session::GetSessionIdPartition(entry.SessionID) != reactorIndex || !Session::ReserveSessionId(entry.SessionID)) {
+                return false;
+            }
+
+            Client* const owner = (entry.OwnerClient >= 0) ? clients[entry.OwnerClient] : (entry.OwnerClient == imageOwner_Shm ? shmClient : nullptr);
+            Session* const session = new Session(owner, entry.Snapshot, reactor->Settings.UdpSocket_ObjectPos_Stream, reactorIndex);
+            assert(session->GetSessionID() == entry.SessionID);
+            reactor->Sessions.push_back(session);
+            reactor->UpdateSessionTimers(*session);
+            if (owner == nullptr && session->IsBotPlayer(Session::PlayerID::PlayerA) && session->IsBotPlayer(Session::PlayerID::PlayerB)) {
+                reactor->NumBotSession += 1;
+            }
+            // (Other ownerless sessions were recovered from a checkpoint and not reclaimed yet. The reclaim timeout starts over, like the other timers of the sessions)
+
+            for (const Image_Subscriber& subscriber : subscribers) {
+                if (subscriber.Client >= 0 && subscriber.Client < (int32_t)clients.size()) {
+                    session->Subscribe(clients[subscriber.Client], subscriber.RecvPort);
+                    clients[subscriber.Client]->subscribedReactorMask |= 1u << reactorIndex;
+                }
+                else if (subscriber.Client == imageOwner_Shm && shmChannel != nullptr) {
+                    session->Subscribe(shmClient, subscriber.RecvPort);
+                    shmClient->subscribedReactorMask |= 1u << reactorIndex;
+                }
+            }
+            numSessions += 1;
+        }
+    }
+
+    // The old process exits on the ack. From here on the sockets are only served by this process.
+    const Handoff_Ack ack = { HOT_RESTART_MAGIC, 0 };
+    const bool bAcked = SendAll(Connection, &ack, sizeof(ack));
+    close(Connection);
+    Connection = -1;
+    if (!bAcked) {
+        std::cerr << "The running process went away during the hot restart" << std::endl;
+        return false;
+    }
+
+    const int64_t restoreUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - beginTime).count();
+    std::cout << "[LOG] Took over " << clients.size() << " clients and " << numSessions << " sessions. Restored in " << restoreUs << "us" << std::endl;
+    if (numDroppedSessions != 0) {
+        std::cout << "[LOG] Dropped " << numDroppedSessions << " sessions of the shared memory channel. (No --shm)" << std::endl;
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                 Old Process                                */
+/* -------------------------------------------------------------------------- */
+bool HotRestart::Listen(const std::vector<Reactor*>& reactors, ShmChannel* shmChannel, int udpStreamSocket, int unixListenerSocket)
+{
+    Reactors = reactors;
+    Shm = shmChannel;
+    UdpStreamSocket = udpStreamSocket;
+    UnixListenerSocket = unixListenerSocket;
+
+    sockaddr_un address;
+    if (!MakeUnixAddress(Path, address)) {
+        return false;
+    }
+    ListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(Path.c_str()); //< Left by the previous process
+    if (ListenSocket == -1
+        || bind(ListenSocket, (const struct sockaddr*)&address, sizeof(address)) == -1
+        || listen(ListenSocket, 1) == -1) {
+        std::cerr << "Failed to listen on the hot restart socket: " << Path << std::endl;
+        return false;
+    }
+
+    std::thread(&HotRestart::ServeMain, this).detach();
+    std::cout << "[LOG] Hot restart socket: " << Path << std::endl;
+    return true;
+}
+
+void HotRestart::ServeMain()
+{
+    while (true)
+    {
+        const int connection = accept(ListenSocket, nullptr, nullptr);
+        if (connection == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Hot restart socket closed. errno: " << errno << std::endl;
+            return;
+        }
+        HandOff(connection);
+        close(connection);
+    }
+}
+
+void HotRestart::HandOff(int connection)
+{
+    SetTimeout(connection, HOT_RESTART_ACK_TIMEOUT_MS);
+
+    Handoff_Request request;
+    if (!RecvAll(connection, &request, sizeof(request))) {
+        return;
+    }
+
+    Handoff_Response response = { HOT_RESTART_MAGIC, 0, 0, 0 };
+    const Reactor::Config& settings = Reactors[0]->Settings;
+    if (request.Magic != HOT_RESTART_MAGIC || request.Version != HOT_RESTART_VERSION
+        || request.NumReactors != Reactors.size() || request.ShardID != settings.ShardID || request.Port != settings.Port) {
+        std::cout << "[LOG] Hot restart refused. The new process has another configuration." << std::endl;
+        response.Result = 1;
+        SendAll(connection, &response, sizeof(response));
+        return;
+    }
+
+    const std::chrono::steady_clock::time_point freezeTime = std::chrono::steady_clock::now();
+    if (!FreezeReactors()) {
+        std::cout << "[LOG] Hot restart refused. No tick boundary without queries in flight or migrated sessions." << std::endl;
+        response.Result = 2;
+        SendAll(connection, &response, sizeof(response));
+        return;
+    }
+
+    // Records of the old process end before the segment of the new one
+    Recorder::Flush();
+
+    std::vector<char> image;
+    std::vector<int> fds;
+    size_t numClients;
+    size_t numSessions;
+    SaveImage(image, fds, numClients, numSessions);
+    response.NumFds = (uint32_t)fds.size();
+    response.ImageSize = (uint32_t)image.size();
+
+    bool bHandedOff = SendAll(connection, &response, sizeof(response));
+    for (size_t i = 0; bHandedOff && i < fds.size(); i += HOT_RESTART_FDS_PER_MESSAGE) {
+        bHandedOff = SendFds(connection, fds.data() + i, std::min<size_t>(HOT_RESTART_FDS_PER_MESSAGE, fds.size() - i));
+    }
+    bHandedOff = bHandedOff && SendAll(connection, image.data(), image.size());
+
+    Handoff_Ack ack;
+    bHandedOff = bHandedOff && RecvAll(connection, &ack, sizeof(ack)) && ack.Magic == HOT_RESTART_MAGIC && ack.Result == 0;
+    if (!bHandedOff) {
+        std::cout << "[LOG] Hot restart failed. Resuming." << std::endl;
+        Recorder::BeginSegment(); //< The new process may have recorded already
+        ReleaseReactors();
+        return;
+    }
+
+    // The reactors stay frozen. Nothing is closed or unlinked, the new process serves all of it now.
+    const int64_t frozenUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - freezeTime).count();
+    std::cout << "[LOG] Handed off " << numClients << " clients and " << numSessions << " sessions. Frozen for " << frozenUs << "us. Exiting." << std::endl;
+    _exit(0);
+}
+
+void HotRestart::Freeze()
+{
+    std::unique_lock<std::mutex> lock(FreezeMutex);
+    const uint64_t generation = FreezeGeneration;
+    NumFrozen += 1;
+    FreezeCondition.notify_all();
+    FreezeCondition.wait(lock, [this, generation]() { return FreezeGeneration != generation; });
+}
+
+bool HotRestart::FreezeReactors()
+{
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(HOT_RESTART_FREEZE_TIMEOUT_MS);
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(FreezeMutex);
+            NumFrozen = 0;
+            bFreezeRequested.store(true, std::memory_order_release);
+            FreezeCondition.wait(lock, [this]() { return NumFrozen == Reactors.size(); });
+        }
+        if (IsQuiescent()) {
+            return true;
+        }
+
+        // A query or an input is still on its way between reactors. Let it land and try on a later tick.
+        ReleaseReactors();
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void HotRestart::ReleaseReactors()
+{
+    std::lock_guard<std::mutex> lock(FreezeMutex);
+    bFreezeRequested.store(false, std::memory_order_relaxed);
+    FreezeGeneration += 1;
+    FreezeCondition.notify_all();
+}
+
+bool HotRestart::IsQuiescent() const
+{
+    for (Reactor* reactor : Reactors)
+    {
+        {
+            std::lock_guard<std::mutex> lock(reactor->MailboxMutex);
+            if (!reactor->Mailbox.empty()) {
+                return false;
+            }
+        }
+        for (const Client* client : reactor->Clients) {
+            if (client->numPendingForwards != 0) {
+                return false;
+            }
+        }
+        if (!reactor->Migrator.IsIdle()) {
+            return false;
+        }
+    }
+    return Shm == nullptr || Shm->GetClient().numPendingForwards == 0;
+}
+
+void HotRestart::SaveImage(std::vector<char>& image, std::vector<int>& fds, size_t& numClients, size_t& numSessions) const
+{
+    const auto addFd = [&fds](int fd) -> int32_t {
+        if (fd == -1) {
+            return -1;
+        }
+        fds.push_back(fd);
+        return (int32_t)fds.size() - 1;
+    };
+
+    Image_Header header;
+    header.NumReactors = (uint32_t)Reactors.size();
+    header.UdpStreamFd = addFd(UdpStreamSocket);
+    header.UnixListenerFd = addFd(UnixListenerSocket);
+    header.ShmFd = (Shm != nullptr) ? addFd(Shm->GetFd()) : -1;
+    Append(image, header);
+    if (Shm != nullptr) {
+        SaveClient(image, fds, Shm->GetClient());
+    }
+
+    // Clients are numbered across the reactors, since spectators may be clients of another reactor
+    std::unordered_map<const Client*, int32_t> clientNumbers;
+    if (Shm != nullptr) {
+        clientNumbers[&Shm->GetClient()] = imageOwner_Shm;
+    }
+    for (Reactor* reactor : Reactors)
+    {
+        Image_Reactor reactorEntry;
+        reactorEntry.ListenFd = addFd(reactor->ListenSocket);
+        reactorEntry.UdpInputFd = addFd(reactor->UdpSocket_PlayerInput);
+        reactorEntry.NumClients = 0;
+        const size_t entryOffset = image.size();
+        Append(image, reactorEntry);
+
+        for (const Client* client : reactor->Clients) {
+            if (client->bClosing) {
+                continue;
+            }
+            const int32_t clientNumber = (int32_t)clientNumbers.size() - (Shm != nullptr ? 1 : 0);
+            clientNumbers[client] = clientNumber;
+            SaveClient(image, fds, *client);
+            reactorEntry.NumClients += 1;
+        }
+        memcpy(image.data() + entryOffset, &reactorEntry, sizeof(reactorEntry));
+    }
+    numClients = clientNumbers.size() - (Shm != nullptr ? 1 : 0);
+
+    const auto findClientNumber = [&clientNumbers](const Client* client) -> int32_t {
+        std::unordered_map<const Client*, int32_t>::const_iterator found = clientNumbers.find(client);
+        return (found != clientNumbers.end()) ? found->second : imageOwner_None;
+    };
+
+    numSessions = 0;
+    for (Reactor* reactor : Reactors)
+    {
+        Append(image, (uint32_t)reactor->Sessions.size());
+        for (const Session* session : reactor->Sessions)
+        {
+            Image_Session entry;
+            entry.OwnerClient = (session->GetOwnerClient() != nullptr) ? findClientNumber(session->GetOwnerClient()) : imageOwner_None;
+            entry.SessionID = session->GetSessionID();
+            entry.NumSubscribers = (uint32_t)session->GetNumSubscribers();
+            session->SaveSnapshot(entry.Snapshot);
+            Append(image, entry);
+
+            for (size_t i = 0; i < session->GetNumSubscribers(); i++) {
+                const Image_Subscriber subscriber = { findClientNumber(session->GetSubscriberClient(i)), session->GetSubscriberPort(i) };
+                Append(image, subscriber);
+            }
+            numSessions += 1;
+        }
+    }
+}
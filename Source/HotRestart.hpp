@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+
+class Reactor;
+class ShmChannel;
+
+/**
+ * Restart of the server binary without dropping connections or sessions. (`--hot-restart <path>`)
+ *
+ * The running process serves a Unix domain socket at the path. A new process started with the same path connects to it.
+ * The old process freezes all reactors between two ticks, once no query or UDP input is in flight between reactors,
+ * and sends over SCM_RIGHTS the listen sockets, the UDP sockets, the client sockets and the shared memory channel,
+ * with an image of the clients (Unparsed queries, unsent responses) and of all sessions. (Session::Snapshot)
+ * The new process restores them under the same session IDs, acknowledges and runs. The old process then exits
+ * without closing anything, so the connections never see the restart.
+ * If the new process fails before acknowledging, the old one resumes.
+ *
+ * Both processes must run the same number of reactors, shard ID and port.
+ * The handoff waits while sessions are migrated to another server. (See SessionMigrator)
+ * */
+class HotRestart
+{
+public:
+    explicit HotRestart(const char* path);
+
+    ~HotRestart();
+
+    // New process: take over from the process serving the path. bTakeOver is false if none does. (Fresh start)
+    // false if the running process refused or the handoff broke. (The old process keeps serving)
+    bool Connect(uint32_t numReactors, int32_t shardID, uint16_t port, bool& bTakeOver);
+
+    // Sockets received from the old process. -1: It had none
+    inline int GetUdpStreamSocket() const { return InheritedUdpStreamSocket; }
+
+    inline int GetUnixListenerSocket() const { return InheritedUnixListenerSocket; }
+
+    inline int GetShmFd() const { return InheritedShmFd; }
+
+    // Restore the clients and sessions into the reactors, which must not run yet, then let the old process exit.
+    // The reactors take the listen and UDP input sockets of the old ones instead of Open().
+    bool Restore(const std::vector<Reactor*>& reactors, ShmChannel* shmChannel);
+
+    // Serve the path for the next restart on a background thread
+    bool Listen(const std::vector<Reactor*>& reactors, ShmChannel* shmChannel, int udpStreamSocket, int unixListenerSocket);
+
+    // Called by every reactor between ticks. Blocks while the reactors are frozen.
+    inline void FreezePoint()
+    {
+        if (bFreezeRequested.load(std::memory_order_acquire)) {
+            Freeze();
+        }
+    }
+
+private:
+    void ServeMain();
+
+    // Hand everything to the connected new process. Returns only if the handoff failed.
+    void HandOff(int connection);
+
+    void Freeze();
+
+    // Freeze all reactors at a point where nothing is in flight between them. false on timeout
+    bool FreezeReactors();
+
+    void ReleaseReactors();
+
+    // Nothing would be lost by stopping here. (Only called while all reactors are frozen)
+    bool IsQuiescent() const;
+
+    // Image of the frozen reactors. Descriptors are referred to by their index in fds.
+    void SaveImage(std::vector<char>& image, std::vector<int>& fds, size_t& numClients, size_t& numSessions) const;
+
+private:
+    const std::string Path;
+
+    // Old process
+    int                   ListenSocket;
+    std::vector<Reactor*> Reactors;
+    ShmChannel*           Shm;
+    int                   UdpStreamSocket;
+    int                   UnixListenerSocket;
+
+    std::mutex              FreezeMutex;
+    std::condition_variable FreezeCondition;
+    std::atomic<bool>       bFreezeRequested;
+    uint32_t                NumFrozen;        //< Reactors blocked in Freeze() for the current generation
+    uint64_t                FreezeGeneration; //< Bumped on release
+
+    // New process
+    int               Connection; //< To the old process until Restore() acknowledged
+    std::vector<int>  InheritedFds;
+    std::vector<char> InheritedImage;
+    int               InheritedUdpStreamSocket;
+    int               InheritedUnixListenerSocket;
+    int               InheritedShmFd;
+};
@@ -0,0 +1,471 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "Migration.hpp"
+#include "Reactor.hpp"
+
+namespace
+{
+    struct __attribute__((packed)) MigrateSession_Response
+    {
+        uint32_t QueryID;
+        uint8_t Result;
+        uint32_t NewSessionID;
+        uint32_t PauseUs; //< Time the session was not simulated anywhere
+    };
+
+    struct __attribute__((packed)) ImportSession_Response
+    {
+        uint32_t QueryID;
+        uint8_t Result;
+        uint32_t SessionID;
+        uint16_t UdpInputPort; //< Network byte order
+    };
+
+    struct __attribute__((packed)) EnableUdpInput_Response
+    {
+        uint32_t QueryID;
+        uint8_t Result;
+        uint16_t UdpInputPort; //< Network byte order
+    };
+
+    // Queries with the SessionID at the front of the param
+    inline bool IsSessionQuery(uint32_t queryID)
+    {
+        switch (queryID) {
+        case 102: case 104: case 201: case 301: case 302: case 401: case 402: case 403:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    inline bool IsOwnerOnlyQuery(uint32_t queryID)
+    {
+        return queryID == 104 || queryID == 302 || queryID == 403;
+    }
+}
+
+SessionMigrator::SessionMigrator(QueryContext& context, fd_set& globalFdSet, int& globalFdSet_MaxFd)
+    : Context(context)
+    , GlobalFdSet(globalFdSet)
+    , GlobalFdSet_MaxFd(globalFdSet_MaxFd)
+{
+}
+
+SessionMigrator::~SessionMigrator()
+{
+    for (std::pair<const uint32_t, MigratedSession>& migrated : MigratedSessions) {
+        delete migrated.second.Frozen;
+    }
+    for (Link* link : Links) {
+        delete link;
+    }
+}
+
+SessionMigrator::Link* SessionMigrator::GetLink(Client& owner, const sockaddr_in& targetAddr)
+{
+    for (Link* link : Links) {
+        if (link->Owner == &owner
+            && link->TargetAddr.sin_addr.s_addr == targetAddr.sin_addr.s_addr
+            && link->TargetAddr.sin_port == targetAddr.sin_port) {
+            return link;
+        }
+    }
+
+    // Blocking connect. Migration targets are expected in the same data center, where it takes a round trip.
+    const int linkSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (linkSocket == -1) {
+        return nullptr;
+    }
+    if (linkSocket >= FD_SETSIZE || connect(linkSocket, (const struct sockaddr*)&targetAddr, sizeof(targetAddr)) == -1) {
+        std::cout << "[LOG] Failed to connect to migration target " << inet_ntoa(targetAddr.sin_addr) << ":" << ntohs(targetAddr.sin_port) << std::endl;
+        close(linkSocket);
+        return nullptr;
+    }
+    int opt = 1;
+    setsockopt(linkSocket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    Link* link = new Link;
+    link->Connection.socket = linkSocket;
+    link->Connection.address = targetAddr;
+    link->TargetAddr = targetAddr;
+    link->Owner = &owner;
+    link->TargetUdpInputPort = 0;
+
+    // Upgrade to v2 first, so that every response after the upgrade response carries its length
+    const uint32_t upgradeQuery[2] = { 1, 2 };
+    AppendQueryResponse(link->Connection, upgradeQuery, sizeof(upgradeQuery));
+    link->Connection.protocolVersion = 2;
+    link->NumSkipBytes = sizeof(uint32_t) + sizeof(uint8_t);
+
+    FD_SET(linkSocket, &GlobalFdSet);
+    GlobalFdSet_MaxFd = std::max(GlobalFdSet_MaxFd, linkSocket);
+    Links.push_back(link);
+    return link;
+}
+
+void SessionMigrator::MigrateSession(Client& requester, uint32_t queryID, uint32_t sessionID, const sockaddr_in& targetAddr)
+{
+    // Sessions of this reactor only. Server owned sessions have no owner to relay the round results to.
+    // Only the owner may migrate, or any client could hand the session of another to a server of its choice.
+    Session* const session = (Context.OwnerReactor->GetRemoteReactor(sessionID) == nullptr) ? Session::FindSession(sessionID) : nullptr;
+    if (session == nullptr || session->GetOwnerClient() != &requester) {
+        SendMigrateResponse(requester, queryID, false, 0, 0);
+        return;
+    }
+
+    Link* const link = GetLink(*session->GetOwnerClient(), targetAddr);
+    if (link == nullptr) {
+        SendMigrateResponse(requester, queryID, false, 0, 0);
+        return;
+    }
+
+    // Freeze. Queries are handled between ticks, so the snapshot is at a tick boundary.
+    struct __attribute__((packed)) ImportSession_Frame
+    {
+        uint32_t QueryID;
+        Session::Snapshot Snapshot;
+    } frame;
+    frame.QueryID = 106;
+    session->SaveSnapshot(frame.Snapshot);
+    session->SetMigrated(true);
+    Context.Sessions.Remove(session);
+
+    AppendQueryResponse(link->Connection, &frame, sizeof(frame));
+    link->PendingResponses.push_back({ &requester, frame.QueryID, sessionID });
+
+    MigratedSession& migrated = MigratedSessions[sessionID];
+    migrated.Frozen = session;
+    migrated.SessionLink = link;
+    migrated.bImporting = true;
+    migrated.NewSessionID = 0;
+    migrated.MigrateRequester = &requester;
+    migrated.MigrateQueryID = queryID;
+    migrated.FreezeTime = std::chrono::steady_clock::now();
+
+    // The response is sent once the target answered
+    requester.numPendingForwards += 1;
+
+    // Don't wait for the next poll
+    const ssize_t nBytesSent = send(link->Connection.socket, link->Connection.GetQueuedData(), link->Connection.GetQueuedBytes(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (nBytesSent > 0) {
+        link->Connection.ConsumeSendBuffer((size_t)nBytesSent);
+    }
+}
+
+SessionMigrator::RelayResult SessionMigrator::RelayQuery(Client& client, uint32_t queryID, const char* param, size_t paramSize)
+{
+    uint32_t sessionID;
+    if (MigratedSessions.empty() || !IsSessionQuery(queryID) || paramSize < sizeof(sessionID)) {
+        return RelayResult::NotMigrated;
+    }
+    memcpy(&sessionID, param, sizeof(sessionID));
+
+    std::unordered_map<uint32_t, MigratedSession>::iterator migratedIt = MigratedSessions.find(sessionID);
+    if (migratedIt == MigratedSessions.end()) {
+        return RelayResult::NotMigrated;
+    }
+    MigratedSession& migrated = migratedIt->second;
+
+    if (migrated.bImporting) {
+        client.numPendingForwards += 1;
+        migrated.Waiters.push_back(&client);
+        return RelayResult::Wait;
+    }
+
+    // The target only sees the link, which owns the session there. Fails in place. (The session is hidden)
+    Link& link = *migrated.SessionLink;
+    if (queryID == 401 || queryID == 402 || (IsOwnerOnlyQuery(queryID) && &client != link.Owner)) {
+        return RelayResult::NotMigrated;
+    }
+
+    // Same frame with the new session ID
+    char* const frame = AllocQueryResponse(link.Connection, sizeof(queryID) + paramSize);
+    memcpy(frame, &queryID, sizeof(queryID));
+    memcpy(frame + sizeof(queryID), &migrated.NewSessionID, sizeof(migrated.NewSessionID));
+    memcpy(frame + sizeof(queryID) + sizeof(sessionID), param + sizeof(sessionID), paramSize - sizeof(sessionID));
+
+    link.PendingResponses.push_back({ &client, queryID, sessionID });
+    client.numPendingForwards += 1;
+    return RelayResult::Relayed;
+}
+
+bool SessionMigrator::RelayUdpInputPacket(int udpSocket, const char* packet, size_t size)
+{
+    // PlayerInput and StateAck packets both start with {uint16 PacketType, uint32 SessionID}
+    constexpr size_t sessionIdOffset = sizeof(uint16_t);
+    uint32_t sessionID;
+    if (MigratedSessions.empty() || size < sessionIdOffset + sizeof(sessionID)) {
+        return false;
+    }
+    memcpy(&sessionID, packet + sessionIdOffset, sizeof(sessionID));
+
+    std::unordered_map<uint32_t, MigratedSession>::iterator migratedIt = MigratedSessions.find(sessionID);
+    if (migratedIt == MigratedSessions.end()) {
+        return false;
+    }
+
+    // The target accepts input from the host of the owner of the session, which is the link (This server)
+    const MigratedSession& migrated = migratedIt->second;
+    const Link& link = *migrated.SessionLink;
+    if (!migrated.bImporting && link.TargetUdpInputPort != 0 && size <= 256) {
+        char relayedPacket[256];
+        memcpy(relayedPacket, packet, size);
+        memcpy(relayedPacket + sessionIdOffset, &migrated.NewSessionID, sizeof(migrated.NewSessionID));
+
+        sockaddr_in targetAddr = link.TargetAddr;
+        targetAddr.sin_port = htons(link.TargetUdpInputPort);
+        sendto(udpSocket, relayedPacket, size, 0, (const struct sockaddr*)&targetAddr, sizeof(targetAddr));
+    }
+    return true;
+}
+
+void SessionMigrator::DisconnectClient(Client& client)
+{
+    for (size_t i = 0; i < Links.size();) {
+        if (Links[i]->Owner == &client) {
+            CloseLink(Links[i], true);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+void SessionMigrator::Poll(const fd_set& recvFdSet, const fd_set& sendFdSet)
+{
+    for (size_t i = 0; i < Links.size();)
+    {
+        Link& link = *Links[i];
+        Client& connection = link.Connection;
+        bool bConnected = !connection.bSendOverflowed;
+
+        if (bConnected && FD_ISSET(connection.socket, &sendFdSet) && connection.GetQueuedBytes() != 0) {
+            const ssize_t nBytesSent = send(connection.socket, connection.GetQueuedData(), connection.GetQueuedBytes(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (nBytesSent == -1) {
+                bConnected = (errno == EAGAIN || errno == EWOULDBLOCK);
+            }
+            else {
+                connection.ConsumeSendBuffer((size_t)nBytesSent);
+            }
+        }
+
+        if (bConnected && FD_ISSET(connection.socket, &recvFdSet)) {
+            char buffer[4096];
+            const ssize_t nBytesRecv = recv(connection.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (nBytesRecv == 0 || (nBytesRecv == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                bConnected = false;
+            }
+            else if (nBytesRecv > 0) {
+                connection.recvBuffer.insert(connection.recvBuffer.end(), buffer, buffer + nBytesRecv);
+                bConnected = HandleLinkResponses(link);
+            }
+        }
+
+        if (!bConnected) {
+            std::cout << "[LOG] Migration link to " << inet_ntoa(link.TargetAddr.sin_addr) << ":" << ntohs(link.TargetAddr.sin_port) << " lost" << std::endl;
+            CloseLink(&link, false);
+            continue;
+        }
+        i++;
+    }
+}
+
+bool SessionMigrator::HandleLinkResponses(Link& link)
+{
+    Client& connection = link.Connection;
+    const char* const data = connection.recvBuffer.data();
+    const size_t size = connection.recvBuffer.size();
+
+    size_t offset = std::min(link.NumSkipBytes, size);
+    link.NumSkipBytes -= offset;
+
+    struct __attribute__((packed)) Response_Header
+    {
+        uint32_t QueryID;
+        uint8_t Result;
+    } header;
+
+    uint32_t length;
+    while (size - offset >= sizeof(length))
+    {
+        memcpy(&length, data + offset, sizeof(length));
+        if (length < sizeof(header) || length > QUERY_V2_MAX_FRAME_LENGTH) {
+            return false;
+        }
+        if (size - offset - sizeof(length) < length) {
+            break;
+        }
+        const char* const response = data + offset + sizeof(length);
+        offset += sizeof(length) + length;
+        memcpy(&header, response, sizeof(header));
+
+        // Round result of a session of the owner. (The BeginRound response has no WinPlayer)
+        if (header.QueryID == 201 && length == sizeof(uint32_t) * 2) {
+            AppendQueryResponse(*link.Owner, response, length);
+            continue;
+        }
+
+        if (link.PendingResponses.empty()) {
+            return false;
+        }
+        const PendingResponse pending = link.PendingResponses.front();
+        link.PendingResponses.pop_front();
+
+        if (pending.QueryID == 106) {
+            CompleteImport(link, pending, response, length);
+            continue;
+        }
+
+        Client& requester = *pending.Requester;
+        if (!requester.bClosing) {
+            if (pending.QueryID == 301) {
+                AppendQueryAck(requester, response, length);
+            }
+            else if (pending.QueryID == 302 && length >= sizeof(EnableUdpInput_Response)) {
+                // UDP input keeps coming to this server, and is forwarded
+                EnableUdpInput_Response udpResponse;
+                memcpy(&udpResponse, response, sizeof(udpResponse));
+                udpResponse.UdpInputPort = htons(Context.UdpInputPort);
+                SendQueryResponse(requester, udpResponse);
+            }
+            else {
+                AppendQueryResponse(requester, response, length);
+            }
+        }
+
+        // Aborted on the target. The old session ID can be reused.
+        if (pending.QueryID == 102 && header.Result == 0) {
+            std::unordered_map<uint32_t, MigratedSession>::iterator migratedIt = MigratedSessions.find(pending.SessionID);
+            if (migratedIt != MigratedSessions.end()) {
+                delete migratedIt->second.Frozen;
+                MigratedSessions.erase(migratedIt);
+            }
+        }
+        Resume(pending.Requester);
+    }
+
+    connection.recvBuffer.erase(connection.recvBuffer.begin(), connection.recvBuffer.begin() + offset);
+    return true;
+}
+
+void SessionMigrator::CompleteImport(Link& link, const PendingResponse& pending, const char* response, size_t size)
+{
+    std::unordered_map<uint32_t, MigratedSession>::iterator migratedIt = MigratedSessions.find(pending.SessionID);
+    if (migratedIt == MigratedSessions.end()) {
+        return;
+    }
+    MigratedSession& migrated = migratedIt->second;
+
+    ImportSession_Response importResponse;
+    const bool bImported = (size >= sizeof(importResponse)) && (memcpy(&importResponse, response, sizeof(importResponse)), importResponse.Result == 0);
+    const uint32_t pauseUs = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - migrated.FreezeTime).count();
+
+    if (bImported) {
+        migrated.bImporting = false;
+        migrated.NewSessionID = importResponse.SessionID;
+        link.TargetUdpInputPort = ntohs(importResponse.UdpInputPort);
+        std::cout << "[LOG] Session " << pending.SessionID << " migrated to " << inet_ntoa(link.TargetAddr.sin_addr) << ":" << ntohs(link.TargetAddr.sin_port)
+                  << " as " << migrated.NewSessionID << ". Pause: " << pauseUs << "us" << std::endl;
+    }
+    else {
+        // Resume here. The transfer time is simulated on the next tick.
+        std::cout << "[LOG] Session " << pending.SessionID << " was not imported by " << inet_ntoa(link.TargetAddr.sin_addr) << ":" << ntohs(link.TargetAddr.sin_port) << std::endl;
+        migrated.Frozen->SetMigrated(false);
+        Context.Sessions.push_back(migrated.Frozen);
+        Context.OwnerReactor->UpdateSessionTimers(*migrated.Frozen);
+        Context.OwnerReactor->SaveCheckpoint(*migrated.Frozen);
+    }
+
+    SendMigrateResponse(*migrated.MigrateRequester, migrated.MigrateQueryID, bImported, migrated.NewSessionID, pauseUs);
+    Resume(migrated.MigrateRequester);
+    for (Client* waiter : migrated.Waiters) {
+        Resume(waiter);
+    }
+
+    if (!bImported) {
+        MigratedSessions.erase(migratedIt);
+    }
+    else {
+        migrated.Waiters.clear();
+    }
+}
+
+void SessionMigrator::SendMigrateResponse(Client& requester, uint32_t queryID, bool bSuccess, uint32_t newSessionID, uint32_t pauseUs)
+{
+    if (requester.bClosing) {
+        return;
+    }
+    MigrateSession_Response response;
+    response.QueryID = queryID;
+    response.Result = bSuccess ? 0 : 1;
+    response.NewSessionID = bSuccess ? newSessionID : 0;
+    response.PauseUs = bSuccess ? pauseUs : 0;
+    SendQueryResponse(requester, response);
+}
+
+void SessionMigrator::Resume(Client* client)
+{
+    // Resumed from the mailbox, not while a link or the client list is being iterated
+    QueryContext* const context = &Context;
+    Context.OwnerReactor->Post([context, client]() {
+        client->numPendingForwards -= 1;
+        if (!client->bClosing) {
+            HandleQueries(*context, *client);
+        }
+    });
+}
+
+void SessionMigrator::CloseLink(Link* link, bool bOwnerDisconnected)
+{
+    // Queries relayed on the link are not answered by the target anymore
+    for (const PendingResponse& pending : link->PendingResponses) {
+        if (pending.QueryID == 106) {
+            continue; //< Answered below
+        }
+        if (!pending.Requester->bClosing) {
+            SendQueryFailure(*pending.Requester, pending.QueryID);
+        }
+        Resume(pending.Requester);
+    }
+
+    for (std::unordered_map<uint32_t, MigratedSession>::iterator migratedIt = MigratedSessions.begin(); migratedIt != MigratedSessions.end();)
+    {
+        MigratedSession& migrated = migratedIt->second;
+        if (migrated.SessionLink != link) {
+            ++migratedIt;
+            continue;
+        }
+
+        // An import in progress is rolled back while the owner is still there
+        const bool bImporting = migrated.bImporting;
+        if (bImporting) {
+            SendMigrateResponse(*migrated.MigrateRequester, migrated.MigrateQueryID, false, 0, 0);
+            Resume(migrated.MigrateRequester);
+            for (Client* waiter : migrated.Waiters) {
+                Resume(waiter);
+            }
+        }
+        if (bImporting && !bOwnerDisconnected) {
+            migrated.Frozen->SetMigrated(false);
+            Context.Sessions.push_back(migrated.Frozen);
+            Context.OwnerReactor->UpdateSessionTimers(*migrated.Frozen);
+            Context.OwnerReactor->SaveCheckpoint(*migrated.Frozen);
+        }
+        else {
+            delete migrated.Frozen;
+        }
+        migratedIt = MigratedSessions.erase(migratedIt);
+    }
+
+    FD_CLR(link->Connection.socket, &GlobalFdSet);
+    Links.erase(std::find(Links.begin(), Links.end(), link));
+    delete link;
+}
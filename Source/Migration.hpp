@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <sys/select.h>
+#include <arpa/inet.h>
+
+#include "config.hpp"
+#include "Client.hpp"
+#include "Session.hpp"
+#include "Query.hpp"
+
+/**
+ * Live migration of sessions to another server. (MigrateSession_v1 / ImportSession_v1)
+ *
+ * The session is frozen between ticks, saved to a Session::Snapshot and imported by the target over a link connection.
+ * Every owner client gets its own link to each target, so the target pushes the round results of the owner's sessions on it.
+ * The target owns the imported session on behalf of the link, and streams straight to the stream address of the session.
+ *
+ * The old session ID stays reserved on this server. Queries on it are relayed to the target with the new ID,
+ * and their responses are sent back in order. (Parsing of the requester pauses like a forward to another reactor)
+ * UDP input and stream acks sent to this server are forwarded to the UDP input port of the target.
+ * Owner-only queries are only relayed for the owner. Subscriptions stay on the old server and fail.
+ * */
+class SessionMigrator
+{
+public:
+    explicit SessionMigrator(QueryContext& context, fd_set& globalFdSet, int& globalFdSet_MaxFd);
+
+    ~SessionMigrator();
+
+    // Freeze the session and import it to the server at targetAddr.
+    // The requester gets the MigrateSession response once the target answered. (Or right away on failure)
+    void MigrateSession(Client& requester, uint32_t queryID, uint32_t sessionID, const sockaddr_in& targetAddr);
+
+    enum class RelayResult
+    {
+        NotMigrated, //< Handle in place
+        Relayed,     //< Sent to the target. The client waits for the response
+        Wait         //< Migration in progress. The query stays in the receive buffer until it is done
+    };
+
+    // Relay a query on a migrated session. Only queries with the SessionID at the front of the param are relayed.
+    RelayResult RelayQuery(Client& client, uint32_t queryID, const char* param, size_t paramSize);
+
+    // Forward a UDP input packet of a migrated session to the target. false if the session is not migrated.
+    bool RelayUdpInputPacket(int udpSocket, const char* packet, size_t size);
+
+    // Close the links of the disconnected owner. The target aborts the sessions.
+    void DisconnectClient(Client& client);
+
+    // Send and receive on the links, and relay the responses
+    void Poll(const fd_set& recvFdSet, const fd_set& sendFdSet);
+
+    // No session of the reactor is migrated out. (Links without sessions can be dropped)
+    inline bool IsIdle() const { return MigratedSessions.empty(); }
+
+private:
+    struct PendingResponse
+    {
+        Client*  Requester; //< Kept alive by numPendingForwards
+        uint32_t QueryID;
+        uint32_t SessionID; //< Old session ID
+    };
+
+    struct Link
+    {
+        Client                      Connection;
+        sockaddr_in                 TargetAddr;
+        Client*                     Owner;
+        uint16_t                    TargetUdpInputPort; //< Host byte order. 0: Unknown yet
+        size_t                      NumSkipBytes;       //< UpgradeProtocol response, still in v1 framing
+        std::deque<PendingResponse> PendingResponses;
+    };
+
+    struct MigratedSession
+    {
+        Session*              Frozen;       //< Holds the session ID
+        Link*                 SessionLink;
+        bool                  bImporting;   //< Waiting for the ImportSession response
+        uint32_t              NewSessionID;
+        std::vector<Client*>  Waiters;      //< Queries waiting for the import (Kept alive by numPendingForwards)
+        Client*               MigrateRequester;
+        uint32_t              MigrateQueryID;
+        std::chrono::steady_clock::time_point FreezeTime;
+    };
+
+private:
+    Link* GetLink(Client& owner, const sockaddr_in& targetAddr);
+
+    // Relay complete response frames of the link. false if the link is broken.
+    bool HandleLinkResponses(Link& link);
+
+    void CompleteImport(Link& link, const PendingResponse& pending, const char* response, size_t size);
+
+    void SendMigrateResponse(Client& requester, uint32_t queryID, bool bSuccess, uint32_t newSessionID, uint32_t pauseUs);
+
+    // Let the client parse its queries again, after the current event loop step
+    void Resume(Client* client);
+
+    // Roll back the imports in progress. Relayed sessions are lost with the link.
+    void CloseLink(Link* link, bool bOwnerDisconnected);
+
+private:
+    QueryContext& Context;
+    fd_set&       GlobalFdSet;
+    int&          GlobalFdSet_MaxFd;
+
+    std::vector<Link*>                            Links;
+    std::unordered_map<uint32_t, MigratedSession> MigratedSessions; //< By old session ID
+};
@@ -0,0 +1,893 @@
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "Query.hpp"
+#include "Reactor.hpp"
+#include "Migration.hpp"
+#include "Trace.hpp"
+
+namespace
+{
+    /* -------------------------------------------------------------------------- */
+    /*                                Query Params                                */
+    /* -------------------------------------------------------------------------- */
+    struct __attribute__((packed)) UpgradeProtocol_Param
+    {
+        uint32_t Version;
+    };
+
+    struct __attribute__((packed)) SetClientAddress_Param
+    {
+        uint32_t Addr; //< Network byte order
+    };
+
+    // Query without param
+    struct __attribute__((packed)) Empty_Param
+    {
+    };
+
+    struct __attribute__((packed)) CreateSession_v1_Param
+    {
+        uint32_t FieldWidth;
+        uint32_t FieldHeight;
+        uint32_t WinScore;
+        uint32_t GameTime;
+        uint32_t BallSpeed;
+        uint32_t BallRadius;
+        uint32_t PaddleSpeed;
+        uint32_t PaddleSize;
+        uint32_t PaddleOffsetFromWall;
+        uint16_t RecvPort_ObjectPos_Stream;
+    };
+
+    struct __attribute__((packed)) CreateSession_v2_Param
+    {
+        CreateSession_v1_Param Base;
+        uint8_t StreamMode;
+        uint16_t StreamRate; //< State packets per second. 0: Every tick
+    };
+
+    struct __attribute__((packed)) CreateSession_v3_Param
+    {
+        CreateSession_v2_Param Base;
+        uint64_t Seed; //< Session RNG. 0: Derived from the server seed
+    };
+
+    struct __attribute__((packed)) SessionID_Param
+    {
+        uint32_t SessionID;
+    };
+
+    struct __attribute__((packed)) SetStreamMode_Param
+    {
+        uint32_t SessionID;
+        uint8_t StreamMode;
+    };
+
+    struct __attribute__((packed)) ActionPlayerInput_Param
+    {
+        uint32_t SessionID;
+        uint32_t PlayerID;
+        uint8_t InputKey;
+        uint8_t InputType;
+    };
+
+    struct __attribute__((packed)) SubscribeSession_Param
+    {
+        uint32_t SessionID;
+        uint16_t RecvPort_ObjectPos_Stream; //< Network byte order
+    };
+
+    struct __attribute__((packed)) SetSessionMulticast_Param
+    {
+        uint32_t SessionID;
+        uint32_t GroupAddr; //< Network byte order. 0: Disable
+        uint16_t Port;      //< Network byte order
+    };
+
+    struct __attribute__((packed)) MigrateSession_Param
+    {
+        uint32_t SessionID;
+        uint32_t TargetAddr; //< Network byte order
+        uint16_t TargetPort; //< Network byte order
+    };
+
+    // Param header of bulk queries. Followed by Count entries.
+    struct __attribute__((packed)) Bulk_Param
+    {
+        uint16_t Count;
+    };
+
+    // Response of queries without payload
+    struct __attribute__((packed)) Result_Response
+    {
+        uint32_t QueryID;
+        uint8_t Result;
+    };
+
+    // Response header of bulk queries. Followed by Count entries in the order of the query.
+    struct __attribute__((packed)) Bulk_Response
+    {
+        uint32_t QueryID;
+        uint8_t Result; //< 0: All entries succeeded
+        uint16_t Count;
+    };
+
+    inline void SendResult(Client& client, uint32_t queryID, bool bSuccess)
+    {
+        Result_Response response;
+        response.QueryID = queryID;
+        response.Result = bSuccess ? 0 : 1;
+        SendQueryResponse(client, response);
+    }
+
+    // Result of a player input query. Subject to the send overflow policy (See SendQueryAck())
+    inline void SendAckResult(Client& client, uint32_t queryID, bool bSuccess)
+    {
+        Result_Response response;
+        response.QueryID = queryID;
+        response.Result = bSuccess ? 0 : 1;
+        SendQueryAck(client, response);
+    }
+
+    // Begin a bulk response and return where to write the entries
+    template <typename TEntry>
+    inline TEntry* AllocBulkResponse(Client& client, uint32_t queryID, uint8_t result, uint16_t count)
+    {
+        char* response = AllocQueryResponse(client, sizeof(Bulk_Response) + sizeof(TEntry) * count);
+        const Bulk_Response header = { queryID, result, count };
+        memcpy(response, &header, sizeof(header));
+        return reinterpret_cast<TEntry*>(response + sizeof(header));
+    }
+
+    // Session of the reactor of the context. nullptr for sessions of the other reactors.
+    inline Session* FindSession(QueryContext& context, uint32_t sessionID)
+    {
+        if (context.OwnerReactor->GetRemoteReactor(sessionID) != nullptr) {
+            return nullptr;
+        }
+        return Session::FindSession(sessionID);
+    }
+
+    // Run the operation on the reactor owning the session, then send its result to the client from this reactor.
+    // Parsing of the client pauses until then, so responses stay in the order of the queries.
+    // Returns false if the session belongs to this reactor. (The caller handles it in place)
+    template <typename TOperation>
+    bool ForwardSessionQuery(QueryContext& context, Client& client, uint32_t queryID, uint32_t sessionID, bool bAck, TOperation operation)
+    {
+        Reactor* const remoteReactor = context.OwnerReactor->GetRemoteReactor(sessionID);
+        if (remoteReactor == nullptr) {
+            return false;
+        }
+
+        QueryContext* const originContext = &context;
+        Client* const requester = &client; //< Kept alive by numPendingForwards
+        client.numPendingForwards += 1;
+        remoteReactor->Post([=]() {
+            QueryContext& remoteContext = remoteReactor->GetQueryContext();
+            Session* const session = FindSession(remoteContext, sessionID);
+            const bool bSuccess = (session != nullptr) && operation(remoteContext, session);
+
+            originContext->OwnerReactor->Post([=]() {
+                requester->numPendingForwards -= 1;
+                if (requester->bClosing) {
+                    return;
+                }
+                if (bAck) {
+                    SendAckResult(*requester, queryID, bSuccess);
+                }
+                else {
+                    SendResult(*requester, queryID, bSuccess);
+                }
+
+                // Resume the queries received in the meantime
+                HandleQueries(*originContext, *requester);
+            });
+        });
+        return true;
+    }
+
+    /* -------------------------------------------------------------------------- */
+    /*                               Query Handlers                               */
+    /* -------------------------------------------------------------------------- */
+    // UpgradeProtocol_v1
+    void HandleUpgradeProtocol(QueryContext&, Client& client, uint32_t queryID, const UpgradeProtocol_Param& param)
+    {
+        std::cout << "[DEBUG] UpgradeProtocol_v1: " << param.Version << std::endl;
+
+        // Only v1 -> v2. The response is still in the framing of the old version.
+        if (param.Version != 2 || client.protocolVersion != 1) {
+            SendResult(client, queryID, false);
+            return;
+        }
+        SendResult(client, queryID, true);
+        client.protocolVersion = 2;
+    }
+
+    // SetClientAddress_v1
+    // A router connects on behalf of its clients, so the UDP streams and input must use the address of the real client
+    void HandleSetClientAddress(QueryContext& context, Client& client, uint32_t queryID, const SetClientAddress_Param& param)
+    {
+        std::cout << "[DEBUG] SetClientAddress_v1: " << inet_ntoa(in_addr{ param.Addr }) << std::endl;
+
+        // Only shards trust it. (The port of a shard must only be reachable by routers)
+        if (context.ShardID < 0) {
+            SendResult(client, queryID, false);
+            return;
+        }
+        client.address.sin_addr.s_addr = param.Addr;
+
+        // The router counts the responses to keep them in order, so its acks must not be coalesced or dropped.
+        // It applies the overflow policy to its own clients instead.
+        client.sendOverflowPolicy = SendOverflowPolicy::Disconnect;
+        SendResult(client, queryID, true);
+    }
+
+    // GetServerStatus_v1
+    // Utilization of the server, polled by routers for load balancing
+    void HandleGetServerStatus(QueryContext& context, Client& client, uint32_t queryID, const Empty_Param&)
+    {
+        struct __attribute__((packed)) GetServerStatus_Response
+        {
+            uint32_t QueryID;
+            uint8_t Result;
+            uint32_t ShardID;
+            uint32_t NumSessions;
+            uint32_t MaxSessions;
+        } response;
+        response.QueryID = queryID;
+        response.Result = 0;
+        response.ShardID = (context.ShardID < 0) ? 0 : (uint32_t)context.ShardID;
+        response.NumSessions = Session::GetNumLiveSessions();
+        response.MaxSessions = MAX_SESSION;
+        SendQueryResponse(client, response);
+    }
+
+    // nullptr if the param is invalid or the server is full
+    Session* CreateSession(QueryContext& context, Client& client, const CreateSession_v1_Param& param, uint8_t streamMode, uint16_t streamRate, uint64_t seed = 0)
+    {
+        if (streamMode > (uint8_t)Session::StreamMode::EventDriven) {
+            return nullptr;
+        }
+
+        const uint32_t idPartition = context.OwnerReactor->GetIndex();
+        if (Session::GetNumFreeSessionIds(idPartition) == 0) {
+            return nullptr;
+        }
+
+        Session* newSession = new Session(&client,
+                                        param.FieldWidth,
+                                        param.FieldHeight,
+                                        param.WinScore,
+                                        param.GameTime,
+                                        param.BallSpeed,
+                                        param.BallRadius,
+                                        param.PaddleSpeed,
+                                        param.PaddleSize,
+                                        param.PaddleOffsetFromWall,
+                                        context.UdpSocket_ObjectPos_Stream,
+                                        client.address,
+                                        param.RecvPort_ObjectPos_Stream,
+                                        idPartition,
+                                        seed);
+        assert(newSession != nullptr);
+        newSession->SetStreamMode((Session::StreamMode)streamMode);
+        newSession->SetStreamRate(streamRate, context.ServerTickRate);
+        context.Sessions.push_back(newSession);
+        context.OwnerReactor->UpdateSessionTimers(*newSession);
+        context.OwnerReactor->SaveCheckpoint(*newSession);
+
+        return newSession;
+    }
+
+    void HandleCreateSession(QueryContext& context, Client& client, uint32_t queryID, const CreateSession_v1_Param& param, uint8_t streamMode, uint16_t streamRate, uint64_t seed = 0)
+    {
+        struct __attribute__((packed)) CreateSession_Response
+        {
+            uint32_t QueryID;
+            uint8_t Result;
+            uint32_t SessionID;
+        } response;
+        response.QueryID = queryID;
+
+        std::cout << "[DEBUG] CreateSession_v" << ((queryID == 108) ? 3 : (queryID == 103) ? 2 : 1) << ": " << param.FieldWidth << ", " << param.FieldHeight << ", " << param.WinScore << ", " << param.GameTime << ", " << param.BallSpeed << ", " << param.BallRadius << ", " << param.PaddleSpeed << ", " << param.PaddleSize << ", " << param.PaddleOffsetFromWall << ", " << param.RecvPort_ObjectPos_Stream << ", " << (int)streamMode << ", " << streamRate << ", " << seed << std::endl;
+
+        Session* newSession = CreateSession(context, client, param, streamMode, streamRate, seed);
+        if (newSession == nullptr) {
+            SendResult(client, queryID, false);
+            return;
+        }
+
+        std::cout << "[DEBUG] Session Created: " << newSession->GetSessionID() << std::endl;
+
+        response.Result = 0;
+        response.SessionID = newSession->GetSessionID();
+        SendQueryResponse(client, response);
+    }
+
+    // CreateSession_v1
+    void HandleCreateSession_v1(QueryContext& context, Client& client, uint32_t queryID, const CreateSession_v1_Param& param)
+    {
+        HandleCreateSession(context, client, queryID, param, (uint8_t)Session::StreamMode::PerSession, 0);
+    }
+
+    // CreateSession_v2 (+ StreamMode, StreamRate)
+    void HandleCreateSession_v2(QueryContext& context, Client& client, uint32_t queryID, const CreateSession_v2_Param& param)
+    {
+        HandleCreateSession(context, client, queryID, param.Base, param.StreamMode, param.StreamRate);
+    }
+
+    // CreateSession_v3 (+ Seed)
+    void HandleCreateSession_v3(QueryContext& context, Client& client, uint32_t queryID, const CreateSession_v3_Param& param)
+    {
+        HandleCreateSession(context, client, queryID, param.Base.Base, param.Base.StreamMode, param.Base.StreamRate, param.Seed);
+    }
+
+    // BulkCreateSession_v2
+    // Response entries are the created SessionIDs. UINT32_MAX: Failed
+    void HandleBulkCreateSession(QueryContext& context, Client& client, uint32_t queryID, const CreateSession_v2_Param* params, uint16_t count)
+    {
+        std::cout << "[DEBUG] BulkCreateSession_v2: " << count << std::endl;
+
+        // Grow the session lists once for the whole batch
+        context.Sessions.reserve(context.Sessions.size() + count);
+
+        uint32_t* sessionIDs = AllocBulkResponse<uint32_t>(client, queryID, 0, count);
+        uint16_t numFailed = 0;
+        for (uint16_t i = 0; i < count; i++) {
+            const Session* newSession = CreateSession(context, client, params[i].Base, params[i].StreamMode, params[i].StreamRate);
+            const uint32_t sessionID = (newSession != nullptr) ? newSession->GetSessionID() : UINT32_MAX;
+            memcpy(&sessionIDs[i], &sessionID, sizeof(sessionID));
+            numFailed += (newSession == nullptr);
+        }
+        reinterpret_cast<Bulk_Response*>((char*)sessionIDs - sizeof(Bulk_Response))->Result = (numFailed == 0) ? 0 : 1;
+
+        std::cout << "[DEBUG] BulkCreateSession_v2 done. Failed: " << numFailed << std::endl;
+    }
+
+    // AbortSession_v1
+    void HandleAbortSession(QueryContext& context, Client& client, uint32_t queryID, const SessionID_Param& param)
+    {
+        std::cout << "[DEBUG] AbortSession_v1: " << param.SessionID << std::endl;
+
+        if (ForwardSessionQuery(context, client, queryID, param.SessionID, false, [](QueryContext& remoteContext, Session* session) {
+                remoteContext.Sessions.Remove(session);
+                delete session;
+                return true;
+            })) {
+            return;
+        }
+
+        Session* session = FindSession(context, param.SessionID);
+        if (session == nullptr) {
+            SendResult(client, queryID, false);
+            return;
+        }
+
+        context.Sessions.Remove(session);
+        delete session;
+        SendResult(client, queryID, true);
+    }
+
+    // BulkAbortSession_v2
+    // Response entries are the result of each session. (0: Success, 1: Not found)
+    void HandleBulkAbortSession(QueryContext& context, Client& client, uint32_t queryID, const SessionID_Param* params, uint16_t count)
+    {
+        std::cout << "[DEBUG] BulkAbortSession_v2: " << count << std::endl;
+
+        uint8_t* results = AllocBulkResponse<uint8_t>(client, queryID, 0, count);
+        static thread_local std::vector<Session*> abortSessions;
+        abortSessions.clear();
+        uint16_t numFailed = 0;
+        for (uint16_t i = 0; i < count; i++) {
+            Session* session = FindSession(context, params[i].SessionID);
+            results[i] = (session != nullptr) ? 0 : 1;
+            numFailed += (session == nullptr);
+            if (session != nullptr) {
+                abortSessions.push_back(session);
+            }
+        }
+        reinterpret_cast<Bulk_Response*>((char*)results - sizeof(Bulk_Response))->Result = (numFailed == 0) ? 0 : 1;
+
+        // A session listed twice is deleted once
+        std::sort(abortSessions.begin(), abortSessions.end());
+        abortSessions.erase(std::unique(abortSessions.begin(), abortSessions.end()), abortSessions.end());
+        for (Session* session : abortSessions) {
+            context.Sessions.Remove(session);
+            delete session;
+        }
+    }
+
+    // SetStreamMode_v1
+    void HandleSetStreamMode(QueryContext& context, Client& client, uint32_t queryID, const SetStreamMode_Param& param)
+    {
+        std::cout << "[DEBUG] SetStreamMode_v1: " << param.SessionID << ", " << (int)param.StreamMode << std::endl;
+
+        Session* session = FindSession(context, param.SessionID);
+        if (session == nullptr || session->GetOwnerClient() != &client || param.StreamMode > (uint8_t)Session::StreamMode::EventDriven) {
+            SendResult(client, queryID, false);
+            return;
+        }
+        session->SetStreamMode((Session::StreamMode)param.StreamMode);
+        context.OwnerReactor->SaveCheckpoint(*session);
+        SendResult(client, queryID, true);
+    }
+
+    // Begin the round, and time it on the reactor of the session
+    bool BeginSessionRound(QueryContext& context, Session* session)
+    {
+        if (!session->BeginRound()) {
+            return false;
+        }
+        context.OwnerReactor->UpdateSessionTimers(*session);
+        return true;
+    }
+
+    // BeginRound_v1
+    void HandleBeginRound(QueryContext& context, Client& client, uint32_t queryID, const SessionID_Param& param)
+    {
+        std::cout << "[DEBUG] BeginRound_v1: " << param.SessionID << std::endl;
+
+        if (ForwardSessionQuery(context, client, queryID, param.SessionID, false, [](QueryContext& remoteContext, Session* session) { return BeginSessionRound(remoteContext, session); })) {
+            return;
+        }
+
+        Session* session = FindSession(context, param.SessionID);
+        SendResult(client, queryID, session != nullptr && BeginSessionRound(context, session));
+    }
+
+    // BulkBeginRound_v2
+    // Response entries are the result of each session. (0: Success, 1: Not found or already running)
+    void HandleBulkBeginRound(QueryContext& context, Client& client, uint32_t queryID, const SessionID_Param* params, uint16_t count)
+    {
+        std::cout << "[DEBUG] BulkBeginRound_v2: " << count << std::endl;
+
+        uint8_t* results = AllocBulkResponse<uint8_t>(client, queryID, 0, count);
+        uint16_t numFailed = 0;
+        for (uint16_t i = 0; i < count; i++) {
+            Session* session = FindSession(context, params[i].SessionID);
+            const bool bSuccess = (session != nullptr && BeginSessionRound(context, session));
+            results[i] = bSuccess ? 0 : 1;
+            numFailed += !bSuccess;
+        }
+        reinterpret_cast<Bulk_Response*>((char*)results - sizeof(Bulk_Response))->Result = (numFailed == 0) ? 0 : 1;
+    }
+
+    // ActionPlayerInput_v1
+    void HandleActionPlayerInput(QueryContext& context, Client& client, uint32_t queryID, const ActionPlayerInput_Param& param)
+    {
+        std::cout << "[DEBUG] ActionPlayerInput_v1: " << param.SessionID << ", " << param.PlayerID << ", " << param.InputKey << ", " << param.InputType << std::endl;
+
+        Session::PlayerID playerID;
+        if (param.PlayerID == 1) {
+            playerID = Session::PlayerID::PlayerA;
+        }
+        else if (param.PlayerID == 2) {
+            playerID = Session::PlayerID::PlayerB;
+        }
+        else {
+            SendAckResult(client, queryID, false);
+            return;
+        }
+
+        Session::InputKey inputKey;
+        if (param.InputKey == 1) {
+            inputKey = Session::InputKey::Left;
+        }
+        else if (param.InputKey == 2) {
+            inputKey = Session::InputKey::Right;
+        }
+        else {
+            SendAckResult(client, queryID, false);
+            return;
+        }
+
+        Session::InputType inputType;
+        if (param.InputType == 0) {
+            inputType = Session::InputType::None;
+        }
+        else if (param.InputType == 1) {
+            inputType = Session::InputType::Press;
+        }
+        else if (param.InputType == 2) {
+            inputType = Session::InputType::Release;
+        }
+        else {
+            SendAckResult(client, queryID, false);
+            return;
+        }
+
+        // Only an input that doesn't fit in the input queue of the session fails. (Inputs between rounds or to a bot slot are ignored)
+        const auto queueInput = [=](QueryContext&, Session* session) {
+            return session->SetPlayerInput(playerID, inputKey, inputType) || !session->IsInputQueueFull();
+        };
+        if (ForwardSessionQuery(context, client, queryID, param.SessionID, true, queueInput)) {
+            return;
+        }
+
+        Session* session = FindSession(context, param.SessionID);
+        if (session == nullptr) {
+            SendAckResult(client, queryID, false);
+            return;
+        }
+
+        SendAckResult(client, queryID, queueInput(context, session));
+    }
+
+    // EnableUdpInput_v1
+    void HandleEnableUdpInput(QueryContext& context, Client& client, uint32_t queryID, const SessionID_Param& param)
+    {
+        struct __attribute__((packed)) EnableUdpInput_Response
+        {
+            uint32_t QueryID;
+            uint8_t Result;
+            uint16_t UdpInputPort; //< Network byte order
+        } response;
+        response.QueryID = queryID;
+        response.UdpInputPort = htons(context.UdpInputPort);
+
+        std::cout << "[DEBUG] EnableUdpInput_v1: " << param.SessionID << std::endl;
+
+        // Only the owner can switch the input channel
+        response.Result = 1;
+        Session* session = FindSession(context, param.SessionID);
+        if (session != nullptr && session->GetOwnerClient() == &client) {
+            session->EnableUdpInput();
+            context.OwnerReactor->SaveCheckpoint(*session);
+            response.Result = 0;
+        }
+        SendQueryResponse(client, response);
+    }
+
+    // SubscribeSession_v1
+    void HandleSubscribeSession(QueryContext& context, Client& client, uint32_t queryID, const SubscribeSession_Param& param)
+    {
+        std::cout << "[DEBUG] SubscribeSession_v1: " << param.SessionID << ", " << param.RecvPort_ObjectPos_Stream << std::endl;
+
+        // Any client can spectate any session (The other reactor reads the address of the client, and links the subscription to it)
+        // The client is unsubscribed on the reactor of the session when it disconnects.
+        Reactor* const remoteReactor = context.OwnerReactor->GetRemoteReactor(param.SessionID);
+        client.subscribedReactorMask |= 1u << ((remoteReactor != nullptr) ? remoteReactor : context.OwnerReactor)->GetIndex();
+
+        Client* const subscriber = &client;
+        const uint16_t recvPort = param.RecvPort_ObjectPos_Stream;
+        if (ForwardSessionQuery(context, client, queryID, param.SessionID, false, [=](QueryContext&, Session* session) { return session->Subscribe(subscriber, recvPort); })) {
+            return;
+        }
+
+        Session* session = FindSession(context, param.SessionID);
+        SendResult(client, queryID, session != nullptr && session->Subscribe(&client, param.RecvPort_ObjectPos_Stream));
+    }
+
+    // UnsubscribeSession_v1
+    void HandleUnsubscribeSession(QueryContext& context, Client& client, uint32_t queryID, const SubscribeSession_Param& param)
+    {
+        std::cout << "[DEBUG] UnsubscribeSession_v1: " << param.SessionID << ", " << param.RecvPort_ObjectPos_Stream << std::endl;
+
+        Client* const subscriber = &client;
+        const uint16_t recvPort = param.RecvPort_ObjectPos_Stream;
+        if (ForwardSessionQuery(context, client, queryID, param.SessionID, false, [=](QueryContext&, Session* session) { return session->Unsubscribe(subscriber, recvPort); })) {
+            return;
+        }
+
+        Session* session = FindSession(context, param.SessionID);
+        SendResult(client, queryID, session != nullptr && session->Unsubscribe(&client, param.RecvPort_ObjectPos_Stream));
+    }
+
+    // MigrateSession_v1
+    // Answered once the target imported the session
+    void HandleMigrateSession(QueryContext& context, Client& client, uint32_t queryID, const MigrateSession_Param& param)
+    {
+        std::cout << "[DEBUG] MigrateSession_v1: " << param.SessionID << ", " << inet_ntoa(in_addr{ param.TargetAddr }) << ":" << ntohs(param.TargetPort) << std::endl;
+
+        sockaddr_in targetAddr;
+        memset(&targetAddr, 0, sizeof(targetAddr));
+        targetAddr.sin_family = AF_INET;
+        targetAddr.sin_addr.s_addr = param.TargetAddr;
+        targetAddr.sin_port = param.TargetPort;
+        context.OwnerReactor->GetMigrator().MigrateSession(client, queryID, param.SessionID, targetAddr);
+    }
+
+    // ImportSession_v1
+    // Resume a session migrated from another server. The client (The link of the old server) owns it.
+    void HandleImportSession(QueryContext& context, Client& client, uint32_t queryID, const Session::Snapshot& param)
+    {
+        struct __attribute__((packed)) ImportSession_Response
+        {
+            uint32_t QueryID;
+            uint8_t Result;
+            uint32_t SessionID;
+            uint16_t UdpInputPort; //< Network byte order
+        } response;
+        response.QueryID = queryID;
+        response.Result = 1;
+        response.SessionID = 0;
+        response.UdpInputPort = htons(context.UdpInputPort);
+
+        const uint32_t idPartition = context.OwnerReactor->GetIndex();
+        if (param.Version == SESSION_SNAPSHOT_VERSION
+            && param.StreamMode <= (uint8_t)Session::StreamMode::EventDriven
+            && Session::GetNumFreeSessionIds(idPartition) != 0) {
+            Session* newSession = new Session(&client, param, context.UdpSocket_ObjectPos_Stream, idPartition);
+            context.Sessions.push_back(newSession);
+            context.OwnerReactor->UpdateSessionTimers(*newSession);
+            context.OwnerReactor->SaveCheckpoint(*newSession);
+            response.Result = 0;
+            response.SessionID = newSession->GetSessionID();
+        }
+
+        std::cout << "[DEBUG] ImportSession_v1: " << param.StreamSessionID << " -> " << response.SessionID << std::endl;
+        SendQueryResponse(client, response);
+    }
+
+    // ReclaimSession_v1
+    // Take the ownership of a session recovered from the checkpoint after a crash of the server.
+    // Only from the address its stream goes to, and only on the reactor of the session. (The owner lives on the same reactor)
+    void HandleReclaimSession(QueryContext& context, Client& client, uint32_t queryID, const SessionID_Param& param)
+    {
+        std::cout << "[DEBUG] ReclaimSession_v1: " << param.SessionID << std::endl;
+
+        Session* session = FindSession(context, param.SessionID);
+        if (session == nullptr
+            || session->GetOwnerClient() != nullptr
+            || session->IsBotPlayer(Session::PlayerID::PlayerA) || session->IsBotPlayer(Session::PlayerID::PlayerB)
+            || session->GetStreamAddress().sin_addr.s_addr != client.address.sin_addr.s_addr) {
+            SendResult(client, queryID, false);
+            return;
+        }
+        session->SetOwnerClient(&client);
+        context.OwnerReactor->UpdateSessionTimers(*session);
+        SendResult(client, queryID, true);
+    }
+
+    // SetSessionMulticast_v1
+    void HandleSetSessionMulticast(QueryContext& context, Client& client, uint32_t queryID, const SetSessionMulticast_Param& param)
+    {
+        std::cout << "[DEBUG] SetSessionMulticast_v1: " << param.SessionID << ", " << inet_ntoa(in_addr{ param.GroupAddr }) << ", " << ntohs(param.Port) << std::endl;
+
+        // Only the owner can publish the session to a group
+        Session* session = FindSession(context, param.SessionID);
+        if (session == nullptr || session->GetOwnerClient() != &client) {
+            SendResult(client, queryID, false);
+            return;
+        }
+        const bool bSuccess = session->SetMulticastGroup(param.GroupAddr, param.Port);
+        if (bSuccess) {
+            context.OwnerReactor->SaveCheckpoint(*session);
+        }
+        SendResult(client, queryID, bSuccess);
+    }
+
+    /* -------------------------------------------------------------------------- */
+    /*                               Handler Table                                */
+    /* -------------------------------------------------------------------------- */
+    struct QueryHandler
+    {
+        uint32_t    QueryID;
+        uint32_t    ParamSize; //< Minimum size for bulk queries
+        bool        bBulk;     //< Variable length. v2 only
+        const char* Name;      //< Trace span name
+        void      (*Dispatch)(QueryContext& context, Client& client, uint32_t queryID, const char* param, size_t paramSize);
+    };
+
+    template <typename TParam, void (*Handler)(QueryContext&, Client&, uint32_t, const TParam&)>
+    void DispatchQuery(QueryContext& context, Client& client, uint32_t queryID, const char* param, size_t)
+    {
+        // Packed params have no alignment requirement, so they are read in place from the receive buffer
+        static_assert(alignof(TParam) == 1, "Query param must be a packed struct");
+        Handler(context, client, queryID, *reinterpret_cast<const TParam*>(param));
+    }
+
+    template <typename TEntry, void (*Handler)(QueryContext&, Client&, uint32_t, const TEntry*, uint16_t)>
+    void DispatchBulkQuery(QueryContext& context, Client& client, uint32_t queryID, const char* param, size_t paramSize)
+    {
+        static_assert(alignof(TEntry) == 1, "Query param must be a packed struct");
+        Bulk_Param header;
+        memcpy(&header, param, sizeof(header));
+        if (paramSize - sizeof(header) < (size_t)header.Count * sizeof(TEntry)) {
+            AllocBulkResponse<uint8_t>(client, queryID, 1, 0);
+            return;
+        }
+        Handler(context, client, queryID, reinterpret_cast<const TEntry*>(param + sizeof(header)), header.Count);
+    }
+
+    template <uint32_t QueryID, typename TParam, void (*Handler)(QueryContext&, Client&, uint32_t, const TParam&)>
+    constexpr QueryHandler MakeQueryHandler(const char* name)
+    {
+        static_assert(QueryID < QUERY_ID_TABLE_SIZE, "QueryID out of the dispatch table");
+        return { QueryID, std::is_empty<TParam>::value ? 0u : (uint32_t)sizeof(TParam), false, name, &DispatchQuery<TParam, Handler> };
+    }
+
+    template <uint32_t QueryID, typename TEntry, void (*Handler)(QueryContext&, Client&, uint32_t, const TEntry*, uint16_t)>
+    constexpr QueryHandler MakeBulkQueryHandler(const char* name)
+    {
+        static_assert(QueryID < QUERY_ID_TABLE_SIZE, "QueryID out of the dispatch table");
+        return { QueryID, (uint32_t)sizeof(Bulk_Param), true, name, &DispatchBulkQuery<TEntry, Handler> };
+    }
+
+    constexpr QueryHandler queryHandlers[] =
+    {
+        MakeQueryHandler<1,   UpgradeProtocol_Param,     HandleUpgradeProtocol>("Query UpgradeProtocol_v1"),
+        MakeQueryHandler<2,   SetClientAddress_Param,    HandleSetClientAddress>("Query SetClientAddress_v1"),
+        MakeQueryHandler<3,   Empty_Param,               HandleGetServerStatus>("Query GetServerStatus_v1"),
+        MakeQueryHandler<101, CreateSession_v1_Param,    HandleCreateSession_v1>("Query CreateSession_v1"),
+        MakeQueryHandler<102, SessionID_Param,           HandleAbortSession>("Query AbortSession_v1"),
+        MakeQueryHandler<103, CreateSession_v2_Param,    HandleCreateSession_v2>("Query CreateSession_v2"),
+        MakeQueryHandler<104, SetStreamMode_Param,       HandleSetStreamMode>("Query SetStreamMode_v1"),
+        MakeQueryHandler<105, MigrateSession_Param,      HandleMigrateSession>("Query MigrateSession_v1"),
+        MakeQueryHandler<106, Session::Snapshot,         HandleImportSession>("Query ImportSession_v1"),
+        MakeQueryHandler<107, SessionID_Param,           HandleReclaimSession>("Query ReclaimSession_v1"),
+        MakeQueryHandler<108, CreateSession_v3_Param,    HandleCreateSession_v3>("Query CreateSession_v3"),
+        MakeBulkQueryHandler<111, CreateSession_v2_Param, HandleBulkCreateSession>("Query BulkCreateSession_v2"),
+        MakeBulkQueryHandler<112, SessionID_Param,        HandleBulkAbortSession>("Query BulkAbortSession_v2"),
+        MakeQueryHandler<201, SessionID_Param,           HandleBeginRound>("Query BeginRound_v1"),
+        MakeBulkQueryHandler<211, SessionID_Param,        HandleBulkBeginRound>("Query BulkBeginRound_v2"),
+        MakeQueryHandler<301, ActionPlayerInput_Param,   HandleActionPlayerInput>("Query ActionPlayerInput_v1"),
+        MakeQueryHandler<302, SessionID_Param,           HandleEnableUdpInput>("Query EnableUdpInput_v1"),
+        MakeQueryHandler<401, SubscribeSession_Param,    HandleSubscribeSession>("Query SubscribeSession_v1"),
+        MakeQueryHandler<402, SubscribeSession_Param,    HandleUnsubscribeSession>("Query UnsubscribeSession_v1"),
+        MakeQueryHandler<403, SetSessionMulticast_Param, HandleSetSessionMulticast>("Query SetSessionMulticast_v1"),
+    };
+    constexpr size_t numQueryHandlers = sizeof(queryHandlers) / sizeof(queryHandlers[0]);
+    static_assert(numQueryHandlers < UINT8_MAX, "Too many query handlers for the index table");
+
+    // QueryID -> (Index of queryHandlers + 1). 0: Unknown
+    constexpr std::array<uint8_t, QUERY_ID_TABLE_SIZE> queryHandlerIndex = []()
+    {
+        std::array<uint8_t, QUERY_ID_TABLE_SIZE> index = {};
+        for (size_t i = 0; i < numQueryHandlers; i++) {
+            index[queryHandlers[i].QueryID] = (uint8_t)(i + 1);
+        }
+        return index;
+    }();
+
+    inline const QueryHandler* FindQueryHandler(uint32_t queryID)
+    {
+        if (queryID >= QUERY_ID_TABLE_SIZE || queryHandlerIndex[queryID] == 0) {
+            return nullptr;
+        }
+        return &queryHandlers[queryHandlerIndex[queryID] - 1];
+    }
+
+    inline void HandleUnknownQuery(Client& client, uint32_t queryID)
+    {
+        TRACE_SCOPE("Query Unknown", queryID);
+        std::cerr << "Unknown Query ID: " << queryID << std::endl;
+        SendResult(client, queryID, false);
+    }
+
+    /* -------------------------------------------------------------------------- */
+    /*                                   Parsers                                  */
+    /* -------------------------------------------------------------------------- */
+    // Returns the number of consumed bytes.
+    // Stops at an incomplete query, when the client upgraded the protocol, or when a query was forwarded to another reactor.
+    size_t ParseQueries_v1(QueryContext& context, Client& client, const char* data, size_t size)
+    {
+        size_t offset = 0;
+        while (size - offset >= sizeof(uint32_t) && client.protocolVersion == 1 && client.numPendingForwards == 0)
+        {
+            uint32_t queryID;
+            memcpy(&queryID, data + offset, sizeof(queryID));
+
+            const QueryHandler* handler = FindQueryHandler(queryID);
+            if (handler == nullptr || handler->bBulk) {
+                // Without a length, only the QueryID can be skipped
+                offset += sizeof(queryID);
+                HandleUnknownQuery(client, queryID);
+                continue;
+            }
+            if (size - offset - sizeof(queryID) < handler->ParamSize) {
+                break;
+            }
+
+            const char* const param = data + offset + sizeof(queryID);
+            const SessionMigrator::RelayResult relay = context.OwnerReactor->GetMigrator().RelayQuery(client, queryID, param, handler->ParamSize);
+            if (relay == SessionMigrator::RelayResult::Wait) {
+                break;
+            }
+            if (relay == SessionMigrator::RelayResult::NotMigrated) {
+                TRACE_SCOPE(handler->Name, queryID);
+                handler->Dispatch(context, client, queryID, param, handler->ParamSize);
+            }
+            offset += sizeof(queryID) + handler->ParamSize;
+        }
+        return offset;
+    }
+
+    size_t ParseQueries_v2(QueryContext& context, Client& client, const char* data, size_t size)
+    {
+        struct __attribute__((packed)) QueryFrame_Header
+        {
+            uint32_t Length; //< Bytes after this field (QueryID + Param)
+            uint32_t QueryID;
+        } header;
+
+        size_t offset = 0;
+        while (size - offset >= sizeof(header.Length) && client.numPendingForwards == 0)
+        {
+            memcpy(&header.Length, data + offset, sizeof(header.Length));
+            if (header.Length < sizeof(header.QueryID) || header.Length > QUERY_V2_MAX_FRAME_LENGTH) {
+                // The frame boundary is lost. Close the connection. (recv() returns 0 on the next poll)
+                std::cerr << "Invalid query frame length: " << header.Length << std::endl;
+                shutdown(client.socket, SHUT_RDWR);
+                return size;
+            }
+            if (size - offset - sizeof(header.Length) < header.Length) {
+                break;
+            }
+            memcpy(&header.QueryID, data + offset + sizeof(header.Length), sizeof(header.QueryID));
+
+            const QueryHandler* handler = FindQueryHandler(header.QueryID);
+            if (handler != nullptr && header.Length - sizeof(header.QueryID) >= handler->ParamSize) {
+                const char* const param = data + offset + sizeof(header);
+                const size_t paramSize = header.Length - sizeof(header.QueryID);
+                const SessionMigrator::RelayResult relay = context.OwnerReactor->GetMigrator().RelayQuery(client, header.QueryID, param, paramSize);
+                if (relay == SessionMigrator::RelayResult::Wait) {
+                    break;
+                }
+                if (relay == SessionMigrator::RelayResult::NotMigrated) {
+                    TRACE_SCOPE(handler->Name, header.QueryID);
+                    handler->Dispatch(context, client, header.QueryID, param, paramSize);
+                }
+            }
+            else {
+                HandleUnknownQuery(client, header.QueryID);
+            }
+            offset += sizeof(header.Length) + header.Length;
+        }
+        return offset;
+    }
+}
+
+bool GetQueryParamSize(uint32_t queryID, uint32_t& paramSize, bool& bBulk)
+{
+    const QueryHandler* handler = FindQueryHandler(queryID);
+    if (handler == nullptr) {
+        return false;
+    }
+    paramSize = handler->ParamSize;
+    bBulk = handler->bBulk;
+    return true;
+}
+
+void SendQueryFailure(Client& client, uint32_t queryID)
+{
+    const QueryHandler* handler = FindQueryHandler(queryID);
+    if (queryID == 302) {
+        struct __attribute__((packed)) EnableUdpInput_Response
+        {
+            uint32_t QueryID;
+            uint8_t Result;
+            uint16_t UdpInputPort;
+        } response = { queryID, 1, 0 };
+        SendQueryResponse(client, response);
+    }
+    else if (handler != nullptr && handler->bBulk) {
+        AllocBulkResponse<uint8_t>(client, queryID, 1, 0);
+    }
+    else {
+        SendResult(client, queryID, false);
+    }
+}
+
+void HandleQueries(QueryContext& context, Client& client)
+{
+    const char* const data = client.recvBuffer.data();
+    const size_t size = client.recvBuffer.size();
+
+    size_t offset = 0;
+    if (client.protocolVersion == 1) {
+        offset += ParseQueries_v1(context, client, data, size);
+    }
+    if (client.protocolVersion == 2) {
+        offset += ParseQueries_v2(context, client, data + offset, size - offset);
+    }
+
+    client.recvBuffer.erase(client.recvBuffer.begin(), client.recvBuffer.begin() + offset);
+}
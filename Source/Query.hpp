@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "config.hpp"
+#include "Client.hpp"
+#include "Session.hpp"
+
+/**
+ * API query parsing and dispatch.
+ *
+ * v1: {uint32 QueryID; Param}. The param size is implied by the QueryID, so an unknown QueryID can't be skipped.
+ * v2: {uint32 Length; uint32 QueryID; Param}. Length counts the bytes after itself.
+ *     Unknown frames are answered with a fail response and skipped. Bytes after the known param are ignored.
+ *
+ * Both versions share the same handler table, indexed by QueryID.
+ * A client starts in v1 and switches with the UpgradeProtocol query. (QueryID 1)
+ * Bulk queries carry a variable number of entries, so they are only available in v2.
+ *
+ * A query on a session of another reactor is forwarded to it, and the client is not parsed further until it is answered.
+ * Bulk and owner-only queries only act on sessions of the reactor of the client.
+ * A query on a session migrated to another server is relayed there. (See SessionMigrator)
+ * */
+
+class Reactor;
+
+// State of the server that query handlers work on. Only used by the main thread.
+struct QueryContext
+{
+    SessionList&           Sessions;
+    int                    UdpSocket_ObjectPos_Stream;
+    uint32_t               ServerTickRate;
+    Reactor*               OwnerReactor; //< Sessions are created in its session ID partition
+    uint16_t               UdpInputPort;
+    int32_t                ShardID;      //< -1: Not sharded (SetClientAddress is refused)
+};
+
+// Param size of a known query (Minimum for bulk queries). false if the QueryID is unknown.
+bool GetQueryParamSize(uint32_t queryID, uint32_t& paramSize, bool& bBulk);
+
+// Handle all complete queries in the receive buffer of the client, and consume them
+void HandleQueries(QueryContext& context, Client& client);
+
+// Fail response in the shape of the query's response. (For queries answered without their handler)
+void SendQueryFailure(Client& client, uint32_t queryID);
+
+// Reserve a response of the given size in the framing of the client's protocol version, and return where to write it.
+// The pointer is valid until the send buffer is modified again.
+inline char* AllocQueryResponse(Client& client, size_t size)
+{
+    const size_t prefixSize = (client.protocolVersion == 2) ? sizeof(uint32_t) : 0;
+    const size_t offset = client.sendBuffer.size();
+    client.sendBuffer.resize(offset + prefixSize + size);
+    if (prefixSize != 0) {
+        const uint32_t length = (uint32_t)size;
+        memcpy(client.sendBuffer.data() + offset, &length, sizeof(length));
+    }
+
+    const size_t queuedBytes = client.GetQueuedBytes();
+    if (queuedBytes > client.peakQueuedBytes) {
+        client.peakQueuedBytes = queuedBytes;
+    }
+    if (queuedBytes > CLIENT_SEND_BUFFER_HARD_LIMIT
+        || (queuedBytes > CLIENT_SEND_BUFFER_LIMIT && client.sendOverflowPolicy == SendOverflowPolicy::Disconnect)) {
+        client.bSendOverflowed = true;
+    }
+
+    return client.sendBuffer.data() + offset + prefixSize;
+}
+
+// Append a response (Or a server pushed message)
+inline void AppendQueryResponse(Client& client, const void* response, size_t size)
+{
+    memcpy(AllocQueryResponse(client, size), response, size);
+}
+
+template <typename TResponse>
+inline void SendQueryResponse(Client& client, const TResponse& response)
+{
+    AppendQueryResponse(client, &response, sizeof(response));
+}
+
+// Append an input ack. Over the send limit, acks are coalesced or dropped by the overflow policy of the client.
+// (A client that stopped reading doesn't need every ack, but must not lose round results)
+inline void AppendQueryAck(Client& client, const void* ack, size_t size)
+{
+    if (client.GetQueuedBytes() >= CLIENT_SEND_BUFFER_LIMIT)
+    {
+        if (client.sendOverflowPolicy == SendOverflowPolicy::DropAcks) {
+            client.numDroppedAcks += 1;
+            return;
+        }
+        if (client.sendOverflowPolicy == SendOverflowPolicy::CoalesceAcks
+            && client.lastAckEnd == client.sendBuffer.size()
+            && client.lastAckEnd - client.sendBufferOffset >= size
+            && memcmp(client.sendBuffer.data() + client.lastAckEnd - size, ack, size) == 0) {
+            client.numCoalescedAcks += 1;
+            return;
+        }
+    }
+
+    AppendQueryResponse(client, ack, size);
+    client.lastAckEnd = client.sendBuffer.size();
+}
+
+template <typename TResponse>
+inline void SendQueryAck(Client& client, const TResponse& ack)
+{
+    AppendQueryAck(client, &ack, sizeof(ack));
+}
@@ -0,0 +1,1120 @@
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "Reactor.hpp"
+#include "ShmChannel.hpp"
+#include "HotRestart.hpp"
+#include "Checkpoint.hpp"
+#include "Trace.hpp"
+
+static volatile sig_atomic_t g_bTraceToggleRequested = 0;
+
+// Server owned session spawned by SpawnBotSessions(). (An ownerless session of a client waits to be reclaimed)
+static inline bool IsBotSession(const Session* session)
+{
+    return session->GetOwnerClient() == nullptr
+           && session->IsBotPlayer(Session::PlayerID::PlayerA)
+           && session->IsBotPlayer(Session::PlayerID::PlayerB);
+}
+
+void Reactor::RequestTraceToggle()
+{
+    g_bTraceToggleRequested = 1;
+}
+
+Reactor::Reactor(uint32_t index, const std::vector<Reactor*>& reactors, const Config& config)
+    : Index(index)
+    , Reactors(reactors)
+    , Settings(config)
+    , ListenSocket(-1)
+    , UdpSocket_PlayerInput(-1)
+    , UnixServerSocket(-1)
+    , Shm(nullptr)
+    , Handoff(nullptr)
+    , SessionCheckpoint(nullptr)
+    , GlobalFdSet_MaxFd(-1)
+    , Context{ Sessions, config.UdpSocket_ObjectPos_Stream, config.TickRate, this, config.UdpInputPort, config.ShardID }
+    , Migrator(Context, GlobalFdSet, GlobalFdSet_MaxFd)
+    , SessionWorkerTaskQueue(new TaskQueue[config.NumWorkers])
+    , SessionWorkerTotalTaskRemainingCount(0)
+    , bSessionWorkerJoinFlag(false)
+    , SessionWorkerWakeUpIssuedUs(0)
+    , SessionWorkerBusyNs(0)
+    , bMailboxPending(false)
+    , LoopCount(0)
+    , LastTickTime(std::chrono::steady_clock::now())
+    , TimerEpoch(LastTickTime)
+    , NumBotSession(0)
+    , NumBotRoundEnded(0)
+    , NumSendOverflowDisconnects(0)
+{
+    assert(config.NumWorkers != 0);
+    FD_ZERO(&GlobalFdSet);
+
+    // Init session worker thread pool
+    for (size_t i = 0; i < Settings.NumWorkers; i++) {
+        SessionWorkerThreads.emplace_back(&Reactor::SessionWorkerMain, this, i);
+    }
+}
+
+Reactor::~Reactor()
+{
+    // Close all session
+    while (!Sessions.empty()) {
+        Session* const session = Sessions[Sessions.size() - 1];
+        Sessions.Remove(session);
+        delete session;
+    }
+
+    // Close client socket. (Subscriptions to the sessions of the other reactors first. The reactors don't run anymore)
+    for (Client* client : Clients) {
+        for (uint32_t idPartition = 0; idPartition < MAX_REACTOR; idPartition++) {
+            Session::UnsubscribeClient(*client, idPartition);
+        }
+        delete client;
+    }
+    Clients.clear();
+
+    // Cleanup threads and resources
+    {
+        std::lock_guard<std::mutex> cvLock(SessionWorkerWakeUpMutex);
+        bSessionWorkerJoinFlag = true;
+    }
+    SessionWorkerWakeUpCondition.notify_all();
+    for (std::thread& thread : SessionWorkerThreads) {
+        thread.join();
+    }
+
+    if (ListenSocket != -1) {
+        close(ListenSocket);
+    }
+    if (UdpSocket_PlayerInput != -1) {
+        close(UdpSocket_PlayerInput);
+    }
+}
+
+bool Reactor::Open()
+{
+    // Init listen socket
+    ListenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (ListenSocket == -1) {
+        std::cerr << "Failed to create socket" << std::endl;
+        return false;
+    }
+
+    // Every reactor binds its own listen socket to the port, the kernel balances new connections over them
+    int opt = 1;
+    if (setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1
+        || setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        std::cerr << "Failed to set socket option" << std::endl;
+        return false;
+    }
+
+    // Set socket option to non-blocking
+    fcntl(ListenSocket, F_SETFL, fcntl(ListenSocket, F_GETFL, 0) | O_NONBLOCK);
+
+    sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_addr.s_addr = INADDR_ANY;
+    serverAddress.sin_port = htons(Settings.Port);
+
+    if (bind(ListenSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) == -1) {
+        std::cerr << "Failed to bind socket to address" << std::endl;
+        return false;
+    }
+
+    // Full backlog, so that a burst of reconnects isn't dropped at SYN
+    if (listen(ListenSocket, SOMAXCONN) == -1) {
+        std::cerr << "Failed to listen for connections" << std::endl;
+        return false;
+    }
+
+    // Open UDP socket for sequenced player input
+    UdpSocket_PlayerInput = socket(AF_INET, SOCK_DGRAM, 0);
+    if (UdpSocket_PlayerInput == -1) {
+        std::cerr << "Failed to create UDP socket" << std::endl;
+        return false;
+    }
+    if (setsockopt(UdpSocket_PlayerInput, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        std::cerr << "Failed to set socket option" << std::endl;
+        return false;
+    }
+    fcntl(UdpSocket_PlayerInput, F_SETFL, fcntl(UdpSocket_PlayerInput, F_GETFL, 0) | O_NONBLOCK);
+
+    sockaddr_in udpInputAddress = serverAddress;
+    udpInputAddress.sin_port = htons(Settings.UdpInputPort);
+    if (bind(UdpSocket_PlayerInput, (struct sockaddr*)&udpInputAddress, sizeof(udpInputAddress)) == -1) {
+        std::cerr << "Failed to bind UDP input socket to address" << std::endl;
+        return false;
+    }
+
+    // Register server socket to select()
+    FD_SET(ListenSocket, &GlobalFdSet);
+    FD_SET(UdpSocket_PlayerInput, &GlobalFdSet);
+    GlobalFdSet_MaxFd = std::max(ListenSocket, UdpSocket_PlayerInput);
+
+    return true;
+}
+
+void Reactor::AttachUnixListener(int unixServerSocket)
+{
+    UnixServerSocket = unixServerSocket;
+    FD_SET(UnixServerSocket, &GlobalFdSet);
+    GlobalFdSet_MaxFd = std::max(GlobalFdSet_MaxFd, UnixServerSocket);
+}
+
+void Reactor::AttachShmChannel(ShmChannel* shmChannel)
+{
+    Shm = shmChannel;
+}
+
+void Reactor::AttachHotRestart(HotRestart* hotRestart)
+{
+    Handoff = hotRestart;
+}
+
+void Reactor::AttachCheckpoint(Checkpoint* checkpoint)
+{
+    SessionCheckpoint = checkpoint;
+}
+
+size_t Reactor::RecoverSessions()
+{
+    assert(SessionCheckpoint != nullptr);
+
+    size_t numRecovered = 0;
+    size_t numBotRecovered = 0;
+    for (uint32_t i = 0; i < MAX_SESSION; i++)
+    {
+        const uint32_t sessionID = SessionCheckpoint->GetSessionIdBase() + i;
+        if (Session::GetSessionIdPartition(sessionID) != Index) {
+            continue;
+        }
+
+        Session::Snapshot snapshot;
+        if (!SessionCheckpoint->Load(sessionID, snapshot)
+            || snapshot.bSessionEnded
+            || snapshot.StreamMode > (uint8_t)Session::StreamMode::EventDriven
+            || !Session::ReserveSessionId(sessionID)) {
+            continue;
+        }
+
+        Session* const session = new Session(nullptr, snapshot, Settings.UdpSocket_ObjectPos_Stream, Index);
+        assert(session->GetSessionID() == sessionID);
+        Sessions.push_back(session);
+        UpdateSessionTimers(*session);
+        numRecovered += 1;
+
+        if (IsBotSession(session)) {
+            numBotRecovered += 1;
+        }
+    }
+    NumBotSession += numBotRecovered;
+
+    return numRecovered;
+}
+
+size_t Reactor::SpawnBotSessions(size_t numBotSession, uint16_t botStreamPort)
+{
+    numBotSession = std::min(numBotSession, (size_t)Session::GetNumFreeSessionIds(Index));
+
+    for (size_t i = 0; i < numBotSession; i++)
+    {
+        sockaddr_in botStreamAddr;
+        memset(&botStreamAddr, 0, sizeof(botStreamAddr));
+        botStreamAddr.sin_family = AF_INET;
+        botStreamAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        Session* botSession = new Session(nullptr, 800, 400, 10, 60, 400, 20, 600, 150, 100,
+                                          Settings.UdpSocket_ObjectPos_Stream, botStreamAddr, htons(botStreamPort), Index);
+        assert(botSession != nullptr);
+        botSession->SetBotPlayer(Session::PlayerID::PlayerA, true);
+        botSession->SetBotPlayer(Session::PlayerID::PlayerB, true);
+        botSession->BeginRound();
+        Sessions.push_back(botSession);
+        UpdateSessionTimers(*botSession);
+    }
+    NumBotSession += numBotSession;
+
+    return numBotSession;
+}
+
+void Reactor::Post(std::function<void()> task)
+{
+    std::lock_guard<std::mutex> lock(MailboxMutex);
+    Mailbox.push_back(std::move(task));
+    bMailboxPending.store(true, std::memory_order_release);
+}
+
+Reactor* Reactor::GetRemoteReactor(uint32_t sessionID) const
+{
+    const uint32_t partition = Session::GetSessionIdPartition(sessionID);
+    if (partition == Index || partition >= Reactors.size()) {
+        return nullptr;
+    }
+    return Reactors[partition];
+}
+
+void Reactor::DrainMailbox()
+{
+    // Checked on every iteration of the loop without taking the lock
+    if (!bMailboxPending.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(MailboxMutex);
+        MailboxSwap.swap(Mailbox);
+        bMailboxPending.store(false, std::memory_order_relaxed);
+    }
+
+    TRACE_SCOPE("Mailbox", (uint32_t)MailboxSwap.size());
+    for (std::function<void()>& task : MailboxSwap) {
+        task();
+    }
+    MailboxSwap.clear();
+}
+
+void Reactor::SessionWorkerMain(size_t threadId)
+{
+    const std::string threadName = "worker" + std::to_string(Index * Settings.NumWorkers + threadId);
+    Tracer::SetThreadName(threadName.c_str());
+
+    while (true)
+    {
+        TaskQueue& taskQueue = SessionWorkerTaskQueue[threadId];
+
+        // Check if task exist
+        {
+            std::unique_lock<std::mutex> cvLock(SessionWorkerWakeUpMutex);
+            SessionWorkerWakeUpCondition.wait(cvLock,
+                [&]() -> bool {
+                    const int32_t localTaskCount = taskQueue.Count.load(std::memory_order_relaxed);
+                    return (localTaskCount > 0) | bSessionWorkerJoinFlag;
+                });
+            if (bSessionWorkerJoinFlag) {
+                return;
+            }
+        }
+        if (Tracer::IsEnabled()) {
+            const uint64_t wakeUpIssuedUs = SessionWorkerWakeUpIssuedUs.load(std::memory_order_relaxed);
+            if (wakeUpIssuedUs != 0) {
+                Tracer::RecordSpan("WorkerWake", wakeUpIssuedUs, Tracer::Now());
+            }
+        }
+
+        int32_t completedTaskCount = 0;
+        const std::chrono::steady_clock::time_point workBeginTime = std::chrono::steady_clock::now();
+
+        // Process all tasks in the local task queue
+        const uint64_t localBatchBeginUs = Tracer::IsEnabled() ? Tracer::Now() : 0;
+        while (true)
+        {
+            // Get exclusive access to session
+            const int32_t taskIdx = taskQueue.Count.fetch_sub(1, std::memory_order_relaxed) - 1;
+            if (taskIdx < 0) {
+                break;
+            }
+            Session* session = taskQueue.Tasks[taskIdx];
+            assert(session != nullptr);
+
+            {
+                // Update session
+                session->Update();
+
+                // Send session state to client (Sessions streaming slower than the tick rate skip most ticks)
+                if (session->IsStreamDue()) {
+                    session->SendObjectState();
+                }
+
+                // Save the state of this tick for crash recovery
+                if (SessionCheckpoint != nullptr) {
+                    SessionCheckpoint->Save(*session);
+                }
+            }
+            completedTaskCount += 1;
+        }
+        if (localBatchBeginUs != 0 && Tracer::IsEnabled()) {
+            Tracer::RecordSpan("LocalBatch", localBatchBeginUs, Tracer::Now(), completedTaskCount);
+        }
+
+        // Work stealing from other worker of the reactor
+        for (size_t targetThreadId = (threadId + 1) % Settings.NumWorkers; targetThreadId != threadId; targetThreadId = (targetThreadId + 1 < Settings.NumWorkers) ? targetThreadId + 1 : 0)
+        {
+            const uint64_t stolenBatchBeginUs = Tracer::IsEnabled() ? Tracer::Now() : 0;
+            int32_t stolenTaskCount = 0;
+            while (true)
+            {
+                // Get exclusive access to session to steal
+                TaskQueue& targetTaskQueue = SessionWorkerTaskQueue[targetThreadId];
+                const int32_t taskIdx = targetTaskQueue.Count.fetch_sub(1, std::memory_order_relaxed) - 1;
+                if (taskIdx < 0) {
+                    break;
+                }
+                Session* session = targetTaskQueue.Tasks[taskIdx];
+                assert(session != nullptr);
+
+                {
+                    // Update session
+                    session->Update();
+
+                    // Send session state to client
+                    if (session->IsStreamDue()) {
+                        session->SendObjectState();
+                    }
+
+                    if (SessionCheckpoint != nullptr) {
+                        SessionCheckpoint->Save(*session);
+                    }
+                }
+                completedTaskCount += 1;
+                stolenTaskCount += 1;
+            }
+            // Only record steals that actually got work, empty probes would flood the trace
+            if (stolenBatchBeginUs != 0 && stolenTaskCount != 0 && Tracer::IsEnabled()) {
+                Tracer::RecordSpan("StolenBatch", stolenBatchBeginUs, Tracer::Now(), stolenTaskCount);
+            }
+        }
+
+        SessionWorkerBusyNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - workBeginTime).count(), std::memory_order_relaxed);
+
+        // Wake up reactor thread if all workers are completed
+        {
+            std::unique_lock cvLock(MainThreadWakeUpMutex);
+            const int32_t remainTaskCount = SessionWorkerTotalTaskRemainingCount.fetch_sub(completedTaskCount, std::memory_order_release) - completedTaskCount;
+            if (remainTaskCount == 0) {
+                cvLock.unlock();
+                MainThreadWakeUpCondition.notify_one();
+            }
+            assert(remainTaskCount >= 0);
+        }
+    }
+}
+
+void Reactor::AcceptClients(int listenSocket, bool bLocal)
+{
+    while (true)
+    {
+        Client* newClient = new Client;
+        assert(newClient != nullptr);
+
+        newClient->socket = accept(listenSocket, (struct sockaddr*)&newClient->address, &newClient->addressLen);
+        if (newClient->socket == -1) {
+            delete newClient;
+            break;
+        }
+        newClient->sendOverflowPolicy = Settings.OverflowPolicy;
+
+        // Local clients have no IP address, so their UDP streams go to the loopback address.
+        if (bLocal) {
+            memset(&newClient->address, 0, sizeof(newClient->address));
+            newClient->address.sin_family = AF_INET;
+            newClient->address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        }
+
+        FD_SET(newClient->socket, &GlobalFdSet);
+        if (GlobalFdSet_MaxFd < newClient->socket) {
+            GlobalFdSet_MaxFd = newClient->socket;
+        }
+
+        Clients.push_back(newClient);
+
+        std::cout << "[LOG] New " << (bLocal ? "local " : "") << "client connected. (reactor " << Index << ")" << std::endl;
+    }
+}
+
+void Reactor::DisconnectClient(Client& client)
+{
+    FD_CLR(client.socket, &GlobalFdSet);
+    client.bClosing = true;
+
+    // The targets abort the migrated sessions of the client with its links
+    Migrator.DisconnectClient(client);
+
+    // Remove the sessions of the client. (Deleting a session unlinks it from the owned session list)
+    while (client.ownedSessions != nullptr) {
+        Session* const session = client.ownedSessions;
+        Sessions.Remove(session);
+        delete session;
+    }
+
+    // and its subscriptions, on the reactors it subscribed on
+    Client* const subscriber = &client;
+    for (Reactor* reactor : Reactors) {
+        if ((client.subscribedReactorMask & (1u << reactor->Index)) == 0) {
+            continue;
+        }
+        if (reactor == this) {
+            Session::UnsubscribeClient(client, Index);
+            continue;
+        }
+
+        // The other reactor unlinks the subscriptions from the client, so it is kept until then
+        client.numPendingForwards += 1;
+        reactor->Post([this, reactor, subscriber]() {
+            Session::UnsubscribeClient(*subscriber, reactor->Index);
+            Post([subscriber]() { subscriber->numPendingForwards -= 1; });
+        });
+    }
+    client.subscribedReactorMask = 0;
+}
+
+void Reactor::HandleUdpInputPacket(const char* packet, size_t size, const sockaddr_in& srcAddr)
+{
+    struct __attribute__((packed)) UdpPlayerInput_Header
+    {
+        uint16_t PacketType; //< 1: PlayerInput
+        uint32_t SessionID;
+        uint32_t PlayerID;
+        uint32_t Seq;        //< Sequence number of Inputs[0]. Inputs[i] has (Seq - i)
+        uint8_t  NumInputs;
+    };
+    struct __attribute__((packed)) UdpPlayerInput_Input
+    {
+        uint8_t InputKey;
+        uint8_t InputType;
+    };
+
+    // Drop malformed packet silently. (There is no one to respond to)
+    struct __attribute__((packed)) UdpPacket_Prefix
+    {
+        uint16_t PacketType;
+        uint32_t SessionID;
+    } prefix;
+    if (size < sizeof(prefix)) {
+        return;
+    }
+    memcpy(&prefix, packet, sizeof(prefix));
+
+    // The kernel spreads packets by address, not by session
+    Reactor* const remoteReactor = GetRemoteReactor(prefix.SessionID);
+    if (remoteReactor != nullptr) {
+        std::vector<char> packetCopy(packet, packet + size);
+        remoteReactor->Post([remoteReactor, packetCopy, srcAddr]() {
+            remoteReactor->HandleUdpInputPacket(packetCopy.data(), packetCopy.size(), srcAddr);
+        });
+        return;
+    }
+
+    // Relayed to the server the session migrated to
+    if (Migrator.RelayUdpInputPacket(UdpSocket_PlayerInput, packet, size)) {
+        return;
+    }
+
+    // StateAck of the quantized delta stream
+    if (prefix.PacketType == 2)
+    {
+        struct __attribute__((packed)) UdpStateAck_Packet
+        {
+            uint16_t PacketType; //< 2: StateAck
+            uint32_t SessionID;
+            uint32_t Tick;
+        } ack;
+        if (size != sizeof(ack)) {
+            return;
+        }
+        memcpy(&ack, packet, sizeof(ack));
+
+        Session* const session = Session::FindSession(ack.SessionID);
+        if (session != nullptr) {
+            Client* const ownerClient = session->GetOwnerClient();
+            if (ownerClient != nullptr && ownerClient->address.sin_addr.s_addr == srcAddr.sin_addr.s_addr) {
+                session->AckStreamTick(ack.Tick);
+            }
+        }
+        return;
+    }
+
+    UdpPlayerInput_Header header;
+    if (size < sizeof(header)) {
+        return;
+    }
+    memcpy(&header, packet, sizeof(header));
+    if (header.PacketType != 1
+        || header.NumInputs == 0 || header.NumInputs > UDP_INPUT_MAX_REDUNDANCY
+        || size != sizeof(header) + sizeof(UdpPlayerInput_Input) * header.NumInputs
+        || (header.PlayerID != 1 && header.PlayerID != 2)) {
+        return;
+    }
+
+    Session::PlayerInput inputs[UDP_INPUT_MAX_REDUNDANCY];
+    for (uint32_t i = 0; i < header.NumInputs; i++) {
+        const UdpPlayerInput_Input* input = (const UdpPlayerInput_Input*)(packet + sizeof(header)) + i;
+        if (input->InputKey > 2 || input->InputType > 2) {
+            return;
+        }
+        inputs[i].Key = (Session::InputKey)input->InputKey;
+        inputs[i].Type = (Session::InputType)input->InputType;
+    }
+
+    // Accept input only from the host of the session owner
+    Session* const session = Session::FindSession(header.SessionID);
+    if (session != nullptr) {
+        Client* const ownerClient = session->GetOwnerClient();
+        if (ownerClient != nullptr && ownerClient->address.sin_addr.s_addr == srcAddr.sin_addr.s_addr) {
+            const Session::PlayerID playerID = (header.PlayerID == 1) ? Session::PlayerID::PlayerA : Session::PlayerID::PlayerB;
+            session->SetPlayerInputSeq(playerID, header.Seq, inputs, header.NumInputs);
+        }
+    }
+}
+
+void Reactor::UpdateTraceToggle()
+{
+    // Dump once the other reactors (And their workers) finished the iteration they were in when tracing was turned off.
+    // A toggle requested until then stays latched, and turns tracing on again after the dump.
+    if (!TraceDumpLoopCounts.empty()) {
+        for (size_t i = 0; i < Reactors.size(); i++) {
+            if (Reactors[i] != this && Reactors[i]->LoopCount.load(std::memory_order_acquire) < TraceDumpLoopCounts[i] + 2) {
+                return;
+            }
+        }
+        Tracer::DumpChromeTrace(Settings.TraceOutputPath);
+        TraceDumpLoopCounts.clear();
+    }
+
+    // Toggle tracing requested by SIGUSR1 (Workers are idle here)
+    if (g_bTraceToggleRequested) {
+        g_bTraceToggleRequested = 0;
+        if (Tracer::IsEnabled()) {
+            Tracer::SetEnabled(false);
+            for (Reactor* reactor : Reactors) {
+                TraceDumpLoopCounts.push_back(reactor->LoopCount.load(std::memory_order_acquire));
+            }
+        }
+        else {
+            std::cout << "[LOG] Trace enabled." << std::endl;
+            Tracer::SetEnabled(true);
+        }
+    }
+}
+
+void Reactor::ReportCapacity(size_t numWorkableSessions, std::chrono::steady_clock::time_point workerPhaseBeginTime)
+{
+    static thread_local std::chrono::steady_clock::time_point lastReportTime = std::chrono::steady_clock::now();
+    static thread_local uint64_t numReportTick = 0;
+    static thread_local uint64_t numReportSessionTick = 0;
+    static thread_local uint64_t sumWorkerPhaseNs = 0;
+
+    const std::chrono::steady_clock::time_point nowTime = std::chrono::steady_clock::now();
+    numReportTick += 1;
+    numReportSessionTick += numWorkableSessions;
+    sumWorkerPhaseNs += std::chrono::duration_cast<std::chrono::nanoseconds>(nowTime - workerPhaseBeginTime).count();
+
+    if (nowTime - lastReportTime >= std::chrono::seconds(CAPACITY_REPORT_INTERVAL_SEC))
+    {
+        const double busyNs = (double)SessionWorkerBusyNs.exchange(0, std::memory_order_relaxed);
+        const double tickBudgetNs = 1e9 / Settings.TickRate;
+        const double nsPerSessionTick = (numReportSessionTick == 0) ? 0.0 : busyNs / numReportSessionTick;
+        const double workerPhaseMs = (double)sumWorkerPhaseNs / numReportTick / 1e6;
+
+        std::ostringstream line;
+        line << "[CAPACITY] sessions: " << numReportSessionTick / numReportTick
+             << " workerPhase: " << workerPhaseMs << "ms/tick (budget " << tickBudgetNs / 1e6 << "ms)"
+             << " cost: " << nsPerSessionTick << "ns/session-tick"
+             << " => " << ((nsPerSessionTick == 0.0) ? 0.0 : tickBudgetNs / nsPerSessionTick) << " sessions/core"
+             << " (rounds ended: " << NumBotRoundEnded << ")";
+        if (Reactors.size() > 1) {
+            line << " (reactor " << Index << ", " << Settings.NumWorkers << " workers)";
+        }
+        line << '\n';
+        std::cout << line.str() << std::flush;
+
+        lastReportTime = nowTime;
+        numReportTick = 0;
+        numReportSessionTick = 0;
+        sumWorkerPhaseNs = 0;
+        NumBotRoundEnded = 0;
+    }
+}
+
+void Reactor::ReportSendBacklog()
+{
+    // Control clients that don't read their responses. Silent while no client has a backlog.
+    static thread_local std::chrono::steady_clock::time_point lastReportTime = std::chrono::steady_clock::now();
+    static thread_local uint64_t lastNumDroppedAcks = 0;
+    static thread_local uint64_t lastNumCoalescedAcks = 0;
+    static thread_local uint64_t lastNumDisconnects = 0;
+
+    const std::chrono::steady_clock::time_point nowTime = std::chrono::steady_clock::now();
+    if (nowTime - lastReportTime < std::chrono::seconds(CLIENT_METRICS_REPORT_INTERVAL_SEC)) {
+        return;
+    }
+
+    size_t   totalQueuedBytes = 0;
+    size_t   peakQueuedBytes = 0;
+    size_t   numClientsOverLimit = 0;
+    uint64_t numDroppedAcks = 0;
+    uint64_t numCoalescedAcks = 0;
+    for (Client* client : Clients) {
+        totalQueuedBytes += client->GetQueuedBytes();
+        peakQueuedBytes = std::max(peakQueuedBytes, client->peakQueuedBytes);
+        numClientsOverLimit += (client->GetQueuedBytes() >= CLIENT_SEND_BUFFER_LIMIT) ? 1 : 0;
+        numDroppedAcks += client->numDroppedAcks;
+        numCoalescedAcks += client->numCoalescedAcks;
+    }
+
+    // Counters of the disconnected clients are gone, so only report increases
+    const uint64_t newDroppedAcks = (numDroppedAcks > lastNumDroppedAcks) ? numDroppedAcks - lastNumDroppedAcks : 0;
+    const uint64_t newCoalescedAcks = (numCoalescedAcks > lastNumCoalescedAcks) ? numCoalescedAcks - lastNumCoalescedAcks : 0;
+    const uint64_t newDisconnects = NumSendOverflowDisconnects - lastNumDisconnects;
+    if (totalQueuedBytes != 0 || newDroppedAcks != 0 || newCoalescedAcks != 0 || newDisconnects != 0) {
+        std::ostringstream line;
+        line << "[LOG] Send backlog: " << totalQueuedBytes << " bytes queued"
+             << " (peak " << peakQueuedBytes << " bytes/client, " << numClientsOverLimit << " clients over limit)"
+             << " acks dropped: " << newDroppedAcks << " coalesced: " << newCoalescedAcks
+             << " overflow disconnects: " << newDisconnects;
+        PrintLogLine(line);
+    }
+
+    lastReportTime = nowTime;
+    lastNumDroppedAcks = numDroppedAcks;
+    lastNumCoalescedAcks = numCoalescedAcks;
+    lastNumDisconnects = NumSendOverflowDisconnects;
+}
+
+void Reactor::PrintLogLine(std::ostringstream& line) const
+{
+    if (Reactors.size() > 1) {
+        line << " (reactor " << Index << ")";
+    }
+    line << '\n';
+    std::cout << line.str() << std::flush;
+}
+
+uint64_t Reactor::GetTimerTick(std::chrono::steady_clock::time_point timePoint, bool bRoundUp) const
+{
+    const int64_t tickDurationUs = 1000000 / Settings.TickRate;
+    const int64_t sinceEpochUs = std::chrono::duration_cast<std::chrono::microseconds>(timePoint - TimerEpoch).count();
+    if (sinceEpochUs <= 0) {
+        return 0;
+    }
+    return (uint64_t)((sinceEpochUs + (bRoundUp ? tickDurationUs - 1 : 0)) / tickDurationUs);
+}
+
+void Reactor::UpdateSessionTimers(Session& session)
+{
+    const std::chrono::steady_clock::time_point nowTime = std::chrono::steady_clock::now();
+
+    if (session.IsRoundRunning()) {
+        Timers.Schedule(session.GetRoundTimer(), GetTimerTick(session.GetRoundDeadline(), false), TimerKind_RoundTimeout);
+    }
+    else {
+        session.GetRoundTimer().Cancel();
+    }
+
+    // Only recovered sessions waiting for a client expire. A connected owner keeps its sessions, and server owned bot sessions never expire.
+    TimerNode& expiryTimer = session.GetExpiryTimer();
+    if (session.GetOwnerClient() == nullptr && !IsBotSession(&session)) {
+        if (!expiryTimer.IsScheduled()) {
+            Timers.Schedule(expiryTimer, GetTimerTick(nowTime + std::chrono::seconds(CHECKPOINT_RECLAIM_TIMEOUT_SEC), true), TimerKind_Reclaim);
+        }
+    }
+    else {
+        expiryTimer.Cancel();
+    }
+}
+
+void Reactor::SaveCheckpoint(const Session& session)
+{
+    if (SessionCheckpoint != nullptr) {
+        SessionCheckpoint->Save(session);
+    }
+}
+
+void Reactor::FireTimers(std::chrono::steady_clock::time_point nowTime)
+{
+    TimedOutSessions.clear();
+    ExpiredTimers.clear();
+    Timers.Advance(GetTimerTick(nowTime, false), ExpiredTimers);
+    if (ExpiredTimers.empty()) {
+        return;
+    }
+
+    size_t numReclaimExpired = 0;
+    for (TimerNode* timer : ExpiredTimers)
+    {
+        // A migrated session is hidden, it runs on the other server
+        Session* const session = Session::FindSession(timer->OwnerID);
+        if (session == nullptr) {
+            continue;
+        }
+
+        if (timer->Kind == TimerKind_RoundTimeout) {
+            if (!session->IsRoundRunning()) {
+                continue;
+            }
+            // The deadline is later within the wheel tick
+            if (nowTime < session->GetRoundDeadline()) {
+                Timers.Schedule(*timer, GetTimerTick(session->GetRoundDeadline(), false), TimerKind_RoundTimeout);
+                continue;
+            }
+            session->EndRoundByTimeout();
+
+            // The round result is sent with the ones of the tick. (Aggregated streams too)
+            if (session->GetStreamMode() != Session::StreamMode::Aggregated && session->IsStreamDue()) {
+                session->SendObjectState();
+            }
+            TimedOutSessions.push_back(session);
+        }
+        else {
+            session->EndSession();
+            numReclaimExpired += 1;
+        }
+    }
+
+    if (numReclaimExpired != 0) {
+        std::ostringstream line;
+        line << "[LOG] Aborted " << numReclaimExpired << " recovered sessions not reclaimed in " << CHECKPOINT_RECLAIM_TIMEOUT_SEC << "s.";
+        PrintLogLine(line);
+    }
+}
+
+void Reactor::Run()
+{
+    const std::string threadName = (Index == 0) ? std::string("main") : "reactor" + std::to_string(Index);
+    Tracer::SetThreadName(threadName.c_str());
+
+    while (true)
+    {
+        LoopCount.fetch_add(1, std::memory_order_release);
+
+        if (Index == 0) {
+            UpdateTraceToggle();
+        }
+
+        fd_set recvFdSet = GlobalFdSet;
+        fd_set sendFdSet = GlobalFdSet;
+
+        timeval zeroTimeout = { 0, };
+        const uint64_t pollBeginUs = Tracer::IsEnabled() ? Tracer::Now() : 0;
+        if (select(GlobalFdSet_MaxFd + 1, &recvFdSet, &sendFdSet, NULL, &zeroTimeout) == -1) {
+            // Interrupted by signal (e.g. SIGUSR1 trace toggle)
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Failed to select" << std::endl;
+            exit(1);
+        }
+        // The loop spins on a zero timeout, so the poll span is only recorded when a socket had something to read
+        bool bSocketActivity = false;
+
+        // Accept new clients
+        if (FD_ISSET(ListenSocket, &recvFdSet)) {
+            AcceptClients(ListenSocket, false);
+            bSocketActivity = true;
+        }
+        if (UnixServerSocket != -1 && FD_ISSET(UnixServerSocket, &recvFdSet)) {
+            AcceptClients(UnixServerSocket, true);
+            bSocketActivity = true;
+        }
+
+        // Process each socket
+        for (std::vector<Client*>::iterator clientIt = Clients.begin(); clientIt != Clients.end();)
+        {
+            Client& client = *(*clientIt);
+
+            // Disconnected client waiting for its forwarded queries
+            if (client.bClosing) {
+                if (client.numPendingForwards == 0) {
+                    delete *clientIt;
+                    clientIt = Clients.erase(clientIt);
+                }
+                else {
+                    ++clientIt;
+                }
+                continue;
+            }
+
+            /* ------------------- Send buffered message to the client ------------------- */
+            // Never block on a client that doesn't read. What doesn't fit in the socket buffer stays queued.
+            if (FD_ISSET(client.socket, &sendFdSet))
+            {
+                if (client.GetQueuedBytes() != 0) {
+                    const ssize_t nBytesSent = send(client.socket, client.GetQueuedData(), client.GetQueuedBytes(), MSG_DONTWAIT | MSG_NOSIGNAL);
+                    if (nBytesSent == -1) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                            std::cout << "[DEBUG] send() == -1. errno: " << errno << std::endl;
+                        }
+                    }
+                    else {
+                        client.ConsumeSendBuffer((size_t)nBytesSent);
+                    }
+                }
+            }
+
+            /* --------------------- Receive message from the client -------------------- */
+            bool bDisconnected = false;
+            if (client.bSendOverflowed) {
+                std::cout << "[LOG] Client disconnected by send overflow. queued: " << client.GetQueuedBytes() << " bytes" << std::endl;
+                NumSendOverflowDisconnects += 1;
+                bDisconnected = true;
+            }
+            else if (FD_ISSET(client.socket, &recvFdSet))
+            {
+                char buffer[1024];
+                const int nBytesRecv = recv(client.socket, buffer, sizeof(buffer), 0);
+                bSocketActivity = true;
+                if (nBytesRecv == -1) {
+                    std::cout << "[DEBUG] recv() == -1. errno: " << errno << std::endl;
+                }
+                else if (nBytesRecv == 0) {
+                    std::cout << "Client disconnected" << std::endl;
+                    bDisconnected = true;
+                }
+                else {
+                    client.recvBuffer.insert(client.recvBuffer.end(), buffer, buffer + nBytesRecv);
+                }
+            }
+
+            // Client disconnected
+            if (bDisconnected)
+            {
+                DisconnectClient(client);
+
+                // delete client
+                if (client.numPendingForwards == 0) {
+                    delete *clientIt;
+                    clientIt = Clients.erase(clientIt);
+                }
+                else {
+                    ++clientIt;
+                }
+                continue;
+            }
+
+            /* ---------------------------- Handle API Query ---------------------------- */
+            if (FD_ISSET(client.socket, &recvFdSet)) {
+                HandleQueries(Context, client);
+            }
+
+            ++clientIt;
+        }
+
+        /* ----------------------- Shared Memory Control Channel ---------------------- */
+        // Polled without a syscall on every iteration
+        if (Shm != nullptr && Shm->Poll(Context)) {
+            bSocketActivity = true;
+        }
+
+        /* ------------------------- Receive UDP Player Input ------------------------- */
+        if (FD_ISSET(UdpSocket_PlayerInput, &recvFdSet))
+        {
+            TRACE_SCOPE("UdpInputChannel");
+            bSocketActivity = true;
+
+            while (true)
+            {
+                char packet[256]; //< Larger than any valid packet
+
+                sockaddr_in srcAddr;
+                socklen_t srcAddrLen = sizeof(srcAddr);
+                const int nBytesRecv = recvfrom(UdpSocket_PlayerInput, packet, sizeof(packet), 0, (struct sockaddr*)&srcAddr, &srcAddrLen);
+                if (nBytesRecv == -1) {
+                    break;
+                }
+                HandleUdpInputPacket(packet, (size_t)nBytesRecv, srcAddr);
+            }
+        }
+
+        /* ------------------------------ Migration Links ----------------------------- */
+        Migrator.Poll(recvFdSet, sendFdSet);
+
+        if (pollBeginUs != 0 && bSocketActivity && Tracer::IsEnabled()) {
+            Tracer::RecordSpan("PollSockets", pollBeginUs, Tracer::Now());
+        }
+
+        /* ------------------------------ Reactor Mailbox ------------------------------ */
+        // Tasks posted by the other reactors (Forwarded queries and their results, UDP input, unsubscribes)
+        DrainMailbox();
+
+        /* -------------------------------- Hot Restart ------------------------------- */
+        // Frozen here while the state is handed to a new process. (Between ticks, the workers are idle)
+        if (Handoff != nullptr) {
+            Handoff->FreezePoint();
+        }
+
+        /* -------------------------- Begin Session Workers --------------------------- */
+        std::vector<Session*> workableSessions;
+        std::chrono::steady_clock::time_point workerPhaseBeginTime;
+        {
+            // Check if the server tick duration time has elapsed
+            const std::chrono::microseconds tickDuration(1000000 / Settings.TickRate);
+            const std::chrono::steady_clock::time_point nowTime = std::chrono::steady_clock::now();
+            const std::chrono::microseconds deltaTime_us = std::chrono::duration_cast<std::chrono::microseconds>(nowTime - LastTickTime);
+            const std::chrono::microseconds latency = std::chrono::duration_cast<std::chrono::microseconds>(nowTime - LastTickTime - tickDuration);
+            if (deltaTime_us < tickDuration) {
+                continue;
+            }
+
+            // Update last tick time
+            LastTickTime = nowTime;
+
+            // Round timeouts, and abandoned sessions.
+            // Fired before the tick, so that the tick reaching the deadline of a round is not simulated. (It ends the round instead)
+            {
+                TRACE_SCOPE("Timers");
+                FireTimers(nowTime);
+            }
+
+            TRACE_SCOPE("WakeWorkers");
+
+            // Exclude sessions that round is not running
+            for (size_t i = 0; i < Sessions.size(); i++) {
+                if (Sessions[i]->IsRoundRunning()) {
+                    workableSessions.push_back(Sessions[i]);
+                }
+            }
+
+            // Log Latency(us)
+            std::ostringstream line;
+            line << "[DEBUG] RunningSession: " << workableSessions.size() << " Lat:" << latency.count() << "us";
+            PrintLogLine(line);
+
+            // Distribute session to session worker
+            workerPhaseBeginTime = std::chrono::steady_clock::now();
+            // (The wake-up condition can only be satisfied by this reactor thread, therefore, omit the SessionWorkerWakeUpMutex)
+            {
+                size_t sessionOffset = 0;
+                const size_t sessionPerWorker = workableSessions.size() / Settings.NumWorkers;
+                const size_t sessionRemainder = workableSessions.size() % Settings.NumWorkers;
+                for (size_t i = 0; i < Settings.NumWorkers; i++)
+                {
+                    TaskQueue& taskQueue = SessionWorkerTaskQueue[i];
+
+                    const size_t numTask = sessionPerWorker + ((i < sessionRemainder) ? 1 : 0);
+                    if (taskQueue.Capacity < numTask) {
+                        taskQueue.Capacity = numTask;
+                        delete taskQueue.Tasks;
+                        taskQueue.Tasks = new Session*[taskQueue.Capacity];
+                    }
+
+                    for (size_t j = 0; j < numTask; j++) {
+                        taskQueue.Tasks[j] = workableSessions[sessionOffset + j];
+                    }
+                    taskQueue.Count = numTask;
+                    sessionOffset += numTask;
+                }
+
+                SessionWorkerTotalTaskRemainingCount.store(workableSessions.size(), std::memory_order_release);
+            }
+
+            // Wake up session worker
+            if (workableSessions.size() != 0) {
+                SessionWorkerWakeUpIssuedUs.store(Tracer::IsEnabled() ? Tracer::Now() : 0, std::memory_order_relaxed);
+                SessionWorkerWakeUpCondition.notify_all();
+            }
+        }
+
+        /* -------------------------- Wait for Session Workers -------------------------- */
+        if (workableSessions.size() != 0)
+        {
+            TRACE_SCOPE("BarrierWait", (uint32_t)workableSessions.size());
+            std::unique_lock<std::mutex> cvLock(MainThreadWakeUpMutex);
+            MainThreadWakeUpCondition.wait(cvLock, [&]() -> bool {
+                return SessionWorkerTotalTaskRemainingCount.load(std::memory_order_relaxed) == 0;
+            });
+        }
+
+        // Rounds timed out before the tick end with the ones ended by the tick
+        const size_t numTickedSessions = workableSessions.size();
+        workableSessions.insert(workableSessions.end(), TimedOutSessions.begin(), TimedOutSessions.end());
+
+        /* ----------------------- Send Aggregated Object State ------------------------ */
+        {
+            static thread_local std::vector<Session*> aggregatedSessions;
+            aggregatedSessions.clear();
+            for (Session* session : workableSessions) {
+                if (session->GetStreamMode() == Session::StreamMode::Aggregated && session->IsStreamDue()) {
+                    aggregatedSessions.push_back(session);
+                }
+            }
+            if (!aggregatedSessions.empty()) {
+                TRACE_SCOPE("AggregatedStream", (uint32_t)aggregatedSessions.size());
+                Session::SendAggregatedObjectState(Settings.UdpSocket_ObjectPos_Stream, aggregatedSessions.data(), aggregatedSessions.size());
+            }
+        }
+
+        /* ------------------------------ Capacity Report ------------------------------ */
+        if (NumBotSession != 0) {
+            ReportCapacity(numTickedSessions, workerPhaseBeginTime);
+        }
+
+        /* ------------------------------ Send Round Result ----------------------------- */
+        {
+            TRACE_SCOPE("RoundResult");
+            for (Session* session : workableSessions) {
+                if (!session->IsRoundRunning()) {
+                    UpdateSessionTimers(*session);
+                    SaveCheckpoint(*session); //< A timed out round was not ticked by the workers
+
+                    struct __attribute__((packed)) RoundResult_Response
+                    {
+                        uint32_t QueryID = 201;
+                        uint32_t WinPlayer;
+                    } response;
+
+                    Session::RoundResultType roundResult = session->GetRoundResult();
+                    if (roundResult == Session::RoundResultType::Timeout) {
+                        response.WinPlayer = 0;
+                    }
+                    else if (roundResult == Session::RoundResultType::WinPlayerA) {
+                        response.WinPlayer = 1;
+                    }
+                    else if (roundResult == Session::RoundResultType::WinPlayerB) {
+                        response.WinPlayer = 2;
+                    }
+                    else {
+                        assert(false);
+                    }
+
+                    Client* const ownerClient = session->GetOwnerClient();
+
+                    // Server owned bot session keeps playing. A recovered session not reclaimed yet has nobody to tell.
+                    if (ownerClient == nullptr) {
+                        if (IsBotSession(session)) {
+                            NumBotRoundEnded += 1;
+                            session->BeginRound();
+                            UpdateSessionTimers(*session);
+                        }
+                        continue;
+                    }
+                    SendQueryResponse(*ownerClient, response);
+                }
+            }
+        }
+
+        /* ---------------------------- Send Backlog Report ---------------------------- */
+        ReportSendBacklog();
+
+        /* ------------------------------ Close Session ------------------------------- */
+        {
+            TRACE_SCOPE("CloseSession");
+            for (size_t i = 0; i < Sessions.size();) {
+                Session* const session = Sessions[i];
+                if (session->IsSessionEnded()) {
+                    Sessions.Remove(session); //< The last session moves to i
+                    delete session;
+                }
+                else {
+                    i++;
+                }
+            }
+        }
+
+        // Running sessions were saved by the workers, and idle ones when they changed. (See SaveCheckpoint)
+        if (SessionCheckpoint != nullptr) {
+            TRACE_SCOPE("Checkpoint");
+            SessionCheckpoint->Sweep(Index);
+        }
+    }
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <sys/select.h>
+
+#include "config.hpp"
+#include "Client.hpp"
+#include "Session.hpp"
+#include "Query.hpp"
+#include "Migration.hpp"
+#include "TimingWheel.hpp"
+
+class ShmChannel;
+class HotRestart;
+class Checkpoint;
+
+/**
+ * Event loop thread of the server.
+ *
+ * Every reactor has its own SO_REUSEPORT listen socket and UDP input socket on the shared ports,
+ * so the kernel spreads new connections and input packets over the reactors.
+ * A reactor owns the clients it accepted, the sessions in its session ID partition, and its own session workers.
+ * Only the reactor thread touches them.
+ *
+ * Other reactors reach them by posting tasks to the mailbox of the reactor.
+ * The mailbox is drained between ticks, while the workers of the reactor are idle.
+ * */
+class Reactor
+{
+public:
+    struct Config
+    {
+        uint32_t           TickRate;
+        uint16_t           Port;         //< API port
+        uint16_t           UdpInputPort;
+        int32_t            ShardID;      //< -1: Not sharded
+        size_t             NumWorkers;
+        int                UdpSocket_ObjectPos_Stream; //< Shared by all reactors
+        SendOverflowPolicy OverflowPolicy;
+        const char*        TraceOutputPath;            //< Used by reactor 0, which handles the trace toggle
+    };
+
+public:
+    // All reactors share the list, so that they can post to each other
+    Reactor(uint32_t index, const std::vector<Reactor*>& reactors, const Config& config);
+
+    ~Reactor();
+
+    // Open the listen socket and the UDP input socket of the reactor
+    bool Open();
+
+    // Accept local clients from the Unix domain socket listener too
+    void AttachUnixListener(int unixServerSocket);
+
+    // Serve the shared memory control channel too
+    void AttachShmChannel(ShmChannel* shmChannel);
+
+    // Let hot restart freeze the reactor between ticks
+    void AttachHotRestart(HotRestart* hotRestart);
+
+    // Save the sessions of the reactor to the checkpoint every tick
+    void AttachCheckpoint(Checkpoint* checkpoint);
+
+    // Resume the sessions of the partition of the reactor saved in the checkpoint. Returns the number resumed.
+    // They have no owner until a client reclaims them, and are aborted after CHECKPOINT_RECLAIM_TIMEOUT_SEC otherwise. (See UpdateSessionTimers)
+    // Bot sessions keep playing. (Counted in GetNumBotSessions())
+    size_t RecoverSessions();
+
+    // Spawn server owned bot-vs-bot sessions in the partition of the reactor. Returns the number spawned.
+    size_t SpawnBotSessions(size_t numBotSession, uint16_t botStreamPort);
+
+    // Run the event loop on the calling thread. Doesn't return.
+    void Run();
+
+    // Run the task on the reactor thread between ticks. Callable from any thread.
+    void Post(std::function<void()> task);
+
+    // Reactor owning the session ID. nullptr if it is this reactor or the ID is invalid. (Handled in place)
+    Reactor* GetRemoteReactor(uint32_t sessionID) const;
+
+    inline uint32_t GetIndex() const { return Index; }
+
+    inline size_t GetNumBotSessions() const { return NumBotSession; }
+
+    inline QueryContext& GetQueryContext() { return Context; }
+
+    inline SessionMigrator& GetMigrator() { return Migrator; }
+
+    // Arm the timers the state of the session needs, and disarm the others. O(1)
+    // Call on the reactor thread whenever the state changes. (Added to the reactor, round begun or ended, owner changed)
+    //  - Round timeout: While the round runs. Fires at the round deadline.
+    //  - Expiry: While an ownerless session recovered from a checkpoint is not reclaimed. (CHECKPOINT_RECLAIM_TIMEOUT_SEC)
+    //            Sessions of a connected client never expire, they end with an abort or the disconnect of the client.
+    void UpdateSessionTimers(Session& session);
+
+    // Save a session changed between ticks to the checkpoint, if any. (Created, moved in, its round ended, or changed by a query)
+    // Running sessions are saved by the workers on every tick, so idle sessions are only saved when they change.
+    void SaveCheckpoint(const Session& session);
+
+    // Toggle tick tracing on reactor 0. (Async signal safe)
+    static void RequestTraceToggle();
+
+private:
+    // Saves and restores the clients and sessions of frozen reactors
+    friend class HotRestart;
+
+    void SessionWorkerMain(size_t threadId);
+
+    void DrainMailbox();
+
+    void AcceptClients(int listenSocket, bool bLocal);
+
+    // Close the client. Deleted once no forwarded query of it is pending.
+    void DisconnectClient(Client& client);
+
+    // Player input / stream ack of the UDP input channel. Forwarded to the owner of the session.
+    void HandleUdpInputPacket(const char* packet, size_t size, const sockaddr_in& srcAddr);
+
+    void UpdateTraceToggle();
+
+    void ReportCapacity(size_t numWorkableSessions, std::chrono::steady_clock::time_point workerPhaseBeginTime);
+
+    void ReportSendBacklog();
+
+    // Print the line with one write, tagged with the reactor if there are several. (Streamed piece by piece, the lines of the reactors interleave)
+    void PrintLogLine(std::ostringstream& line) const;
+
+    // Fire the timers due by now. Timed out rounds end (TimedOutSessions), and expired sessions are ended. (Deleted at the end of the tick)
+    void FireTimers(std::chrono::steady_clock::time_point nowTime);
+
+    // Wheel tick of the time point. Rounded up for expiries, so that they never fire early.
+    // Round deadlines are rounded down and checked when fired, so that the round ends on the first tick past the deadline.
+    uint64_t GetTimerTick(std::chrono::steady_clock::time_point timePoint, bool bRoundUp) const;
+
+private:
+    struct TaskQueue
+    {
+        Session**            Tasks  = nullptr;
+        std::atomic<int32_t> Count  = 0;
+        size_t               Capacity = 0;
+
+        inline ~TaskQueue() {
+            delete Tasks;
+        }
+    };
+
+    const uint32_t               Index;
+    const std::vector<Reactor*>& Reactors;
+    const Config                 Settings;
+
+    int         ListenSocket;
+    int         UdpSocket_PlayerInput;
+    int         UnixServerSocket;  //< -1: None
+    ShmChannel* Shm;               //< nullptr: None
+    HotRestart* Handoff;           //< nullptr: None
+    Checkpoint* SessionCheckpoint; //< nullptr: None
+
+    fd_set GlobalFdSet;
+    int    GlobalFdSet_MaxFd;
+
+    std::vector<Client*>  Clients;
+    SessionList           Sessions; //< Only the reactor thread modifies it
+    QueryContext          Context;
+    SessionMigrator       Migrator; //< Sessions of the reactor migrated to other servers
+
+    // Session worker thread pool
+    std::vector<std::thread>     SessionWorkerThreads;
+    std::unique_ptr<TaskQueue[]> SessionWorkerTaskQueue;
+    std::condition_variable      SessionWorkerWakeUpCondition;
+    std::mutex                   SessionWorkerWakeUpMutex;
+    std::atomic<int32_t>         SessionWorkerTotalTaskRemainingCount;
+    std::condition_variable      MainThreadWakeUpCondition;
+    std::mutex                   MainThreadWakeUpMutex;
+    bool                         bSessionWorkerJoinFlag;
+    std::atomic<uint64_t>        SessionWorkerWakeUpIssuedUs; //< For tracing wake-up latency of workers
+    std::atomic<uint64_t>        SessionWorkerBusyNs;         //< Sum of time workers spent on sessions (For capacity report)
+
+    // Mailbox
+    std::mutex                         MailboxMutex;
+    std::vector<std::function<void()>> Mailbox;
+    std::vector<std::function<void()>> MailboxSwap; //< Drained outside of the lock
+    std::atomic<bool>                  bMailboxPending;
+
+    std::atomic<uint64_t> LoopCount; //< Iterations of the event loop (The trace is dumped once every reactor moved on)
+    std::vector<uint64_t> TraceDumpLoopCounts; //< Loop counts of the reactors when tracing was turned off. Empty: No dump pending
+
+    std::chrono::steady_clock::time_point LastTickTime;
+
+    // Session timers. One wheel tick is one tick duration since TimerEpoch
+    enum TimerKind : uint8_t
+    {
+        TimerKind_RoundTimeout,
+        TimerKind_Reclaim
+    };
+    TimingWheel                           Timers;
+    std::chrono::steady_clock::time_point TimerEpoch;
+    std::vector<TimerNode*>               ExpiredTimers;
+    std::vector<Session*>                 TimedOutSessions; //< Rounds ended by FireTimers() before the current tick
+
+    // Reports
+    size_t   NumBotSession;
+    uint64_t NumBotRoundEnded;
+    uint64_t NumSendOverflowDisconnects;
+};
@@ -0,0 +1,216 @@
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Recorder.hpp"
+
+std::atomic<bool> Recorder::bEnabled(false);
+uint32_t Recorder::NominalStepMs = 1000 / SERVER_TICK_RATE;
+
+static_assert((REPLAY_BUFFER_SIZE & (REPLAY_BUFFER_SIZE - 1)) == 0, "REPLAY_BUFFER_SIZE must be a power of two");
+
+namespace
+{
+    // Single-producer single-consumer byte ring. (Recording thread -> Writer)
+    struct ReplayBuffer
+    {
+        alignas(CACHE_LINE) std::atomic<uint64_t> Head; //< Total bytes written. Only stored by the recording thread
+        std::atomic<uint64_t> NumDropped;               //< Records that didn't fit. Only stored by the recording thread
+        alignas(CACHE_LINE) std::atomic<uint64_t> Tail; //< Total bytes written to the file. Only stored by the writer
+        uint64_t NumDroppedReported;                    //< NumDropped already logged by the writer
+        alignas(CACHE_LINE) char Data[REPLAY_BUFFER_SIZE];
+    };
+
+    // Buffers are owned by the registry, so that records of exited threads are still written
+    std::mutex                                 replayBufferRegistryMutex;
+    std::vector<std::unique_ptr<ReplayBuffer>> replayBufferRegistry;
+
+    std::mutex replayFileMutex; //< Serializes the writes to the file. (Writer thread, Flush(), BeginSegment())
+    int        replayFd = -1;
+
+    ReplayPayload_Segment replaySegment;
+
+    ReplayBuffer* GetThreadReplayBuffer()
+    {
+        thread_local ReplayBuffer* threadBuffer = nullptr;
+        if (threadBuffer == nullptr)
+        {
+            std::unique_ptr<ReplayBuffer> buffer(new ReplayBuffer);
+            buffer->Head.store(0, std::memory_order_relaxed);
+            buffer->NumDropped.store(0, std::memory_order_relaxed);
+            buffer->Tail.store(0, std::memory_order_relaxed);
+            buffer->NumDroppedReported = 0;
+
+            std::lock_guard<std::mutex> lock(replayBufferRegistryMutex);
+            threadBuffer = buffer.get();
+            replayBufferRegistry.push_back(std::move(buffer));
+        }
+        return threadBuffer;
+    }
+
+    bool WriteFull(int fd, const void* data, size_t size)
+    {
+        size_t nTotalBytesWritten = 0;
+        while (nTotalBytesWritten < size)
+        {
+            const ssize_t nBytesWritten = write(fd, (const char*)data + nTotalBytesWritten, size - nTotalBytesWritten);
+            if (nBytesWritten <= 0) {
+                if (nBytesWritten == -1 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            nTotalBytesWritten += nBytesWritten;
+        }
+        return true;
+    }
+
+    // Write a record without a session directly to the file. Call with replayFileMutex held.
+    void WriteRecord(ReplayRecordType type, const void* payload, size_t payloadSize)
+    {
+        char record[sizeof(ReplayRecord) + sizeof(ReplayPayload_Segment)];
+        const ReplayRecord header = { (uint8_t)type, 0, 0 };
+        memcpy(record, &header, sizeof(header));
+        memcpy(record + sizeof(header), payload, payloadSize);
+        if (!WriteFull(replayFd, record, sizeof(header) + payloadSize)) {
+            std::cerr << "Failed to write replay log. errno: " << errno << std::endl;
+        }
+    }
+
+    // Write the records buffered so far. Call with replayFileMutex held.
+    void WriteBufferedRecords()
+    {
+        std::lock_guard<std::mutex> lock(replayBufferRegistryMutex);
+        for (const std::unique_ptr<ReplayBuffer>& buffer : replayBufferRegistry)
+        {
+            // Records dropped since the last write come before the buffered ones
+            const uint64_t numDropped = buffer->NumDropped.load(std::memory_order_relaxed);
+            if (numDropped != buffer->NumDroppedReported) {
+                const ReplayPayload_Gap gap = { numDropped - buffer->NumDroppedReported };
+                WriteRecord(ReplayRecordType::Gap, &gap, sizeof(gap));
+                std::cout << "[LOG] Replay buffer full. Dropped " << gap.NumDroppedRecords << " records." << std::endl;
+                buffer->NumDroppedReported = numDropped;
+            }
+
+            const uint64_t tail = buffer->Tail.load(std::memory_order_relaxed);
+            const uint64_t head = buffer->Head.load(std::memory_order_acquire);
+            if (head == tail) {
+                continue;
+            }
+
+            // Whole records only. (The recording thread publishes a record at once)
+            const size_t begin = tail % REPLAY_BUFFER_SIZE;
+            const size_t size = head - tail;
+            const size_t firstSize = std::min(size, (size_t)REPLAY_BUFFER_SIZE - begin);
+            if (!WriteFull(replayFd, buffer->Data + begin, firstSize) || !WriteFull(replayFd, buffer->Data, size - firstSize)) {
+                std::cerr << "Failed to write replay log. errno: " << errno << std::endl;
+            }
+            buffer->Tail.store(head, std::memory_order_release);
+        }
+    }
+}
+
+bool Recorder::Open(const char* path, uint32_t tickRate, uint64_t serverSeed, uint32_t sessionIdBase)
+{
+    const int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd == -1) {
+        std::cerr << "Failed to open replay log: " << path << ". errno: " << errno << std::endl;
+        return false;
+    }
+
+    // Wall time steps are whole milliseconds. The remainder of the tick duration carries over to the next step.
+    NominalStepMs = (1000 + tickRate / 2) / tickRate;
+
+    replaySegment.Magic = REPLAY_LOG_MAGIC;
+    replaySegment.Version = REPLAY_LOG_VERSION;
+    replaySegment.SnapshotVersion = SESSION_SNAPSHOT_VERSION;
+    replaySegment.ProcessID = (uint32_t)getpid();
+    replaySegment.TickRate = tickRate;
+    replaySegment.NominalStepMs = NominalStepMs;
+    replaySegment.SessionIdBase = sessionIdBase;
+    replaySegment.ServerSeed = serverSeed;
+    replaySegment.StartTime = (int64_t)time(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(replayFileMutex);
+        replayFd = fd;
+        WriteRecord(ReplayRecordType::Segment, &replaySegment, sizeof(replaySegment));
+    }
+
+    std::thread([]() {
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(REPLAY_FLUSH_INTERVAL_MS));
+            Flush();
+        }
+    }).detach();
+
+    bEnabled.store(true, std::memory_order_relaxed);
+    std::cout << "[LOG] Recording sessions to " << path << std::endl;
+    return true;
+}
+
+void Recorder::Append(ReplayRecordType type, uint32_t replayID, uint32_t tick, const void* payload, size_t payloadSize)
+{
+    ReplayBuffer* const buffer = GetThreadReplayBuffer();
+
+    const size_t size = sizeof(ReplayRecord) + payloadSize;
+    const uint64_t head = buffer->Head.load(std::memory_order_relaxed);
+    if (head + size - buffer->Tail.load(std::memory_order_acquire) > REPLAY_BUFFER_SIZE) {
+        buffer->NumDropped.store(buffer->NumDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    char record[sizeof(ReplayRecord) + sizeof(ReplayPayload_Resume)];
+    const ReplayRecord header = { (uint8_t)type, replayID, tick };
+    memcpy(record, &header, sizeof(header));
+    if (payloadSize != 0) {
+        memcpy(record + sizeof(header), payload, payloadSize);
+    }
+
+    const size_t begin = head % REPLAY_BUFFER_SIZE;
+    const size_t firstSize = std::min(size, (size_t)REPLAY_BUFFER_SIZE - begin);
+    memcpy(buffer->Data + begin, record, firstSize);
+    memcpy(buffer->Data, record + firstSize, size - firstSize);
+    buffer->Head.store(head + size, std::memory_order_release);
+}
+
+void Recorder::Flush()
+{
+    std::lock_guard<std::mutex> lock(replayFileMutex);
+    if (replayFd != -1) {
+        WriteBufferedRecords();
+    }
+}
+
+void Recorder::BeginSegment()
+{
+    std::lock_guard<std::mutex> lock(replayFileMutex);
+    if (replayFd != -1) {
+        WriteBufferedRecords();
+        WriteRecord(ReplayRecordType::Segment, &replaySegment, sizeof(replaySegment));
+    }
+}
+
+bool Recorder::GetPayloadSize(uint8_t type, size_t& payloadSize)
+{
+    switch ((ReplayRecordType)type)
+    {
+    case ReplayRecordType::Segment:      payloadSize = sizeof(ReplayPayload_Segment);  return true;
+    case ReplayRecordType::Create:       payloadSize = sizeof(ReplayPayload_Create);   return true;
+    case ReplayRecordType::Resume:       payloadSize = sizeof(ReplayPayload_Resume);   return true;
+    case ReplayRecordType::Bot:          payloadSize = sizeof(ReplayPayload_Bot);      return true;
+    case ReplayRecordType::BeginRound:   payloadSize = 0;                              return true;
+    case ReplayRecordType::Input:        payloadSize = sizeof(ReplayPayload_Input);    return true;
+    case ReplayRecordType::Step:         payloadSize = sizeof(ReplayPayload_Step);     return true;
+    case ReplayRecordType::RoundEnd:     payloadSize = sizeof(ReplayPayload_RoundEnd); return true;
+    case ReplayRecordType::Close:        payloadSize = sizeof(ReplayPayload_Close);    return true;
+    case ReplayRecordType::Gap:          payloadSize = sizeof(ReplayPayload_Gap);      return true;
+    case ReplayRecordType::RoundTimeout: payloadSize = sizeof(ReplayPayload_RoundEnd); return true;
+    }
+    return false;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+#include "config.hpp"
+#include "Session.hpp"
+
+/**
+ * Replay recorder. (`--record <path>`)
+ *
+ * Appends everything the simulation of a session depends on to a binary log, so that the session can be replayed offline tick by tick:
+ *  - Creation: the parameters and the seed of the session RNG. (Or the snapshot of a session resumed from another process)
+ *  - Bot slots, round begins, round timeouts, and every queued input with the tick it is applied in and the time into that tick.
+ *  - Ticks whose time step differs from the nominal tick duration. (The step is the wall time since the last tick)
+ * Round ends and the deletion of a session are recorded with the scores and the ball position, to check a replay against.
+ *
+ * Records are appended to a buffer of the calling thread (Reactor or session worker) without a lock or a syscall,
+ * and a background thread writes the buffers to the file every REPLAY_FLUSH_INTERVAL_MS.
+ * A full buffer drops records. The writer logs it and appends a Gap record.
+ *
+ * A session is recorded by its reactor between ticks and by the worker ticking it, so its records may be out of order across threads.
+ * (Even the first tick may come before the creation)
+ * Sorted by Tick, the Step and RoundEnd records of a tick come first (Recorded during the tick), then the others in the order of the log.
+ * (Round timeouts are recorded by the reactor, so they are ordered with the inputs and round begins)
+ *
+ * The log is append-only. Every process starts a segment, so a log can hold the runs of several processes.
+ * (e.g. Restarts, hot restarts) Records belong to the last segment before them.
+ * */
+enum class ReplayRecordType : uint8_t
+{
+    Segment      = 0, //< ReplayPayload_Segment. A process started recording
+    Create       = 1, //< ReplayPayload_Create
+    Resume       = 2, //< ReplayPayload_Resume. Follows the Create of a session resumed from a snapshot, and replaces its state
+    Bot          = 3, //< ReplayPayload_Bot
+    BeginRound   = 4, //< No payload
+    Input        = 5, //< ReplayPayload_Input. Applied during the next tick
+    Step         = 6, //< ReplayPayload_Step. Time step of the tick, if it is not the nominal one
+    RoundEnd     = 7, //< ReplayPayload_RoundEnd. The round ended on the tick
+    Close        = 8, //< ReplayPayload_Close. The session was deleted (Ended, aborted, disconnected or migrated away)
+    Gap          = 9, //< ReplayPayload_Gap. Records were dropped
+    RoundTimeout = 10 //< ReplayPayload_RoundEnd. The round timer ended the round after the tick, on a tick without simulation
+};
+
+// Every record starts with the header, followed by the payload of its type
+struct __attribute__((packed)) ReplayRecord
+{
+    uint8_t  Type;     //< ReplayRecordType
+    uint32_t ReplayID; //< Session in the segment. (Session IDs are reused, replay IDs are not)
+    uint32_t Tick;     //< Session::GetTickNumber() when recorded. Step and RoundEnd carry the tick they belong to
+};
+
+struct __attribute__((packed)) ReplayPayload_Segment
+{
+    uint32_t Magic;           //< REPLAY_LOG_MAGIC
+    uint32_t Version;         //< REPLAY_LOG_VERSION
+    uint32_t SnapshotVersion; //< SESSION_SNAPSHOT_VERSION
+    uint32_t ProcessID;
+    uint32_t TickRate;
+    uint32_t NominalStepMs;   //< Time step of the ticks without a Step record
+    uint32_t SessionIdBase;
+    uint64_t ServerSeed;
+    int64_t  StartTime;       //< Unix time in seconds
+};
+
+struct __attribute__((packed)) ReplayPayload_Create
+{
+    uint32_t SessionID;
+    uint64_t Seed; //< Session RNG. (Pcg32::Seed)
+    uint32_t FieldWidth;
+    uint32_t FieldHeight;
+    uint32_t WinScore;
+    uint32_t GameTime;
+    uint32_t BallSpeed;
+    uint32_t BallRadius;
+    uint32_t PaddleSpeed;
+    uint32_t PaddleSize;
+    uint32_t PaddleOffsetFromWall;
+};
+
+struct __attribute__((packed)) ReplayPayload_Resume
+{
+    Session::Snapshot Snapshot;
+};
+
+struct __attribute__((packed)) ReplayPayload_Bot
+{
+    uint8_t PlayerID; //< Session::PlayerID
+    uint8_t bBot;
+};
+
+struct __attribute__((packed)) ReplayPayload_Input
+{
+    uint8_t  PlayerID; //< Session::PlayerID
+    uint8_t  Key;      //< Session::InputKey
+    uint8_t  Type;     //< Session::InputType
+    uint32_t OffsetUs; //< Time into the next tick it was received at
+};
+
+struct __attribute__((packed)) ReplayPayload_Step
+{
+    uint32_t DeltaMs;
+};
+
+struct __attribute__((packed)) ReplayPayload_RoundEnd
+{
+    uint8_t  Result; //< Session::RoundResultType
+    uint32_t ScoreA;
+    uint32_t ScoreB;
+    float    BallPos[2];
+};
+
+struct __attribute__((packed)) ReplayPayload_Close
+{
+    uint32_t ScoreA;
+    uint32_t ScoreB;
+    float    BallPos[2];
+};
+
+struct __attribute__((packed)) ReplayPayload_Gap
+{
+    uint64_t NumDroppedRecords;
+};
+
+class Recorder
+{
+public:
+    static inline bool IsEnabled() { return bEnabled.load(std::memory_order_relaxed); }
+
+    // Open the log for appending, start a segment and the writer thread, and enable recording.
+    static bool Open(const char* path, uint32_t tickRate, uint64_t serverSeed, uint32_t sessionIdBase);
+
+    // Time step of a tick that is not recorded
+    static inline uint32_t GetNominalStepMs() { return NominalStepMs; }
+
+    // Append a record to the buffer of the calling thread. payloadSize is the size of the payload of the type.
+    static void Append(ReplayRecordType type, uint32_t replayID, uint32_t tick, const void* payload = nullptr, size_t payloadSize = 0);
+
+    // Write the buffered records now. (e.g. Before the process exits)
+    static void Flush();
+
+    // Start a new segment of this process. (The old process resuming after a failed hot restart, where the new one already recorded)
+    // Call while no thread is recording.
+    static void BeginSegment();
+
+    // Size of the payload of the record type. false for an unknown type. (For readers of the log)
+    static bool GetPayloadSize(uint8_t type, size_t& payloadSize);
+
+private:
+    static std::atomic<bool> bEnabled;
+    static uint32_t NominalStepMs;
+};
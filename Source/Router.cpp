@@ -0,0 +1,701 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "Router.hpp"
+#include "Query.hpp"
+
+namespace
+{
+    struct __attribute__((packed)) Result_Response
+    {
+        uint32_t QueryID;
+        uint8_t Result;
+    };
+
+    // Queries creating sessions are balanced over the shards
+    uint32_t GetNumCreatedSessions(uint32_t queryID, const char* param, uint32_t paramLength)
+    {
+        if (queryID == 101 || queryID == 103 || queryID == 108) {
+            return 1;
+        }
+        if (queryID == 111 && paramLength >= sizeof(uint16_t)) {
+            uint16_t count;
+            memcpy(&count, param, sizeof(count));
+            return count;
+        }
+        return 0;
+    }
+
+    void SetNoDelay(int socket)
+    {
+        // Queries and responses are relayed one by one, don't let them wait for the ack of the previous segment
+        int opt = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+}
+
+Router::Router(uint16_t port, SendOverflowPolicy overflowPolicy)
+    : Port(port)
+    , OverflowPolicy(overflowPolicy)
+    , ListenSocket(-1)
+    , LastStatusTime()
+    , LastReportTime(std::chrono::steady_clock::now())
+{
+}
+
+Router::~Router()
+{
+    for (RoutedClient* client : Clients) {
+        CloseClient(*client);
+        delete client;
+    }
+    for (Shard& shard : Shards) {
+        delete shard.StatusLink;
+    }
+    close(ListenSocket);
+}
+
+bool Router::Open(const char* shardList)
+{
+    // Parse the shard addresses
+    std::string list = shardList;
+    size_t begin = 0;
+    while (begin <= list.size())
+    {
+        const size_t end = std::min(list.find(',', begin), list.size());
+        const std::string entry = list.substr(begin, end - begin);
+        const size_t colon = entry.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Invalid shard address: " << entry << " (host:port)" << std::endl;
+            return false;
+        }
+
+        Shard shard = {};
+        shard.Address.sin_family = AF_INET;
+        shard.Address.sin_addr.s_addr = inet_addr(entry.substr(0, colon).c_str());
+        shard.Address.sin_port = htons((uint16_t)atoi(entry.c_str() + colon + 1));
+        if (shard.Address.sin_addr.s_addr == INADDR_NONE || shard.Address.sin_port == 0) {
+            std::cerr << "Invalid shard address: " << entry << " (host:port)" << std::endl;
+            return false;
+        }
+        Shards.push_back(shard);
+
+        begin = end + 1;
+    }
+
+    // Init listen socket
+    ListenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (ListenSocket == -1) {
+        std::cerr << "Failed to create socket" << std::endl;
+        return false;
+    }
+    int opt = 1;
+    if (setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+        std::cerr << "Failed to set socket option" << std::endl;
+        return false;
+    }
+    fcntl(ListenSocket, F_SETFL, fcntl(ListenSocket, F_GETFL, 0) | O_NONBLOCK);
+
+    sockaddr_in routerAddress;
+    memset(&routerAddress, 0, sizeof(routerAddress));
+    routerAddress.sin_family = AF_INET;
+    routerAddress.sin_addr.s_addr = INADDR_ANY;
+    routerAddress.sin_port = htons(Port);
+    if (bind(ListenSocket, (struct sockaddr*)&routerAddress, sizeof(routerAddress)) == -1) {
+        std::cerr << "Failed to bind socket to address" << std::endl;
+        return false;
+    }
+    if (listen(ListenSocket, SOMAXCONN) == -1) {
+        std::cerr << "Failed to listen for connections" << std::endl;
+        return false;
+    }
+
+    // Shards that are down are retried on every status poll
+    for (Shard& shard : Shards) {
+        shard.StatusLink = ConnectLink(shard.Address, 0);
+        std::cout << "[LOG] Shard " << inet_ntoa(shard.Address.sin_addr) << ":" << ntohs(shard.Address.sin_port)
+                  << ((shard.StatusLink != nullptr) ? " connected" : " is down") << std::endl;
+    }
+    std::cout << "[LOG] Router on port " << Port << ", " << Shards.size() << " shards." << std::endl;
+
+    return true;
+}
+
+Router::Link* Router::ConnectLink(const sockaddr_in& address, uint32_t clientAddr)
+{
+    // Blocking connect. Shards are expected on the same host or the same rack, where it takes a round trip.
+    const int linkSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (linkSocket == -1) {
+        return nullptr;
+    }
+    if (linkSocket >= FD_SETSIZE || connect(linkSocket, (const struct sockaddr*)&address, sizeof(address)) == -1) {
+        close(linkSocket);
+        return nullptr;
+    }
+    SetNoDelay(linkSocket);
+
+    Link* link = new Link;
+    link->Connection.socket = linkSocket;
+    link->Connection.address = address;
+
+    // Upgrade to v2 first, so that every response after the upgrade response carries its length
+    const uint32_t upgradeQuery[2] = { 1, 2 };
+    AppendQueryResponse(link->Connection, upgradeQuery, sizeof(upgradeQuery));
+    link->Connection.protocolVersion = 2;
+    link->NumSkipBytes = sizeof(Result_Response);
+
+    // Streams and UDP input of the sessions are between the shard and the client itself
+    if (clientAddr != 0) {
+        const uint32_t setClientAddressQuery[2] = { 2, clientAddr };
+        AppendQueryResponse(link->Connection, setClientAddressQuery, sizeof(setClientAddressQuery));
+    }
+
+    return link;
+}
+
+void Router::UpdateStatusLinks()
+{
+    const std::chrono::steady_clock::time_point nowTime = std::chrono::steady_clock::now();
+    if (nowTime - LastStatusTime < std::chrono::milliseconds(ROUTER_STATUS_INTERVAL_MS)) {
+        return;
+    }
+    LastStatusTime = nowTime;
+
+    for (Shard& shard : Shards)
+    {
+        if (shard.StatusLink == nullptr) {
+            shard.StatusLink = ConnectLink(shard.Address, 0);
+            if (shard.StatusLink == nullptr) {
+                continue;
+            }
+            std::cout << "[LOG] Shard " << inet_ntoa(shard.Address.sin_addr) << ":" << ntohs(shard.Address.sin_port) << " connected" << std::endl;
+        }
+
+        // One status query at a time. A shard too busy to answer keeps its last status.
+        if (!shard.bStatusPending) {
+            const uint32_t getServerStatusQuery = 3;
+            AppendQueryResponse(shard.StatusLink->Connection, &getServerStatusQuery, sizeof(getServerStatusQuery));
+            shard.bStatusPending = true;
+            shard.NumRoutedCreatesAtRequest = shard.NumRoutedCreates;
+        }
+    }
+
+    // Report
+    if (nowTime - LastReportTime >= std::chrono::seconds(CLIENT_METRICS_REPORT_INTERVAL_SEC))
+    {
+        std::cout << "[ROUTER] clients: " << Clients.size();
+        for (Shard& shard : Shards) {
+            std::cout << " | shard " << shard.ShardID << ": ";
+            if (shard.StatusLink == nullptr) {
+                std::cout << "down";
+            }
+            else {
+                std::cout << "free " << shard.NumFreeSessionIds << ", queries " << shard.NumRoutedQueries;
+            }
+            shard.NumRoutedQueries = 0;
+        }
+        std::cout << std::endl;
+        LastReportTime = nowTime;
+    }
+}
+
+void Router::AcceptClients()
+{
+    while (true)
+    {
+        RoutedClient* newClient = new RoutedClient;
+        assert(newClient != nullptr);
+
+        Client& downstream = newClient->Downstream;
+        downstream.socket = accept(ListenSocket, (struct sockaddr*)&downstream.address, &downstream.addressLen);
+        if (downstream.socket == -1) {
+            delete newClient;
+            break;
+        }
+        if (downstream.socket >= FD_SETSIZE) {
+            std::cout << "[LOG] Client refused. Out of select() slots." << std::endl;
+            delete newClient;
+            continue;
+        }
+        SetNoDelay(downstream.socket);
+        downstream.sendOverflowPolicy = OverflowPolicy;
+
+        newClient->Upstreams.resize(Shards.size(), nullptr);
+        newClient->Target = -1;
+        newClient->NumOutstanding = 0;
+        newClient->bClosing = false;
+
+        Clients.push_back(newClient);
+    }
+}
+
+int32_t Router::SelectLeastLoadedShard()
+{
+    // Free sessions at the last status, minus the sessions routed since then
+    int32_t bestShardIndex = -1;
+    int64_t bestNumFree = 0;
+    for (size_t i = 0; i < Shards.size(); i++) {
+        if (Shards[i].StatusLink == nullptr) {
+            continue;
+        }
+        const int64_t numFree = (int64_t)Shards[i].NumFreeSessionIds - Shards[i].NumRoutedCreates;
+        if (bestShardIndex == -1 || numFree > bestNumFree) {
+            bestShardIndex = (int32_t)i;
+            bestNumFree = numFree;
+        }
+    }
+    return bestShardIndex;
+}
+
+int32_t Router::FindShard(uint32_t sessionID) const
+{
+    const uint32_t shardID = sessionID >> SESSION_ID_SHARD_SHIFT;
+    for (size_t i = 0; i < Shards.size(); i++) {
+        if (Shards[i].ShardID != 0 && Shards[i].ShardID == shardID) {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+int32_t Router::SelectShard(uint32_t queryID, const char* param, uint32_t paramLength)
+{
+    uint32_t sessionID;
+    switch (queryID)
+    {
+    case 101: case 103: case 108: case 111:
+        return SelectLeastLoadedShard();
+
+    case 102: case 104: case 105: case 107: case 201: case 301: case 401: case 402: case 403:
+        if (paramLength < sizeof(sessionID)) {
+            break;
+        }
+        memcpy(&sessionID, param, sizeof(sessionID));
+        return FindShard(sessionID);
+
+    case 112: case 211:
+        // Bulk query by the shard of its first entry. The entries of the other shards fail there.
+        if (paramLength < sizeof(uint16_t) + sizeof(sessionID)) {
+            break;
+        }
+        memcpy(&sessionID, param + sizeof(uint16_t), sizeof(sessionID));
+        return FindShard(sessionID);
+
+    default:
+        break;
+    }
+
+    // Malformed, or a query the router answers itself
+    return -1;
+}
+
+bool Router::ForwardQuery(RoutedClient& client, int32_t shardIndex, const char* frame, uint32_t frameLength)
+{
+    Link*& upstream = client.Upstreams[shardIndex];
+    if (upstream == nullptr) {
+        upstream = ConnectLink(Shards[shardIndex].Address, client.Downstream.address.sin_addr.s_addr);
+        if (upstream == nullptr) {
+            return false;
+        }
+    }
+
+    AppendQueryResponse(upstream->Connection, frame, frameLength);
+    client.Target = shardIndex;
+    client.NumOutstanding += 1;
+    Shards[shardIndex].NumRoutedQueries += 1;
+    return true;
+}
+
+void Router::RouteQueries(RoutedClient& client)
+{
+    Client& downstream = client.Downstream;
+    const char* const data = downstream.recvBuffer.data();
+    const size_t size = downstream.recvBuffer.size();
+
+    size_t offset = 0;
+    while (!client.bClosing)
+    {
+        // Frame of the query (QueryID + Param), in the framing of the client
+        uint32_t queryID;
+        const char* frame;
+        uint32_t frameLength;
+        size_t frameOffset;
+        if (downstream.protocolVersion == 1)
+        {
+            if (size - offset < sizeof(queryID)) {
+                break;
+            }
+            memcpy(&queryID, data + offset, sizeof(queryID));
+
+            uint32_t paramSize;
+            bool bBulk;
+            if (!GetQueryParamSize(queryID, paramSize, bBulk) || bBulk) {
+                // Without a length, only the QueryID can be skipped
+                if (client.NumOutstanding != 0) {
+                    break;
+                }
+                SendQueryFailure(downstream, queryID);
+                offset += sizeof(queryID);
+                continue;
+            }
+            if (size - offset - sizeof(queryID) < paramSize) {
+                break;
+            }
+            frame = data + offset;
+            frameLength = sizeof(queryID) + paramSize;
+            frameOffset = offset + frameLength;
+        }
+        else
+        {
+            uint32_t length;
+            if (size - offset < sizeof(length)) {
+                break;
+            }
+            memcpy(&length, data + offset, sizeof(length));
+            if (length < sizeof(queryID) || length > QUERY_V2_MAX_FRAME_LENGTH) {
+                // The frame boundary is lost. Close the connection. (recv() returns 0 on the next poll)
+                std::cerr << "Invalid query frame length: " << length << std::endl;
+                shutdown(downstream.socket, SHUT_RDWR);
+                offset = size;
+                break;
+            }
+            if (size - offset - sizeof(length) < length) {
+                break;
+            }
+            memcpy(&queryID, data + offset + sizeof(length), sizeof(queryID));
+            frame = data + offset + sizeof(length);
+            frameLength = length;
+            frameOffset = offset + sizeof(length) + length;
+        }
+        const char* const param = frame + sizeof(queryID);
+        const uint32_t paramLength = frameLength - sizeof(queryID);
+
+        // Keep the responses in the order of the queries
+        const int32_t shardIndex = SelectShard(queryID, param, paramLength);
+        if (client.NumOutstanding != 0 && shardIndex != client.Target) {
+            break;
+        }
+        offset = frameOffset;
+
+        if (shardIndex == -1)
+        {
+            // UpgradeProtocol is answered in the framing of the old version
+            uint32_t version = 0;
+            if (queryID == 1 && downstream.protocolVersion == 1 && paramLength >= sizeof(version)) {
+                memcpy(&version, param, sizeof(version));
+            }
+            if (version == 2) {
+                const Result_Response response = { queryID, 0 };
+                SendQueryResponse(downstream, response);
+                downstream.protocolVersion = 2;
+            }
+            else {
+                SendQueryFailure(downstream, queryID);
+            }
+            continue;
+        }
+
+        if (!ForwardQuery(client, shardIndex, frame, frameLength)) {
+            std::cout << "[LOG] Failed to connect to shard " << Shards[shardIndex].ShardID << ". Client closed." << std::endl;
+            CloseClient(client);
+            break;
+        }
+        Shards[shardIndex].NumRoutedCreates += GetNumCreatedSessions(queryID, param, paramLength);
+    }
+
+    downstream.recvBuffer.erase(downstream.recvBuffer.begin(), downstream.recvBuffer.begin() + offset);
+}
+
+bool Router::RelayResponses(RoutedClient& client, Link& link)
+{
+    Client& upstream = link.Connection;
+    Client& downstream = client.Downstream;
+    const char* const data = upstream.recvBuffer.data();
+    const size_t size = upstream.recvBuffer.size();
+
+    size_t offset = std::min(link.NumSkipBytes, size);
+    link.NumSkipBytes -= offset;
+
+    uint32_t length;
+    while (size - offset >= sizeof(length))
+    {
+        memcpy(&length, data + offset, sizeof(length));
+        if (length < sizeof(Result_Response) || length > QUERY_V2_MAX_FRAME_LENGTH) {
+            std::cerr << "Invalid response frame length from shard: " << length << std::endl;
+            return false;
+        }
+        if (size - offset - sizeof(length) < length) {
+            break;
+        }
+        const char* const response = data + offset + sizeof(length);
+        offset += sizeof(length) + length;
+
+        Result_Response header;
+        memcpy(&header, response, sizeof(header));
+        if (header.QueryID == 2) {
+            // SetClientAddress of the router itself
+            if (header.Result != 0) {
+                std::cout << "[LOG] Shard refused SetClientAddress. (Not started with --shard?)" << std::endl;
+                return false;
+            }
+        }
+        else if (header.QueryID == 201 && length == sizeof(uint32_t) * 2) {
+            // Round result pushed by the shard. (The BeginRound response is a Result_Response)
+            AppendQueryResponse(downstream, response, length);
+        }
+        else {
+            if (client.NumOutstanding == 0) {
+                std::cerr << "Unexpected response from shard. QueryID: " << header.QueryID << std::endl;
+                return false;
+            }
+            client.NumOutstanding -= 1;
+
+            if (header.QueryID == 301) {
+                AppendQueryAck(downstream, response, length);
+            }
+            else {
+                AppendQueryResponse(downstream, response, length);
+            }
+        }
+    }
+
+    upstream.recvBuffer.erase(upstream.recvBuffer.begin(), upstream.recvBuffer.begin() + offset);
+    return true;
+}
+
+void Router::HandleStatusResponses(Shard& shard)
+{
+    struct __attribute__((packed)) GetServerStatus_Response
+    {
+        uint32_t QueryID;
+        uint8_t Result;
+        uint32_t ShardID;
+        uint32_t NumSessions;
+        uint32_t MaxSessions;
+    } response;
+
+    Link& link = *shard.StatusLink;
+    Client& connection = link.Connection;
+    const char* const data = connection.recvBuffer.data();
+    const size_t size = connection.recvBuffer.size();
+
+    size_t offset = std::min(link.NumSkipBytes, size);
+    link.NumSkipBytes -= offset;
+
+    uint32_t length;
+    while (size - offset >= sizeof(length))
+    {
+        memcpy(&length, data + offset, sizeof(length));
+        if (size - offset - sizeof(length) < length) {
+            break;
+        }
+        if (length >= sizeof(response)) {
+            memcpy(&response, data + offset + sizeof(length), sizeof(response));
+            if (response.QueryID == 3 && response.Result == 0) {
+                if (shard.ShardID != response.ShardID) {
+                    std::cout << "[LOG] Shard " << inet_ntoa(shard.Address.sin_addr) << ":" << ntohs(shard.Address.sin_port)
+                              << " has shard ID " << response.ShardID << std::endl;
+                }
+                shard.ShardID = response.ShardID;
+                shard.NumFreeSessionIds = (response.MaxSessions > response.NumSessions) ? response.MaxSessions - response.NumSessions : 0;
+                shard.NumRoutedCreates -= std::min(shard.NumRoutedCreates, shard.NumRoutedCreatesAtRequest);
+                shard.NumRoutedCreatesAtRequest = 0;
+                shard.bStatusPending = false;
+            }
+        }
+        offset += sizeof(length) + length;
+    }
+
+    connection.recvBuffer.erase(connection.recvBuffer.begin(), connection.recvBuffer.begin() + offset);
+}
+
+bool Router::FlushSendBuffer(Client& connection)
+{
+    if (connection.GetQueuedBytes() == 0) {
+        return true;
+    }
+    const ssize_t nBytesSent = send(connection.socket, connection.GetQueuedData(), connection.GetQueuedBytes(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (nBytesSent == -1) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    connection.ConsumeSendBuffer((size_t)nBytesSent);
+    return true;
+}
+
+bool Router::ReceiveAll(Client& connection)
+{
+    char buffer[4096];
+    const ssize_t nBytesRecv = recv(connection.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (nBytesRecv == -1) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    if (nBytesRecv == 0) {
+        return false;
+    }
+    connection.recvBuffer.insert(connection.recvBuffer.end(), buffer, buffer + nBytesRecv);
+    return true;
+}
+
+void Router::CloseClient(RoutedClient& client)
+{
+    // Closing the upstreams makes the shards abort the sessions of the client
+    for (Link*& upstream : client.Upstreams) {
+        delete upstream;
+        upstream = nullptr;
+    }
+    client.bClosing = true;
+}
+
+void Router::Run()
+{
+    while (true)
+    {
+        /* ----------------------------- Poll Sockets ----------------------------- */
+        // Rebuilt on every iteration, sockets are only polled for writing while they have queued bytes
+        fd_set recvFdSet;
+        fd_set sendFdSet;
+        FD_ZERO(&recvFdSet);
+        FD_ZERO(&sendFdSet);
+        int maxFd = ListenSocket;
+        const auto addSocket = [&](const Client& connection) {
+            FD_SET(connection.socket, &recvFdSet);
+            if (connection.GetQueuedBytes() != 0) {
+                FD_SET(connection.socket, &sendFdSet);
+            }
+            maxFd = std::max(maxFd, connection.socket);
+        };
+
+        FD_SET(ListenSocket, &recvFdSet);
+        for (Shard& shard : Shards) {
+            if (shard.StatusLink != nullptr) {
+                addSocket(shard.StatusLink->Connection);
+            }
+        }
+        for (RoutedClient* client : Clients) {
+            addSocket(client->Downstream);
+            for (Link* upstream : client->Upstreams) {
+                if (upstream != nullptr) {
+                    addSocket(upstream->Connection);
+                }
+            }
+        }
+
+        // Wake up for the next status poll
+        const std::chrono::steady_clock::duration untilStatus = std::chrono::milliseconds(ROUTER_STATUS_INTERVAL_MS) - (std::chrono::steady_clock::now() - LastStatusTime);
+        const int64_t timeoutUs = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(untilStatus).count());
+        timeval timeout = { (time_t)(timeoutUs / 1000000), (suseconds_t)(timeoutUs % 1000000) };
+        if (select(maxFd + 1, &recvFdSet, &sendFdSet, NULL, &timeout) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Failed to select" << std::endl;
+            exit(1);
+        }
+
+        if (FD_ISSET(ListenSocket, &recvFdSet)) {
+            AcceptClients();
+        }
+
+        /* ------------------------------ Status Links ----------------------------- */
+        for (Shard& shard : Shards)
+        {
+            if (shard.StatusLink == nullptr) {
+                continue;
+            }
+            Client& connection = shard.StatusLink->Connection;
+            bool bConnected = true;
+            if (FD_ISSET(connection.socket, &sendFdSet)) {
+                bConnected = FlushSendBuffer(connection);
+            }
+            if (bConnected && FD_ISSET(connection.socket, &recvFdSet)) {
+                bConnected = ReceiveAll(connection);
+                HandleStatusResponses(shard);
+            }
+
+            // Not balanced to until the status link is back
+            if (!bConnected) {
+                std::cout << "[LOG] Shard " << shard.ShardID << " is down" << std::endl;
+                delete shard.StatusLink;
+                shard.StatusLink = nullptr;
+                shard.bStatusPending = false;
+            }
+        }
+
+        /* -------------------------------- Clients -------------------------------- */
+        for (std::vector<RoutedClient*>::iterator clientIt = Clients.begin(); clientIt != Clients.end();)
+        {
+            RoutedClient& client = *(*clientIt);
+            Client& downstream = client.Downstream;
+
+            // Responses of the shards
+            for (Link* upstream : client.Upstreams) {
+                if (upstream == nullptr || client.bClosing) {
+                    continue;
+                }
+                const int upstreamSocket = upstream->Connection.socket;
+                bool bConnected = !upstream->Connection.bSendOverflowed;
+                if (bConnected && FD_ISSET(upstreamSocket, &sendFdSet)) {
+                    bConnected = FlushSendBuffer(upstream->Connection);
+                }
+                if (bConnected && FD_ISSET(upstreamSocket, &recvFdSet)) {
+                    bConnected = ReceiveAll(upstream->Connection) && RelayResponses(client, *upstream);
+                }
+                if (!bConnected) {
+                    std::cout << "[LOG] Shard connection lost. Client closed." << std::endl;
+                    CloseClient(client);
+                }
+            }
+
+            // Queries of the client
+            if (!client.bClosing) {
+                bool bConnected = true;
+                if (FD_ISSET(downstream.socket, &sendFdSet)) {
+                    bConnected = FlushSendBuffer(downstream);
+                }
+                if (bConnected && FD_ISSET(downstream.socket, &recvFdSet)) {
+                    bConnected = ReceiveAll(downstream);
+                }
+                if (downstream.bSendOverflowed) {
+                    std::cout << "[LOG] Client disconnected by send overflow. queued: " << downstream.GetQueuedBytes() << " bytes" << std::endl;
+                    bConnected = false;
+                }
+                if (!bConnected) {
+                    CloseClient(client);
+                }
+            }
+
+            // Also resumes the queries that waited for the responses relayed above
+            if (!client.bClosing) {
+                RouteQueries(client);
+            }
+
+            if (client.bClosing) {
+                delete *clientIt;
+                clientIt = Clients.erase(clientIt);
+                continue;
+            }
+
+            // Send right away instead of waiting for the next poll
+            FlushSendBuffer(downstream);
+            for (Link* upstream : client.Upstreams) {
+                if (upstream != nullptr) {
+                    FlushSendBuffer(upstream->Connection);
+                }
+            }
+
+            ++clientIt;
+        }
+
+        /* ------------------------------ Shard Status ----------------------------- */
+        UpdateStatusLinks();
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <sys/select.h>
+#include <arpa/inet.h>
+
+#include "config.hpp"
+#include "Client.hpp"
+
+/**
+ * Control query router in front of sharded server processes. (`--router`)
+ *
+ * Every shard owns the session IDs with its shard ID in the high bits. (See SESSION_ID_SHARD_SHIFT)
+ * The router forwards a query on a session to the shard encoded in the SessionID,
+ * and a query creating sessions to the shard with the most free sessions. (Polled with GetServerStatus)
+ *
+ * Each client gets its own v2 connection to every shard it uses, so the shards see one client per client,
+ * and the UDP streams go straight from the shard to the address of the client. (SetClientAddress)
+ * Responses are relayed in the order of the queries. While responses of one shard are outstanding,
+ * a query to another shard waits. Round results are pushed as they arrive.
+ *
+ * Not routed: the UDP input channel (EnableUdpInput fails), and bulk queries across shards.
+ * (A bulk query goes to the shard of its first entry)
+ * */
+class Router
+{
+public:
+    Router(uint16_t port, SendOverflowPolicy overflowPolicy);
+
+    ~Router();
+
+    // Listen on the port, and connect the status links to the shards. ("host:port,host:port,...")
+    bool Open(const char* shardList);
+
+    // Run the event loop on the calling thread. Doesn't return.
+    void Run();
+
+private:
+    // Connection to a shard. The shard speaks v2 after the leading upgrade response.
+    struct Link
+    {
+        Client Connection;
+        size_t NumSkipBytes; //< UpgradeProtocol response, still in v1 framing
+    };
+
+    struct Shard
+    {
+        sockaddr_in Address;
+        Link*       StatusLink; //< nullptr: Down
+        bool        bStatusPending;
+        uint32_t    ShardID;    //< 0: Unknown yet
+        uint32_t    NumFreeSessionIds;
+        uint32_t    NumRoutedCreates;          //< Sessions routed to the shard since the last status
+        uint32_t    NumRoutedCreatesAtRequest; //< Already counted by the pending status
+        uint64_t    NumRoutedQueries;          //< Since the last report
+    };
+
+    struct RoutedClient
+    {
+        Client             Downstream;
+        std::vector<Link*> Upstreams;      //< Per shard. nullptr: Not connected yet
+        int32_t            Target;         //< Shard of the outstanding queries. -1: None
+        uint32_t           NumOutstanding; //< Responses to relay before a query may go to another shard
+        bool               bClosing;
+    };
+
+private:
+    Link* ConnectLink(const sockaddr_in& address, uint32_t clientAddr);
+
+    void UpdateStatusLinks();
+
+    void AcceptClients();
+
+    // Parse the queries of the client and forward them. Stops at a query that must wait for outstanding responses.
+    void RouteQueries(RoutedClient& client);
+
+    // Forward a query frame (QueryID + Param) to the shard. false if the shard is unreachable.
+    bool ForwardQuery(RoutedClient& client, int32_t shardIndex, const char* frame, uint32_t frameLength);
+
+    // Shard to forward the query to. -1: Answered by the router
+    int32_t SelectShard(uint32_t queryID, const char* param, uint32_t paramLength);
+
+    int32_t SelectLeastLoadedShard();
+
+    int32_t FindShard(uint32_t sessionID) const;
+
+    // Relay complete response frames of the link to the client. false if the link is broken.
+    bool RelayResponses(RoutedClient& client, Link& link);
+
+    void HandleStatusResponses(Shard& shard);
+
+    // Send what fits in the socket buffer. false if the connection is broken.
+    bool FlushSendBuffer(Client& connection);
+
+    // Receive what is available. false if the connection is closed.
+    bool ReceiveAll(Client& connection);
+
+    void CloseClient(RoutedClient& client);
+
+private:
+    const uint16_t           Port;
+    const SendOverflowPolicy OverflowPolicy;
+
+    int ListenSocket;
+
+    std::vector<Shard>         Shards;
+    std::vector<RoutedClient*> Clients;
+
+    std::chrono::steady_clock::time_point LastStatusTime;
+    std::chrono::steady_clock::time_point LastReportTime;
+};
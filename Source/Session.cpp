@@ -1,15 +1,54 @@
+#include <algorithm>
 #include "Session.hpp"
+#include "Recorder.hpp"
 
-uint32_t Session::sessionIdPoolTop = 0;
+static_assert(MAX_SESSION <= (1u << SESSION_ID_SHARD_SHIFT), "Local session IDs must fit below the shard bits");
+static_assert((INPUT_EVENT_QUEUE_SIZE & (INPUT_EVENT_QUEUE_SIZE - 1)) == 0, "INPUT_EVENT_QUEUE_SIZE must be a power of two");
+
+uint32_t Session::sessionIdBase = 0;
+uint32_t Session::sessionIdPartitionSize = MAX_SESSION;
+uint32_t Session::sessionIdPoolTop[MAX_REACTOR] = {};
 uint32_t Session::sessionIdPool[MAX_SESSION];
+Session* Session::sessionTable[MAX_SESSION] = {};
+std::atomic<uint32_t> Session::numLiveSessions(0);
+uint64_t Session::serverSeed = 0;
+std::atomic<uint32_t> Session::nextReplayID(1);
+
+void Session::InitSessionIdPool(uint32_t numPartitions, uint32_t idBase) {
+    assert(numPartitions != 0 && numPartitions <= MAX_REACTOR);
+    sessionIdBase = idBase;
+    sessionIdPartitionSize = (MAX_SESSION + numPartitions - 1) / numPartitions;
+
+    // Generate session id pool for unique session id (Lowest ID of the partition on the top)
+    for (uint32_t partition = 0; partition < numPartitions; partition++) {
+        const uint32_t begin = partition * sessionIdPartitionSize;
+        const uint32_t end = std::min(begin + sessionIdPartitionSize, (uint32_t)MAX_SESSION);
+        sessionIdPoolTop[partition] = end - begin;
+        uint32_t* p_sessionIdPool = sessionIdPool + begin;
+        for (uint32_t id = end; id-- > begin;) {
+            *p_sessionIdPool++ = idBase + id;
+        }
+    }
+}
 
-void Session::InitSessionIdPool() {
-    // Generate session id pool for unique session id
-    sessionIdPoolTop = MAX_SESSION;
-    uint32_t* p_sessionIdPool = (uint32_t*)sessionIdPool;
-    for (int i = MAX_SESSION - 1; i >= 0; i--) {
-        *p_sessionIdPool++ = i;
+bool Session::ReserveSessionId(uint32_t sessionID)
+{
+    const uint32_t partition = GetSessionIdPartition(sessionID);
+    if (sessionID - sessionIdBase >= MAX_SESSION || partition >= MAX_REACTOR || sessionIdPoolTop[partition] == 0) {
+        return false;
     }
+
+    // Swap it to the top of the free IDs of the partition.
+    // Searched from the top, where the lowest free IDs are, so reserving IDs in ascending order doesn't scan the pool.
+    uint32_t* const pool = sessionIdPool + partition * sessionIdPartitionSize;
+    uint32_t* const top = pool + sessionIdPoolTop[partition] - 1;
+    for (uint32_t i = sessionIdPoolTop[partition]; i-- > 0;) {
+        if (pool[i] == sessionID) {
+            std::swap(pool[i], *top);
+            return true;
+        }
+    }
+    return false;
 }
 
 Session::Session(Client*  ownerClient,
@@ -24,8 +63,15 @@ Session::Session(Client*  ownerClient,
             uint32_t paddleOffsetFromWall,
             int udpSocket_ObjectPos_Stream,
             sockaddr_in addr_ObjectPos_Stream,
-            uint16_t recvPort_ObjectPos_Stream)
-    : OwnerClient(ownerClient)
+            uint16_t recvPort_ObjectPos_Stream,
+            uint32_t idPartition,
+            uint64_t seed)
+    : bMigrated(false)
+    , bDetached(idPartition == DetachedIdPartition)
+    , OwnerClient(nullptr)
+    , OwnerPrev(nullptr)
+    , OwnerNext(nullptr)
+    , ListIndex(UINT32_MAX)
     , LastTickUpdateTime(std::chrono::steady_clock::now())
     , FieldWidth(fieldWidth)
     , FieldHeight(fieldHeight)
@@ -39,21 +85,254 @@ Session::Session(Client*  ownerClient,
     , UdpSocket_ObjectPos_Stream(udpSocket_ObjectPos_Stream)
     , Addr_ObjectPos_Stream(addr_ObjectPos_Stream)
     , RecvPort_ObjectPos_Stream(recvPort_ObjectPos_Stream)
+    , CurrentStreamMode(StreamMode::PerSession)
+    , StreamInterval(1)
+    , bMulticastEnabled(false)
+    , StreamAckedTick(0)
+    , bStreamAcked(false)
+    , StreamLastKeyframeTick(0)
+    , bStreamKeyframeSent(false)
+    , StreamEventFlags(0)
+    , StreamLastEventTime(0)
+    , InputEventHead(0)
+    , InputEventTail(0)
+    , bUdpInputEnabled(false)
+    , PlayerA_LastInputSeq(0)
+    , PlayerB_LastInputSeq(0)
+    , bBotPlayerA(false)
+    , bBotPlayerB(false)
     , ScoreA(0)
     , ScoreB(0)
+    , TickNumber(0)
     , RoundTimeElapsed(0)
     , bRoundRunning(false)
     , bSessionEnded(false)
+    , CollisionIterationCount(0)
 {
-    assert(sessionIdPoolTop != 0);
-    SessionID = Session::sessionIdPool[--Session::sessionIdPoolTop];
+    if (bDetached) {
+        SessionID = UINT32_MAX;
+    }
+    else {
+        assert(sessionIdPoolTop[idPartition] != 0);
+        SessionID = Session::sessionIdPool[idPartition * sessionIdPartitionSize + --Session::sessionIdPoolTop[idPartition]];
+        Session::sessionTable[SessionID - sessionIdBase] = this;
+        numLiveSessions.fetch_add(1, std::memory_order_relaxed);
+    }
+    StreamSessionID = SessionID;
+    SetOwnerClient(ownerClient);
 
     Addr_ObjectPos_Stream.sin_port = recvPort_ObjectPos_Stream;
+
+    ReplayID = nextReplayID.fetch_add(1, std::memory_order_relaxed);
+    RoundTimer.OwnerID = SessionID;
+    ExpiryTimer.OwnerID = SessionID;
+    if (seed == 0) {
+        seed = MixSeed(serverSeed + ReplayID);
+    }
+    Random.Seed(seed);
+
+    if (Recorder::IsEnabled()) {
+        const ReplayPayload_Create record = { SessionID, seed, FieldWidth, FieldHeight, WinScore, GameTime, BallSpeed, BallRadius, PaddleSpeed, PaddleSize, PaddleOffsetFromWall };
+        Recorder::Append(ReplayRecordType::Create, ReplayID, TickNumber, &record, sizeof(record));
+    }
+}
+
+Session::Session(Client* ownerClient, const Snapshot& snapshot, int udpSocket_ObjectPos_Stream, uint32_t idPartition)
+    : Session(ownerClient,
+              snapshot.FieldWidth,
+              snapshot.FieldHeight,
+              snapshot.WinScore,
+              snapshot.GameTime,
+              snapshot.BallSpeed,
+              snapshot.BallRadius,
+              snapshot.PaddleSpeed,
+              snapshot.PaddleSize,
+              snapshot.PaddleOffsetFromWall,
+              udpSocket_ObjectPos_Stream,
+              sockaddr_in{ AF_INET, 0, { snapshot.StreamAddr }, {} },
+              snapshot.StreamPort,
+              idPartition)
+{
+    StreamSessionID = snapshot.StreamSessionID;
+    StreamInterval = snapshot.StreamInterval;
+    Addr_Multicast.sin_family = AF_INET;
+    Addr_Multicast.sin_addr.s_addr = snapshot.MulticastAddr;
+    Addr_Multicast.sin_port = snapshot.MulticastPort;
+    bMulticastEnabled = snapshot.bMulticastEnabled;
+
+    bUdpInputEnabled = snapshot.bUdpInputEnabled;
+    PlayerA_LastInputSeq = snapshot.PlayerA_LastInputSeq;
+    PlayerB_LastInputSeq = snapshot.PlayerB_LastInputSeq;
+    bBotPlayerA = snapshot.bBotPlayerA;
+    bBotPlayerB = snapshot.bBotPlayerB;
+    PlayerA_BotAimError = snapshot.PlayerA_BotAimError;
+    PlayerB_BotAimError = snapshot.PlayerB_BotAimError;
+
+    // Queued inputs of the players are applied in the next tick at the time they were received, as they would have been
+    const PlayerInput playerA_Input = { (InputKey)snapshot.PlayerA_InputKey, (InputType)snapshot.PlayerA_InputType };
+    const PlayerInput playerB_Input = { (InputKey)snapshot.PlayerB_InputKey, (InputType)snapshot.PlayerB_InputType };
+    PlayerA_Input = bBotPlayerA ? playerA_Input : PlayerInput{ InputKey::None, InputType::None };
+    PlayerB_Input = bBotPlayerB ? playerB_Input : PlayerInput{ InputKey::None, InputType::None };
+    const uint32_t numQueuedInputs = std::min<uint32_t>(snapshot.NumQueuedInputs, INPUT_EVENT_QUEUE_SIZE);
+    for (uint32_t i = 0; i < numQueuedInputs; i++) {
+        const Snapshot::QueuedInput& queued = snapshot.QueuedInputs[i];
+        const PlayerID playerID = (queued.PlayerID == (uint8_t)PlayerID::PlayerA) ? PlayerID::PlayerA : PlayerID::PlayerB;
+        if (!IsBotPlayer(playerID)) {
+            PushInputEvent(playerID, { (InputKey)queued.Key, (InputType)queued.Type }, queued.OffsetUs);
+        }
+    }
+    Random.State = snapshot.RandomState;
+    Random.Increment = snapshot.RandomIncrement;
+
+    ScoreA = snapshot.ScoreA;
+    ScoreB = snapshot.ScoreB;
+    BallPos = { snapshot.BallPos[0], snapshot.BallPos[1] };
+    BallVel = { snapshot.BallVel[0], snapshot.BallVel[1] };
+    PlayerA_PaddlePos = snapshot.PlayerA_PaddlePos;
+    PlayerB_PaddlePos = snapshot.PlayerB_PaddlePos;
+    PlayerA_PaddleDir = (InputKey)snapshot.PlayerA_PaddleDir;
+    PlayerB_PaddleDir = (InputKey)snapshot.PlayerB_PaddleDir;
+    TickNumber = snapshot.TickNumber;
+    RoundTimeElapsed = std::chrono::milliseconds(snapshot.RoundTimeElapsedMs);
+    bRoundRunning = snapshot.bRoundRunning;
+    bSessionEnded = snapshot.bSessionEnded;
+    LastRoundResult = (RoundResultType)snapshot.LastRoundResult;
+    CollisionIterationCount = snapshot.CollisionIterationCount;
+
+    // Keep the tick phase. (The transfer time is simulated on the next tick)
+    LastTickUpdateTime = std::chrono::steady_clock::now() - std::chrono::microseconds(snapshot.SinceLastTickUs);
+
+    // The stream restarts from a keyframe (The acked snapshots stayed on the old server)
+    SetStreamMode((StreamMode)snapshot.StreamMode);
+
+    if (Recorder::IsEnabled()) {
+        Recorder::Append(ReplayRecordType::Resume, ReplayID, TickNumber, &snapshot, sizeof(snapshot));
+    }
 }
 
 Session::~Session()
 {
-    Session::sessionIdPool[Session::sessionIdPoolTop++] = SessionID; 
+    assert(ListIndex == UINT32_MAX); //< Still in the session list of the reactor
+    SetOwnerClient(nullptr);
+    while (!Subscribers.empty()) {
+        RemoveSubscription(Subscribers.back());
+    }
+
+    if (Recorder::IsEnabled()) {
+        const ReplayPayload_Close record = { ScoreA, ScoreB, { BallPos.x, BallPos.y } };
+        Recorder::Append(ReplayRecordType::Close, ReplayID, TickNumber, &record, sizeof(record));
+    }
+
+    if (bDetached) {
+        return;
+    }
+    if (!bMigrated) {
+        Session::sessionTable[SessionID - sessionIdBase] = nullptr;
+        numLiveSessions.fetch_sub(1, std::memory_order_relaxed);
+    }
+    const uint32_t idPartition = GetSessionIdPartition(SessionID);
+    Session::sessionIdPool[idPartition * sessionIdPartitionSize + Session::sessionIdPoolTop[idPartition]++] = SessionID;
+}
+
+void Session::SetOwnerClient(Client* ownerClient)
+{
+    if (OwnerClient != nullptr) {
+        (OwnerPrev != nullptr ? OwnerPrev->OwnerNext : OwnerClient->ownedSessions) = OwnerNext;
+        if (OwnerNext != nullptr) {
+            OwnerNext->OwnerPrev = OwnerPrev;
+        }
+    }
+
+    OwnerClient = ownerClient;
+    OwnerPrev = nullptr;
+    OwnerNext = nullptr;
+    if (ownerClient != nullptr) {
+        OwnerNext = ownerClient->ownedSessions;
+        if (OwnerNext != nullptr) {
+            OwnerNext->OwnerPrev = this;
+        }
+        ownerClient->ownedSessions = this;
+    }
+}
+
+void Session::SaveSnapshot(Snapshot& snapshot, std::chrono::steady_clock::time_point saveTime) const
+{
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.Version = SESSION_SNAPSHOT_VERSION;
+
+    snapshot.FieldWidth = FieldWidth;
+    snapshot.FieldHeight = FieldHeight;
+    snapshot.WinScore = WinScore;
+    snapshot.GameTime = GameTime;
+    snapshot.BallSpeed = BallSpeed;
+    snapshot.BallRadius = BallRadius;
+    snapshot.PaddleSpeed = PaddleSpeed;
+    snapshot.PaddleSize = PaddleSize;
+    snapshot.PaddleOffsetFromWall = PaddleOffsetFromWall;
+
+    snapshot.StreamSessionID = StreamSessionID;
+    snapshot.StreamAddr = Addr_ObjectPos_Stream.sin_addr.s_addr;
+    snapshot.StreamPort = RecvPort_ObjectPos_Stream;
+    snapshot.StreamMode = (uint8_t)CurrentStreamMode;
+    snapshot.StreamInterval = StreamInterval;
+    snapshot.MulticastAddr = bMulticastEnabled ? Addr_Multicast.sin_addr.s_addr : 0;
+    snapshot.MulticastPort = bMulticastEnabled ? Addr_Multicast.sin_port : 0;
+    snapshot.bMulticastEnabled = bMulticastEnabled;
+
+    const PlayerInput playerA_Input = GetPendingInput(PlayerID::PlayerA);
+    const PlayerInput playerB_Input = GetPendingInput(PlayerID::PlayerB);
+    snapshot.PlayerA_InputKey = (uint8_t)playerA_Input.Key;
+    snapshot.PlayerA_InputType = (uint8_t)playerA_Input.Type;
+    snapshot.PlayerB_InputKey = (uint8_t)playerB_Input.Key;
+    snapshot.PlayerB_InputType = (uint8_t)playerB_Input.Type;
+    const uint32_t inputEventHead = InputEventHead.load(std::memory_order_acquire);
+    for (uint32_t i = InputEventTail.load(std::memory_order_acquire); i != inputEventHead; i++) {
+        const InputEvent& event = InputEvents[i % INPUT_EVENT_QUEUE_SIZE];
+        snapshot.QueuedInputs[snapshot.NumQueuedInputs++] = { event.OffsetUs, event.PlayerID, event.Key, event.Type };
+    }
+    snapshot.bUdpInputEnabled = bUdpInputEnabled;
+    snapshot.PlayerA_LastInputSeq = PlayerA_LastInputSeq;
+    snapshot.PlayerB_LastInputSeq = PlayerB_LastInputSeq;
+    snapshot.bBotPlayerA = bBotPlayerA;
+    snapshot.bBotPlayerB = bBotPlayerB;
+    snapshot.PlayerA_BotAimError = PlayerA_BotAimError;
+    snapshot.PlayerB_BotAimError = PlayerB_BotAimError;
+    snapshot.RandomState = Random.State;
+    snapshot.RandomIncrement = Random.Increment;
+
+    snapshot.ScoreA = ScoreA;
+    snapshot.ScoreB = ScoreB;
+    snapshot.BallPos[0] = BallPos.x;
+    snapshot.BallPos[1] = BallPos.y;
+    snapshot.BallVel[0] = BallVel.x;
+    snapshot.BallVel[1] = BallVel.y;
+    snapshot.PlayerA_PaddlePos = PlayerA_PaddlePos;
+    snapshot.PlayerB_PaddlePos = PlayerB_PaddlePos;
+    snapshot.PlayerA_PaddleDir = (uint8_t)PlayerA_PaddleDir;
+    snapshot.PlayerB_PaddleDir = (uint8_t)PlayerB_PaddleDir;
+    snapshot.TickNumber = TickNumber;
+    snapshot.RoundTimeElapsedMs = RoundTimeElapsed.count();
+    snapshot.SinceLastTickUs = std::chrono::duration_cast<std::chrono::microseconds>(saveTime - LastTickUpdateTime).count();
+    snapshot.bRoundRunning = bRoundRunning;
+    snapshot.bSessionEnded = bSessionEnded;
+    snapshot.LastRoundResult = (uint8_t)LastRoundResult;
+    snapshot.CollisionIterationCount = CollisionIterationCount;
+}
+
+void Session::SetMigrated(bool bNewMigrated)
+{
+    assert(!bDetached);
+    if (bMigrated == bNewMigrated) {
+        return;
+    }
+    bMigrated = bNewMigrated;
+    Session::sessionTable[SessionID - sessionIdBase] = bMigrated ? nullptr : this;
+    if (bMigrated) {
+        numLiveSessions.fetch_sub(1, std::memory_order_relaxed);
+    }
+    else {
+        numLiveSessions.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
 bool Session::BeginRound()
@@ -67,10 +346,18 @@ bool Session::BeginRound()
     PlayerA_Input.Type = InputType::None;
     PlayerB_Input.Type = InputType::None;
 
+    // Drop the inputs left from the last round. (Between ticks, nothing applies them meanwhile)
+    InputEventTail.store(InputEventHead.load(std::memory_order_relaxed), std::memory_order_release);
+
     BallPos = { FieldWidth / 2.0f, FieldHeight / 2.0f };
+
+    // The session is not ticked between rounds. Don't simulate the idle time on the first tick.
+    LastTickUpdateTime = std::chrono::steady_clock::now();
+
+    StreamEventFlags |= StreamEvent_RoundBegin;
     
     // Randomize ball direction
-    const float theta = (rand() % 360) * (3.14159265358f / 180.0f);
+    const float theta = (Random.Next() % 360) * (3.14159265358f / 180.0f);
     BallVel.x = cosf(theta);
     BallVel.y = sinf(theta);
     BallVel = vec2::normalize(BallVel) * BallSpeed;
@@ -79,14 +366,20 @@ bool Session::BeginRound()
     PlayerB_PaddlePos = 0.0f;
     PlayerA_PaddleDir = InputKey::None;
     PlayerB_PaddleDir = InputKey::None;
+    PlayerA_BotAimError = 0.0f;
+    PlayerB_BotAimError = 0.0f;
 
     RoundTimeElapsed = std::chrono::milliseconds(0);
     bRoundRunning = true;
 
+    if (Recorder::IsEnabled()) {
+        Recorder::Append(ReplayRecordType::BeginRound, ReplayID, TickNumber);
+    }
+
     return true;
 }
 
-bool Session::SetPlayerInput(PlayerID playerID, InputKey key, InputType type)
+bool Session::SetPlayerInput(PlayerID playerID, InputKey key, InputType type, std::chrono::steady_clock::time_point receiveTime)
 {
     if (!bRoundRunning) {
         return false;
@@ -94,13 +387,79 @@ bool Session::SetPlayerInput(PlayerID playerID, InputKey key, InputType type)
 
     // std::cout << "[DEBUG] SetPlayerInput: " << (int)playerID << ", " << (int)key << ", " << (int)type << std::endl;
 
-    if (playerID == PlayerID::PlayerA) {
-        PlayerA_Input.Key = key;
-        PlayerA_Input.Type = type;
+    // Bot controlled slot doesn't accept external input
+    if (IsBotPlayer(playerID)) {
+        return false;
     }
-    else if (playerID == PlayerID::PlayerB) {
-        PlayerB_Input.Key = key;
-        PlayerB_Input.Type = type;
+
+    // The next tick starts at LastTickUpdateTime
+    const int64_t sinceLastTickUs = std::chrono::duration_cast<std::chrono::microseconds>(receiveTime - LastTickUpdateTime).count();
+    const uint32_t offsetUs = (uint32_t)std::min<int64_t>(std::max<int64_t>(sinceLastTickUs, 0), UINT32_MAX);
+    if (!PushInputEvent(playerID, { key, type }, offsetUs)) {
+        return false;
+    }
+
+    if (Recorder::IsEnabled()) {
+        const ReplayPayload_Input record = { (uint8_t)playerID, (uint8_t)key, (uint8_t)type, offsetUs };
+        Recorder::Append(ReplayRecordType::Input, ReplayID, TickNumber, &record, sizeof(record));
+    }
+
+    return true;
+}
+
+bool Session::PushInputEvent(PlayerID playerID, const PlayerInput& input, uint32_t offsetUs)
+{
+    if (IsInputQueueFull()) {
+        return false;
+    }
+
+    const uint32_t head = InputEventHead.load(std::memory_order_relaxed);
+
+    InputEvent& event = InputEvents[head % INPUT_EVENT_QUEUE_SIZE];
+    event.OffsetUs = offsetUs;
+    event.PlayerID = (uint8_t)playerID;
+    event.Key = (uint8_t)input.Key;
+    event.Type = (uint8_t)input.Type;
+    InputEventHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+Session::PlayerInput Session::GetPendingInput(PlayerID playerID) const
+{
+    if (IsBotPlayer(playerID)) {
+        return (playerID == PlayerID::PlayerA) ? PlayerA_Input : PlayerB_Input;
+    }
+
+    const uint32_t tail = InputEventTail.load(std::memory_order_acquire);
+    for (uint32_t i = InputEventHead.load(std::memory_order_acquire); i != tail; i--) {
+        const InputEvent& event = InputEvents[(i - 1) % INPUT_EVENT_QUEUE_SIZE];
+        if (event.PlayerID == (uint8_t)playerID) {
+            return { (InputKey)event.Key, (InputType)event.Type };
+        }
+    }
+    return { InputKey::None, InputType::None };
+}
+
+bool Session::SetPlayerInputSeq(PlayerID playerID, uint32_t seq, const PlayerInput* inputs, uint32_t numInputs)
+{
+    if (!bUdpInputEnabled || IsBotPlayer(playerID)) {
+        return false;
+    }
+
+    uint32_t& lastInputSeq = (playerID == PlayerID::PlayerA) ? PlayerA_LastInputSeq : PlayerB_LastInputSeq;
+
+    // Serial number arithmetic, so that the sequence may wrap around
+    const int32_t numNewInputs = std::min<int32_t>((int32_t)(seq - lastInputSeq), (int32_t)numInputs);
+    if (numNewInputs <= 0) {
+        return true;
+    }
+
+    // Stop at a full input queue. The client repeats the inputs that are not acknowledged.
+    for (int32_t i = numNewInputs - 1; i >= 0; i--) {
+        if (!SetPlayerInput(playerID, inputs[i].Key, inputs[i].Type) && bRoundRunning) {
+            break;
+        }
+        lastInputSeq = seq - i;
     }
 
     return true;
@@ -112,7 +471,6 @@ bool Session::Update()
     const std::chrono::milliseconds tickDuration(1000 / SERVER_TICK_RATE);
     const std::chrono::steady_clock::time_point nowTime = std::chrono::steady_clock::now();
     const std::chrono::milliseconds deltaTime_Ms = std::chrono::duration_cast<std::chrono::milliseconds>(nowTime - LastTickUpdateTime);
-    const float deltaTime_Sec = (float)deltaTime_Ms.count() / 1000;
 
     // Log Latency(us)
     std::chrono::microseconds latency = std::chrono::duration_cast<std::chrono::microseconds>(nowTime - LastTickUpdateTime - tickDuration);
@@ -121,66 +479,74 @@ bool Session::Update()
     
     // assert(deltaTime_Ms.count() <= tickDuration.count());
 
-    // Update last tick update time
-    LastTickUpdateTime = std::chrono::steady_clock::now();
+    // Update last tick update time.
+    // Advance by the consumed whole milliseconds so that the truncated remainder carries over to the next tick.
+    // (Otherwise the game runs slow at tick rates whose duration is not a whole millisecond)
+    LastTickUpdateTime += deltaTime_Ms;
 
-    if (!bRoundRunning) {
-        return true;
-    }
+    return Simulate(deltaTime_Ms);
+}
 
-    RoundTimeElapsed += deltaTime_Ms;
-    // Timeout 
-    if (RoundTimeElapsed >= std::chrono::milliseconds(GameTime * std::chrono::milliseconds(1000))) 
-    {
-        bRoundRunning = false;
+bool Session::Simulate(const std::chrono::milliseconds deltaTime_Ms)
+{
+    const float deltaTime_Sec = (float)deltaTime_Ms.count() / 1000;
 
-        // Set round result
-        LastRoundResult = RoundResultType::Timeout;
+    TickNumber += 1;
 
+    // A replay steps ticks by the nominal duration, unless told otherwise
+    if (Recorder::IsEnabled() && (uint32_t)deltaTime_Ms.count() != Recorder::GetNominalStepMs()) {
+        const ReplayPayload_Step record = { (uint32_t)deltaTime_Ms.count() };
+        Recorder::Append(ReplayRecordType::Step, ReplayID, TickNumber, &record, sizeof(record));
+    }
+
+    if (!bRoundRunning) {
         return true;
     }
 
-    // Update paddle position
-    const uint32_t deltaPaddlePos = PaddleSpeed * deltaTime_Sec;
+    // Timeout is fired by the round timer of the reactor. (See EndRoundByTimeout)
+    RoundTimeElapsed += deltaTime_Ms;
 
-    const float paddlePosMax = (float)FieldHeight / 2.f;
-    const float paddlePosMin = -(float)FieldHeight / 2.f;
-    if (PlayerA_PaddleDir == InputKey::Right) {
-        PlayerA_PaddlePos -= deltaPaddlePos;
-        if (PlayerA_PaddlePos < paddlePosMin) {
-            PlayerA_PaddlePos = paddlePosMin;
-        }
-    }
-    else if (PlayerA_PaddleDir == InputKey::Left) {
-        PlayerA_PaddlePos += deltaPaddlePos;
-        if (PlayerA_PaddlePos > paddlePosMax) {
-            PlayerA_PaddlePos = paddlePosMax;
-        }
-    }
-    if (PlayerB_PaddleDir == InputKey::Right) {
-        PlayerB_PaddlePos -= deltaPaddlePos;
-        if (PlayerB_PaddlePos < paddlePosMin) {
-            PlayerB_PaddlePos = paddlePosMin;
+    // Update paddle position
+    // Piecewise, so that each queued input changes the direction at the time it was received within the tick.
+    // (A press and a release within one tick still move the paddle in between)
+    const auto applyInput = [](InputKey& paddleDir, InputKey key, InputType type) -> bool {
+        const InputKey prevPaddleDir = paddleDir;
+        if (type == InputType::Release) {
+            paddleDir = InputKey::None;
         }
-    }
-    else if (PlayerB_PaddleDir == InputKey::Left) {
-        PlayerB_PaddlePos += deltaPaddlePos;
-        if (PlayerB_PaddlePos > paddlePosMax) {
-            PlayerB_PaddlePos = paddlePosMax;
+        if (type == InputType::Press) {
+            paddleDir = key;
         }
+        return paddleDir != prevPaddleDir;
+    };
+    bool bPaddleDirChanged = false;
+    const uint64_t stepUs = (uint64_t)deltaTime_Ms.count() * 1000;
+    uint64_t movedUs = 0;
+    const uint32_t inputEventHead = InputEventHead.load(std::memory_order_acquire);
+    uint32_t inputEventTail = InputEventTail.load(std::memory_order_relaxed);
+    for (; inputEventTail != inputEventHead; inputEventTail++) {
+        const InputEvent& event = InputEvents[inputEventTail % INPUT_EVENT_QUEUE_SIZE];
+        const uint64_t eventUs = std::min<uint64_t>(std::max<uint64_t>(event.OffsetUs, movedUs), stepUs);
+        MovePaddles((float)(eventUs - movedUs) / 1000000);
+        movedUs = eventUs;
+
+        InputKey& paddleDir = (event.PlayerID == (uint8_t)PlayerID::PlayerA) ? PlayerA_PaddleDir : PlayerB_PaddleDir;
+        bPaddleDirChanged |= applyInput(paddleDir, (InputKey)event.Key, (InputType)event.Type);
     }
+    InputEventTail.store(inputEventTail, std::memory_order_release);
+    MovePaddles((float)(stepUs - movedUs) / 1000000);
 
-    if (PlayerA_Input.Type == InputType::Release) {
-        PlayerA_PaddleDir = InputKey::None;
-    }
-    if (PlayerA_Input.Type == InputType::Press) {
-        PlayerA_PaddleDir = PlayerA_Input.Key;
+    // Bot players decide their input from the predicted ball trajectory
+    if (bBotPlayerA) {
+        UpdateBotInput(PlayerID::PlayerA);
+        bPaddleDirChanged |= applyInput(PlayerA_PaddleDir, PlayerA_Input.Key, PlayerA_Input.Type);
     }
-    if (PlayerB_Input.Type == InputType::Release) {
-        PlayerB_PaddleDir = InputKey::None;
+    if (bBotPlayerB) {
+        UpdateBotInput(PlayerID::PlayerB);
+        bPaddleDirChanged |= applyInput(PlayerB_PaddleDir, PlayerB_Input.Key, PlayerB_Input.Type);
     }
-    if (PlayerB_Input.Type == InputType::Press) {
-        PlayerB_PaddleDir = PlayerB_Input.Key;
+    if (bPaddleDirChanged) {
+        StreamEventFlags |= StreamEvent_PaddleDir;
     }
 
     // Compute absolute position of paddle
@@ -209,6 +575,8 @@ bool Session::Update()
 
     while (ballLeftMove >= 1.0f)
     {
+        CollisionIterationCount += 1;
+
         vec2 ballDir = vec2::normalize(nextBallPos - BallPos);
 
         // shortestPointA = A_s + factorS[0, 1] * (A_e - A_s)
@@ -331,6 +699,7 @@ bool Session::Update()
 
                     // Update ball velocity vector
                     BallVel = reflectVec * BallSpeed;
+                    StreamEventFlags |= StreamEvent_Bounce;
 
                     // Move ball to exact collision point
                     //vec2 collisionPos = shortestPointB + vec2::normalize(-shortestVec * BallRadius);
@@ -394,6 +763,9 @@ bool Session::Update()
                         LastRoundResult = RoundResultType::WinPlayerB;
                     }
 
+                    StreamEventFlags |= StreamEvent_RoundEnd;
+                    RecordRoundEnd();
+
                     //std::cout << "[DEBUG] RoundResult: " << (int)LastRoundResult << std::endl;
 
                     return true;
@@ -415,6 +787,7 @@ bool Session::Update()
                 
                 // Update ball velocity vector
                 BallVel = reflectVec * BallSpeed;
+                StreamEventFlags |= StreamEvent_Bounce;
 
                 // Move ball from exact collision point
                 vec2 collisionPos = shortestPointB + vec2::normalize(-shortestVec) * BallRadius;
@@ -441,8 +814,156 @@ bool Session::Update()
     return true;
 }
 
+void Session::SetBotPlayer(PlayerID playerID, bool bBot)
+{
+    if (playerID == PlayerID::PlayerA) {
+        bBotPlayerA = bBot;
+    }
+    else if (playerID == PlayerID::PlayerB) {
+        bBotPlayerB = bBot;
+    }
+
+    if (Recorder::IsEnabled()) {
+        const ReplayPayload_Bot record = { (uint8_t)playerID, (uint8_t)bBot };
+        Recorder::Append(ReplayRecordType::Bot, ReplayID, TickNumber, &record, sizeof(record));
+    }
+}
+
+void Session::EndRoundByTimeout()
+{
+    if (!bRoundRunning) {
+        return;
+    }
+
+    // The round times out on this tick, like on a tick of the session that found the round time over
+    const uint32_t lastTick = TickNumber;
+    TickNumber += 1;
+    bRoundRunning = false;
+    LastRoundResult = RoundResultType::Timeout;
+    StreamEventFlags |= StreamEvent_RoundEnd;
+
+    if (Recorder::IsEnabled()) {
+        const ReplayPayload_RoundEnd record = { (uint8_t)LastRoundResult, ScoreA, ScoreB, { BallPos.x, BallPos.y } };
+        Recorder::Append(ReplayRecordType::RoundTimeout, ReplayID, lastTick, &record, sizeof(record));
+    }
+}
+
+void Session::RecordRoundEnd() const
+{
+    if (Recorder::IsEnabled()) {
+        const ReplayPayload_RoundEnd record = { (uint8_t)LastRoundResult, ScoreA, ScoreB, { BallPos.x, BallPos.y } };
+        Recorder::Append(ReplayRecordType::RoundEnd, ReplayID, TickNumber, &record, sizeof(record));
+    }
+}
+
+void Session::MovePaddles(float deltaTime_Sec)
+{
+    const float deltaPaddlePos = PaddleSpeed * deltaTime_Sec;
+
+    const float paddlePosMax = (float)FieldHeight / 2.f;
+    const float paddlePosMin = -(float)FieldHeight / 2.f;
+    if (PlayerA_PaddleDir == InputKey::Right) {
+        PlayerA_PaddlePos -= deltaPaddlePos;
+        if (PlayerA_PaddlePos < paddlePosMin) {
+            PlayerA_PaddlePos = paddlePosMin;
+        }
+    }
+    else if (PlayerA_PaddleDir == InputKey::Left) {
+        PlayerA_PaddlePos += deltaPaddlePos;
+        if (PlayerA_PaddlePos > paddlePosMax) {
+            PlayerA_PaddlePos = paddlePosMax;
+        }
+    }
+    if (PlayerB_PaddleDir == InputKey::Right) {
+        PlayerB_PaddlePos -= deltaPaddlePos;
+        if (PlayerB_PaddlePos < paddlePosMin) {
+            PlayerB_PaddlePos = paddlePosMin;
+        }
+    }
+    else if (PlayerB_PaddleDir == InputKey::Left) {
+        PlayerB_PaddlePos += deltaPaddlePos;
+        if (PlayerB_PaddlePos > paddlePosMax) {
+            PlayerB_PaddlePos = paddlePosMax;
+        }
+    }
+}
+
+void Session::UpdateBotInput(PlayerID playerID)
+{
+    const bool   bPlayerA   = (playerID == PlayerID::PlayerA);
+    PlayerInput& input      = bPlayerA ? PlayerA_Input : PlayerB_Input;
+    const float  paddlePos  = bPlayerA ? PlayerA_PaddlePos : PlayerB_PaddlePos;
+    float&       aimError   = bPlayerA ? PlayerA_BotAimError : PlayerB_BotAimError;
+    const float  paddleAbsX = bPlayerA ? (float)PaddleOffsetFromWall : FieldWidth - (float)PaddleOffsetFromWall;
+
+    // Wait at the center while the ball is moving away
+    float targetAbsY = FieldHeight / 2.0f;
+    const bool bBallApproaching = bPlayerA ? (BallVel.x < 0.f) : (BallVel.x > 0.f);
+    if (bBallApproaching)
+    {
+        // Predict the height where the ball crosses the paddle line, folding the bounces of top/bottom wall
+        const float timeToReach = (paddleAbsX - BallPos.x) / BallVel.x;
+        const float minY = (float)BallRadius;
+        const float rangeY = std::max(1.0f, (float)FieldHeight - 2.0f * BallRadius);
+        float foldY = fmodf(BallPos.y + BallVel.y * timeToReach - minY, 2.0f * rangeY);
+        if (foldY < 0.f) {
+            foldY += 2.0f * rangeY;
+        }
+        if (foldY > rangeY) {
+            foldY = 2.0f * rangeY - foldY;
+        }
+
+        // Pick a new aim error once per approach so that rallies eventually end
+        if (aimError == 0.0f) {
+            const float unit = Random.NextUnit(); // [0, 1]
+            aimError = (unit * 2.0f - 1.0f) * PaddleSize * BOT_AIM_ERROR_FACTOR + FLT_EPSILON;
+        }
+        targetAbsY = minY + foldY + aimError;
+    }
+    else {
+        aimError = 0.0f;
+    }
+
+    // Absolute height to relative paddle position (See the paddle coordinate of the API document)
+    const float targetPaddlePos = bPlayerA ? (FieldHeight / 2.0f - targetAbsY) : (targetAbsY - FieldHeight / 2.0f);
+    const float diff = targetPaddlePos - paddlePos;
+    const float deadZone = PaddleSize * 0.1f;
+    if (diff > deadZone) {
+        input.Key = InputKey::Left;
+        input.Type = InputType::Press;
+    }
+    else if (diff < -deadZone) {
+        input.Key = InputKey::Right;
+        input.Type = InputType::Press;
+    }
+    else {
+        input.Type = InputType::Release;
+    }
+}
+
 bool Session::SendObjectState()
 {
+    const bool bHasSpectator = !Subscribers.empty() || bMulticastEnabled;
+
+    // Stream is disabled (e.g. Bot sessions without a viewer)
+    if (RecvPort_ObjectPos_Stream == 0 && !bHasSpectator) {
+        return true;
+    }
+
+    // Sent to the owner by the main thread after all sessions are updated.
+    // Spectators still get the per session packet below.
+    if (CurrentStreamMode == StreamMode::Aggregated && !bHasSpectator) {
+        return true;
+    }
+
+    if (CurrentStreamMode == StreamMode::QuantizedDelta) {
+        return SendQuantizedDeltaState();
+    }
+
+    if (CurrentStreamMode == StreamMode::EventDriven) {
+        return SendEventDrivenState();
+    }
+
     struct __attribute__((packed)) ObjectState
     {
         vec2 BallPos;
@@ -450,13 +971,28 @@ bool Session::SendObjectState()
         float PlayerB_PaddlePos;
     } objectState;
 
+    struct __attribute__((packed)) ObjectState_InputAck
+    {
+        ObjectState State;
+        uint32_t PlayerA_LastInputSeq;
+        uint32_t PlayerB_LastInputSeq;
+    } objectStateInputAck;
+
     objectState.BallPos = BallPos;
     objectState.PlayerA_PaddlePos = PlayerA_PaddlePos;
     objectState.PlayerB_PaddlePos = PlayerB_PaddlePos;
 
-    int nBytesSend = sendto(UdpSocket_ObjectPos_Stream, &objectState, sizeof(objectState), 0, (sockaddr*)&Addr_ObjectPos_Stream, sizeof(Addr_ObjectPos_Stream));
-    if (nBytesSend <= 0) {
-        std::cout << "[DEBUG] sendUdpPos. sendto failed. errno: " << errno << std::endl;
+    const void* packet = &objectState;
+    size_t packetSize = sizeof(objectState);
+    if (bUdpInputEnabled) {
+        objectStateInputAck.State = objectState;
+        objectStateInputAck.PlayerA_LastInputSeq = PlayerA_LastInputSeq;
+        objectStateInputAck.PlayerB_LastInputSeq = PlayerB_LastInputSeq;
+        packet = &objectStateInputAck;
+        packetSize = sizeof(objectStateInputAck);
+    }
+
+    if (!SendStatePacket(packet, packetSize, CurrentStreamMode != StreamMode::Aggregated)) {
         return false;
     }
 
@@ -467,3 +1003,389 @@ bool Session::SendObjectState()
 
     return true;
 }
+
+void Session::SetStreamRate(uint32_t streamRate, uint32_t tickRate)
+{
+    if (streamRate == 0 || streamRate >= tickRate) {
+        StreamInterval = 1;
+        return;
+    }
+
+    StreamInterval = (tickRate + streamRate / 2) / streamRate;
+}
+
+void Session::AckStreamTick(uint32_t tick)
+{
+    // Ignore acks of snapshots never sent or older than the current base (Serial number arithmetic)
+    if ((int32_t)(TickNumber - tick) < 0) {
+        return;
+    }
+    if (bStreamAcked && (int32_t)(tick - StreamAckedTick) <= 0) {
+        return;
+    }
+
+    StreamAckedTick = tick;
+    bStreamAcked = true;
+}
+
+bool Session::SendQuantizedDeltaState()
+{
+    auto quantizeUnsigned = [](float value, float range) -> uint16_t {
+        const float unit = std::max(0.f, std::min(1.f, value / range));
+        return (uint16_t)lroundf(unit * 65535.f);
+    };
+    auto quantizeSigned = [](float value, float halfRange) -> int16_t {
+        const float unit = std::max(-1.f, std::min(1.f, value / halfRange));
+        return (int16_t)lroundf(unit * 32767.f);
+    };
+
+    QuantizedState& state = StreamHistory[TickNumber % STREAM_V2_SNAPSHOT_HISTORY];
+    state.Tick = TickNumber;
+    state.BallX = quantizeUnsigned(BallPos.x, (float)FieldWidth);
+    state.BallY = quantizeUnsigned(BallPos.y, (float)FieldHeight);
+    state.PaddleA = quantizeSigned(PlayerA_PaddlePos, FieldHeight / 2.f);
+    state.PaddleB = quantizeSigned(PlayerB_PaddlePos, FieldHeight / 2.f);
+    state.PlayerA_LastInputSeq = PlayerA_LastInputSeq;
+    state.PlayerB_LastInputSeq = PlayerB_LastInputSeq;
+
+    // Delta base is the last acknowledged snapshot, if it is still in the history
+    const QuantizedState* base = nullptr;
+    if (bStreamAcked) {
+        const uint32_t ackAge = TickNumber - StreamAckedTick;
+        const QuantizedState& ackedState = StreamHistory[StreamAckedTick % STREAM_V2_SNAPSHOT_HISTORY];
+        if (ackAge > 0 && ackAge < STREAM_V2_SNAPSHOT_HISTORY && ackedState.Tick == StreamAckedTick) {
+            base = &ackedState;
+        }
+    }
+    if (!bStreamKeyframeSent || TickNumber - StreamLastKeyframeTick >= STREAM_V2_KEYFRAME_INTERVAL) {
+        base = nullptr;
+    }
+    if (base == nullptr) {
+        StreamLastKeyframeTick = TickNumber;
+        bStreamKeyframeSent = true;
+    }
+
+    struct __attribute__((packed)) QuantizedState_Header
+    {
+        uint16_t PacketType = 3; //< 3: QuantizedDeltaState
+        uint32_t Tick;
+        uint8_t  BaseTickDelta;  //< Tick - BaseTick. 0: Keyframe (All fields present)
+        uint8_t  FieldMask;      //< Fields present in the packet
+    } header;
+
+    enum : uint8_t
+    {
+        FIELD_BALL_X   = 1 << 0, // uint16_t
+        FIELD_BALL_Y   = 1 << 1, // uint16_t
+        FIELD_PADDLE_A = 1 << 2, // int16_t
+        FIELD_PADDLE_B = 1 << 3, // int16_t
+        FIELD_INPUT_ACK = 1 << 4 // uint32_t[2]. Only when UDP input is enabled
+    };
+
+    header.Tick = TickNumber;
+    header.BaseTickDelta = (base == nullptr) ? 0 : (uint8_t)(TickNumber - base->Tick);
+    header.FieldMask = 0;
+
+    char packet[sizeof(header) + sizeof(uint16_t) * 4 + sizeof(uint32_t) * 2];
+    size_t packetSize = sizeof(header);
+    auto appendField = [&](uint8_t field, bool bChanged, const void* value, size_t size) {
+        if (base == nullptr || bChanged) {
+            header.FieldMask |= field;
+            memcpy(packet + packetSize, value, size);
+            packetSize += size;
+        }
+    };
+    appendField(FIELD_BALL_X, base && base->BallX != state.BallX, &state.BallX, sizeof(state.BallX));
+    appendField(FIELD_BALL_Y, base && base->BallY != state.BallY, &state.BallY, sizeof(state.BallY));
+    appendField(FIELD_PADDLE_A, base && base->PaddleA != state.PaddleA, &state.PaddleA, sizeof(state.PaddleA));
+    appendField(FIELD_PADDLE_B, base && base->PaddleB != state.PaddleB, &state.PaddleB, sizeof(state.PaddleB));
+    if (bUdpInputEnabled) {
+        const bool bAckChanged = base && (base->PlayerA_LastInputSeq != state.PlayerA_LastInputSeq || base->PlayerB_LastInputSeq != state.PlayerB_LastInputSeq);
+        appendField(FIELD_INPUT_ACK, bAckChanged, &state.PlayerA_LastInputSeq, sizeof(uint32_t) * 2);
+    }
+    memcpy(packet, &header, sizeof(header));
+
+    return SendStatePacket(packet, packetSize, true);
+}
+
+bool Session::SendEventDrivenState()
+{
+    if (!IsStreamDue()) {
+        return true;
+    }
+
+    // Paddle velocity in PaddlePos units per second (See the paddle update of Simulate())
+    auto paddleVelocity = [this](InputKey dir) -> float {
+        if (dir == InputKey::Left) {
+            return (float)PaddleSpeed;
+        }
+        if (dir == InputKey::Right) {
+            return -(float)PaddleSpeed;
+        }
+        return 0.f;
+    };
+
+    struct __attribute__((packed)) EventDrivenState
+    {
+        uint16_t PacketType = 4; //< 4: EventDrivenState
+        uint32_t Tick;
+        uint8_t  EventFlags;     //< StreamEventFlag. 0: Heartbeat
+        uint8_t  bRoundRunning;
+        vec2     BallPos;
+        vec2     BallVel;        //< Per second
+        float    PlayerA_PaddlePos;
+        float    PlayerB_PaddlePos;
+        float    PlayerA_PaddleVel; //< Per second. The paddle stops at +-FieldHeight/2
+        float    PlayerB_PaddleVel;
+        uint32_t PlayerA_LastInputSeq; //< Only when UDP input is enabled
+        uint32_t PlayerB_LastInputSeq;
+    } packet;
+
+    packet.Tick = TickNumber;
+    packet.EventFlags = StreamEventFlags;
+    packet.bRoundRunning = bRoundRunning;
+    packet.BallPos = BallPos;
+    packet.BallVel = BallVel;
+    packet.PlayerA_PaddlePos = PlayerA_PaddlePos;
+    packet.PlayerB_PaddlePos = PlayerB_PaddlePos;
+    packet.PlayerA_PaddleVel = paddleVelocity(PlayerA_PaddleDir);
+    packet.PlayerB_PaddleVel = paddleVelocity(PlayerB_PaddleDir);
+    packet.PlayerA_LastInputSeq = PlayerA_LastInputSeq;
+    packet.PlayerB_LastInputSeq = PlayerB_LastInputSeq;
+
+    const size_t packetSize = bUdpInputEnabled ? sizeof(packet) : sizeof(packet) - sizeof(uint32_t) * 2;
+
+    StreamEventFlags = 0;
+    StreamLastEventTime = RoundTimeElapsed;
+
+    return SendStatePacket(&packet, packetSize, true);
+}
+
+bool Session::SendStatePacket(const void* packet, size_t packetSize, bool bSendToOwner)
+{
+    bSendToOwner = bSendToOwner && (RecvPort_ObjectPos_Stream != 0);
+
+    // Common case. Only the owner
+    if (Subscribers.empty() && !bMulticastEnabled)
+    {
+        if (!bSendToOwner) {
+            return true;
+        }
+
+        int nBytesSend = sendto(UdpSocket_ObjectPos_Stream, packet, packetSize, 0, (sockaddr*)&Addr_ObjectPos_Stream, sizeof(Addr_ObjectPos_Stream));
+        if (nBytesSend <= 0) {
+            std::cout << "[DEBUG] SendStatePacket. sendto failed. errno: " << errno << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Fan out. Every message shares the same serialized packet, only the destination differs.
+    // Scratch is per thread since sessions are updated by all workers concurrently.
+    thread_local std::vector<mmsghdr> messages;
+    iovec iov = { const_cast<void*>(packet), packetSize };
+
+    messages.clear();
+    auto addDestination = [&](const sockaddr_in& addr) {
+        mmsghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_hdr.msg_name = const_cast<sockaddr_in*>(&addr);
+        message.msg_hdr.msg_namelen = sizeof(addr);
+        message.msg_hdr.msg_iov = &iov;
+        message.msg_hdr.msg_iovlen = 1;
+        messages.push_back(message);
+    };
+    if (bSendToOwner) {
+        addDestination(Addr_ObjectPos_Stream);
+    }
+    if (bMulticastEnabled) {
+        addDestination(Addr_Multicast);
+    }
+    for (const Subscription* subscription : Subscribers) {
+        addDestination(subscription->Addr);
+    }
+
+    constexpr size_t maxMessagesPerCall = 1024; //< UIO_MAXIOV
+    bool bSuccess = true;
+    size_t numSent = 0;
+    while (numSent < messages.size())
+    {
+        const unsigned int batchSize = (unsigned int)std::min(messages.size() - numSent, maxMessagesPerCall);
+        const int result = sendmmsg(UdpSocket_ObjectPos_Stream, messages.data() + numSent, batchSize, 0);
+        if (result <= 0) {
+            // Skip the failed destination (e.g. Unreachable subscriber) and keep sending to the rest
+            std::cout << "[DEBUG] SendStatePacket. sendmmsg failed. errno: " << errno << std::endl;
+            bSuccess = false;
+            numSent += 1;
+            continue;
+        }
+        numSent += result;
+    }
+
+    return bSuccess;
+}
+
+bool Session::Subscribe(Client* client, uint16_t recvPort)
+{
+    for (const Subscription* subscription : Subscribers) {
+        if (subscription->SubscriberClient == client && subscription->Addr.sin_port == recvPort) {
+            return true;
+        }
+    }
+    if (Subscribers.size() >= MAX_SUBSCRIBER_PER_SESSION) {
+        return false;
+    }
+
+    Subscription* const subscription = new Subscription;
+    subscription->SubscribedSession = this;
+    subscription->SubscriberClient = client;
+    subscription->Addr = client->address;
+    subscription->Addr.sin_port = recvPort;
+    subscription->Index = (uint32_t)Subscribers.size();
+    Subscribers.push_back(subscription);
+
+    Subscription*& clientSubscriptions = client->subscriptions[GetSessionIdPartition(SessionID)];
+    subscription->ClientPrev = nullptr;
+    subscription->ClientNext = clientSubscriptions;
+    if (clientSubscriptions != nullptr) {
+        clientSubscriptions->ClientPrev = subscription;
+    }
+    clientSubscriptions = subscription;
+
+    // Restart the quantized stream from a keyframe, so that the new subscriber can decode it
+    bStreamKeyframeSent = false;
+    StreamEventFlags |= StreamEvent_Resync;
+
+    return true;
+}
+
+bool Session::Unsubscribe(Client* client, uint16_t recvPort)
+{
+    for (Subscription* subscription : Subscribers) {
+        if (subscription->SubscriberClient == client && subscription->Addr.sin_port == recvPort) {
+            RemoveSubscription(subscription);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Session::UnsubscribeClient(Client& client, uint32_t idPartition)
+{
+    while (client.subscriptions[idPartition] != nullptr) {
+        Subscription* const subscription = client.subscriptions[idPartition];
+        subscription->SubscribedSession->RemoveSubscription(subscription);
+    }
+}
+
+void Session::RemoveSubscription(Subscription* subscription)
+{
+    assert(subscription->SubscribedSession == this && Subscribers[subscription->Index] == subscription);
+
+    Subscription*& clientSubscriptions = subscription->SubscriberClient->subscriptions[GetSessionIdPartition(SessionID)];
+    (subscription->ClientPrev != nullptr ? subscription->ClientPrev->ClientNext : clientSubscriptions) = subscription->ClientNext;
+    if (subscription->ClientNext != nullptr) {
+        subscription->ClientNext->ClientPrev = subscription->ClientPrev;
+    }
+
+    Subscription* const last = Subscribers.back();
+    Subscribers[subscription->Index] = last;
+    last->Index = subscription->Index;
+    Subscribers.pop_back();
+    delete subscription;
+}
+
+bool Session::SetMulticastGroup(uint32_t groupAddr, uint16_t port)
+{
+    if (groupAddr == 0) {
+        bMulticastEnabled = false;
+        return true;
+    }
+
+    // 224.0.0.0/4
+    if ((ntohl(groupAddr) & 0xF0000000) != 0xE0000000 || port == 0) {
+        return false;
+    }
+
+    memset(&Addr_Multicast, 0, sizeof(Addr_Multicast));
+    Addr_Multicast.sin_family = AF_INET;
+    Addr_Multicast.sin_addr.s_addr = groupAddr;
+    Addr_Multicast.sin_port = port;
+    bMulticastEnabled = true;
+
+    bStreamKeyframeSent = false;
+    StreamEventFlags |= StreamEvent_Resync;
+
+    return true;
+}
+
+bool Session::SendAggregatedObjectState(int udpSocket, Session** sessions, size_t numSessions)
+{
+    struct __attribute__((packed)) AggregatedState_Header
+    {
+        uint16_t PacketType = 2; //< 2: AggregatedObjectState
+        uint16_t NumEntries;
+    };
+
+    struct __attribute__((packed)) AggregatedState_Entry
+    {
+        uint32_t SessionID;
+        vec2 BallPos;
+        float PlayerA_PaddlePos;
+        float PlayerB_PaddlePos;
+    };
+
+    constexpr size_t maxEntriesPerDatagram = (STREAM_AGGREGATE_MAX_DATAGRAM - sizeof(AggregatedState_Header)) / sizeof(AggregatedState_Entry);
+    static_assert(maxEntriesPerDatagram > 0, "STREAM_AGGREGATE_MAX_DATAGRAM is too small");
+
+    // Group sessions by destination
+    std::sort(sessions, sessions + numSessions, [](const Session* a, const Session* b) -> bool {
+        if (a->Addr_ObjectPos_Stream.sin_addr.s_addr != b->Addr_ObjectPos_Stream.sin_addr.s_addr) {
+            return a->Addr_ObjectPos_Stream.sin_addr.s_addr < b->Addr_ObjectPos_Stream.sin_addr.s_addr;
+        }
+        return a->Addr_ObjectPos_Stream.sin_port < b->Addr_ObjectPos_Stream.sin_port;
+    });
+
+    bool bSuccess = true;
+    char datagram[STREAM_AGGREGATE_MAX_DATAGRAM];
+    size_t sessionIdx = 0;
+    while (sessionIdx < numSessions)
+    {
+        const sockaddr_in& destAddr = sessions[sessionIdx]->Addr_ObjectPos_Stream;
+        if (sessions[sessionIdx]->RecvPort_ObjectPos_Stream == 0) {
+            sessionIdx += 1;
+            continue;
+        }
+
+        // Pack the run of sessions sharing this destination, up to one datagram
+        AggregatedState_Header header;
+        header.NumEntries = 0;
+        size_t datagramSize = sizeof(header);
+        while (sessionIdx < numSessions && header.NumEntries < maxEntriesPerDatagram)
+        {
+            const Session* session = sessions[sessionIdx];
+            if (session->Addr_ObjectPos_Stream.sin_addr.s_addr != destAddr.sin_addr.s_addr
+                || session->Addr_ObjectPos_Stream.sin_port != destAddr.sin_port) {
+                break;
+            }
+
+            AggregatedState_Entry entry;
+            entry.SessionID = session->StreamSessionID;
+            entry.BallPos = session->BallPos;
+            entry.PlayerA_PaddlePos = session->PlayerA_PaddlePos;
+            entry.PlayerB_PaddlePos = session->PlayerB_PaddlePos;
+            memcpy(datagram + datagramSize, &entry, sizeof(entry));
+            datagramSize += sizeof(entry);
+            header.NumEntries += 1;
+            sessionIdx += 1;
+        }
+        memcpy(datagram, &header, sizeof(header));
+
+        if (sendto(udpSocket, datagram, datagramSize, 0, (const sockaddr*)&destAddr, sizeof(destAddr)) <= 0) {
+            std::cout << "[DEBUG] SendAggregatedObjectState. sendto failed. errno: " << errno << std::endl;
+            bSuccess = false;
+        }
+    }
+
+    return bSuccess;
+}
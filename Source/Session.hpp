@@ -6,6 +6,7 @@
 #include <atomic>
 #include <cassert>
 #include <cstring>
+#include <vector>
 #include <sys/socket.h>
 #include <arpa/inet.h> 
 #include <unistd.h>
@@ -14,6 +15,21 @@
 #include "math.hpp"
 #include "config.hpp"
 #include "Helper.hpp"
+#include "TimingWheel.hpp"
+
+class Session;
+
+// Spectator of a session. In the subscribers of the session, and in the subscription list of the client for the reactor of the session.
+// (Client::subscriptions) Only that reactor touches it.
+struct Subscription
+{
+    Session*      SubscribedSession;
+    Client*       SubscriberClient;
+    sockaddr_in   Addr;
+    uint32_t      Index;      //< Position in the subscribers of the session
+    Subscription* ClientPrev; //< Subscription list of the client
+    Subscription* ClientNext;
+};
 
 class Session
 {
@@ -21,11 +37,47 @@ public:
     enum class PlayerID;
     enum class InputKey;
     enum class InputType;
+    struct PlayerInput;
     enum class RoundResultType;
+    enum class StreamMode;
+    struct Snapshot;
 
 public:
-    // Generate session id pool for unique session id
-    static void InitSessionIdPool();
+    // Generate session id pool for unique session id. IDs are [idBase, idBase + MAX_SESSION). (idBase encodes the shard)
+    // The ID space is split into contiguous partitions (One per reactor), so the owner of an ID is known without a lookup.
+    static void InitSessionIdPool(uint32_t numPartitions = 1, uint32_t idBase = 0);
+
+    // idPartition of a session outside of the session ID pool. It takes no session ID and FindSession() doesn't see it,
+    // so any number of threads can create them without partitions. (Offline replay)
+    static constexpr uint32_t DetachedIdPartition = UINT32_MAX;
+
+    // Make the ID the next one handed out in its partition. false if it is taken or invalid. (Hot restart keeps the session IDs)
+    static bool ReserveSessionId(uint32_t sessionID);
+
+    // Number of sessions that can still be created in the partition
+    static inline uint32_t GetNumFreeSessionIds(uint32_t partition = 0) { return sessionIdPoolTop[partition]; }
+
+    // Partition of the session ID. (Out of range for an invalid ID, or an ID of another shard)
+    static inline uint32_t GetSessionIdPartition(uint32_t sessionID) { return (sessionID - sessionIdBase) / sessionIdPartitionSize; }
+
+    // Partition p has the IDs [idBase + p * size, +size). (The last one may be shorter)
+    static inline uint32_t GetSessionIdPartitionSize() { return sessionIdPartitionSize; }
+
+    // Sessions alive in all partitions. Readable from any thread.
+    static inline uint32_t GetNumLiveSessions() { return numLiveSessions.load(std::memory_order_relaxed); }
+
+    // Live session of the ID in O(1). nullptr if there is no such session.
+    static inline Session* FindSession(uint32_t sessionID) { return (sessionID - sessionIdBase < MAX_SESSION) ? sessionTable[sessionID - sessionIdBase] : nullptr; }
+
+    // Seed of the session RNGs. Each session draws from its own sequence, derived from the server seed and its replay ID.
+    // (Unless the session is created with a seed of its own)
+    static inline void SetServerSeed(uint64_t seed) { serverSeed = seed; }
+
+    static inline uint64_t GetServerSeed() { return serverSeed; }
+
+    // Pack the object state of sessions in StreamMode::Aggregated into MTU-sized datagrams per destination.
+    // The order of the given sessions is changed.
+    static bool SendAggregatedObjectState(int udpSocket, Session** sessions, size_t numSessions);
 
 public:
     Session(Client*  ownerClient,
@@ -40,21 +92,128 @@ public:
             uint32_t paddleOffsetFromWall,
             int udpSocket_ObjectPos_Stream,
             sockaddr_in addr_ObjectPos_Stream,
-            uint16_t recvPort_ObjectPos_Stream);
+            uint16_t recvPort_ObjectPos_Stream,
+            uint32_t idPartition = 0,
+            uint64_t seed = 0); //< Seed of the session RNG. 0: Derived from the server seed
+
+    // Resume a session saved by SaveSnapshot() (e.g. on another server) under a new session ID. (Or the one reserved by ReserveSessionId())
+    // The stream keeps the original ID and restarts from a keyframe. Spectators are not carried over.
+    Session(Client* ownerClient, const Snapshot& snapshot, int udpSocket_ObjectPos_Stream, uint32_t idPartition = 0);
 
     ~Session();
 
+    // Save the full state of the session. Call between ticks.
+    // The time of the save sets SinceLastTickUs. (A checkpoint passes the time of the last tick, to resume at the tick)
+    void SaveSnapshot(Snapshot& snapshot, std::chrono::steady_clock::time_point saveTime = std::chrono::steady_clock::now()) const;
+
+    // Hide the session from FindSession() while it runs on another server. The session ID stays allocated.
+    void SetMigrated(bool bMigrated);
+
+    inline bool IsMigrated() const { return bMigrated; }
+
     bool BeginRound();
 
-    bool SetPlayerInput(PlayerID playerID, InputKey key, InputType type);
+    // Queue the input for the next tick, which applies it at the time it was received within the tick.
+    // Fails if the input queue of the session is full. (INPUT_EVENT_QUEUE_SIZE inputs between two ticks)
+    bool SetPlayerInput(PlayerID playerID, InputKey key, InputType type, std::chrono::steady_clock::time_point receiveTime = std::chrono::steady_clock::now());
+
+    inline bool IsInputQueueFull() const
+    {
+        return InputEventHead.load(std::memory_order_relaxed) - InputEventTail.load(std::memory_order_acquire) == INPUT_EVENT_QUEUE_SIZE;
+    }
+
+    // Switch player input to the sequenced UDP channel. The state stream then echoes the last applied input sequence.
+    inline void EnableUdpInput() { bUdpInputEnabled = true; }
 
+    inline bool IsUdpInputEnabled() const { return bUdpInputEnabled; }
+
+    // Apply sequenced inputs received via UDP. inputs[i] has sequence number (seq - i).
+    // Inputs not newer than the last applied sequence are ignored, the rest are applied oldest first.
+    // Inputs that don't fit in the input queue are not acknowledged, so that the client repeats them.
+    bool SetPlayerInputSeq(PlayerID playerID, uint32_t seq, const PlayerInput* inputs, uint32_t numInputs);
+
+    // Let the server drive the player slot from the predicted ball trajectory
+    void SetBotPlayer(PlayerID playerID, bool bBot);
+
+    inline bool IsBotPlayer(PlayerID playerID) const { return (playerID == PlayerID::PlayerA) ? bBotPlayerA : bBotPlayerB; }
+
+    // Advance the simulation by the wall-clock time elapsed since the last tick
     bool Update();
 
+    // Advance the simulation by the given time step (Used by Update() and headless benchmark)
+    bool Simulate(std::chrono::milliseconds deltaTime_Ms);
+
+    // Send the object state of this tick. (No-op in StreamMode::Aggregated, see SendAggregatedObjectState())
     bool SendObjectState();
 
+    inline void SetStreamMode(StreamMode mode)
+    {
+        CurrentStreamMode = mode;
+
+        // Restart the quantized stream from a keyframe
+        bStreamAcked = false;
+        bStreamKeyframeSent = false;
+
+        // The event driven stream starts with the current state
+        StreamEventFlags |= StreamEvent_Resync;
+    }
+
+    inline StreamMode GetStreamMode() const { return CurrentStreamMode; }
+
+    // Stream the state at streamRate(Hz) independent of the simulation tick rate. 0: Every tick
+    void SetStreamRate(uint32_t streamRate, uint32_t tickRate);
+
+    // Whether the state of the current tick should be streamed.
+    // Sessions are phase shifted by their ID, so that low rate sessions don't all send on the same tick.
+    // The event driven stream is due on a discontinuity of the motion, or when the heartbeat interval has passed.
+    inline bool IsStreamDue() const
+    {
+        if (CurrentStreamMode == StreamMode::EventDriven) {
+            return StreamEventFlags != 0 || RoundTimeElapsed - StreamLastEventTime >= std::chrono::milliseconds(STREAM_HEARTBEAT_MS);
+        }
+        return (TickNumber + StreamSessionID) % StreamInterval == 0;
+    }
+
+    inline const sockaddr_in& GetStreamAddress() const { return Addr_ObjectPos_Stream; }
+
+    // Add a spectator receiving the state stream at the address of the client and recvPort(Network byte order).
+    // The state packet is serialized once per tick and fanned out to the owner, the multicast group and all subscribers.
+    bool Subscribe(Client* client, uint16_t recvPort);
+
+    bool Unsubscribe(Client* client, uint16_t recvPort);
+
+    // Remove all subscriptions of the client to the sessions of the partition. (e.g. On disconnect) O(subscriptions)
+    // Call on the reactor of the partition.
+    static void UnsubscribeClient(Client& client, uint32_t idPartition);
+
+    // Also stream to the IP multicast group. groupAddr and port are in network byte order. groupAddr 0: Disable
+    bool SetMulticastGroup(uint32_t groupAddr, uint16_t port);
+
+    inline size_t GetNumSubscribers() const { return Subscribers.size(); }
+
+    // Client and receive port (Network byte order) of the i-th spectator
+    inline Client* GetSubscriberClient(size_t i) const { return Subscribers[i]->SubscriberClient; }
+
+    inline uint16_t GetSubscriberPort(size_t i) const { return Subscribers[i]->Addr.sin_port; }
+
+    // Client acknowledged the quantized state of the tick. Later packets are delta encoded against it.
+    void AckStreamTick(uint32_t tick);
+
+    inline uint32_t GetTickNumber() const { return TickNumber; }
+
     inline uint32_t GetSessionID() const { return SessionID; }
 
+    // Unique in the process, unlike the session ID. (Identifies the session in the replay log, see Recorder)
+    inline uint32_t GetReplayID() const { return ReplayID; }
+
     inline Client* GetOwnerClient() const { return OwnerClient; }
+
+    // Give an ownerless session to a client. (A session recovered from a checkpoint, see ReclaimSession_v1)
+    // Moves the session to the owned session list of the client. nullptr: Ownerless
+    void SetOwnerClient(Client* ownerClient);
+
+    // Next session of the owned session list of the owner. (Client::ownedSessions) nullptr: Last one
+    inline Session* GetNextOwnedSession() const { return OwnerNext; }
     
     inline std::chrono::steady_clock::time_point GetLastTickUpdateTime() const { return LastTickUpdateTime; }
 
@@ -64,6 +223,26 @@ public:
 
     inline bool IsSessionEnded() const { return bSessionEnded; }
 
+    // Let the reactor delete the session between ticks. (e.g. Abandoned by its client)
+    inline void EndSession() { bSessionEnded = true; }
+
+    // Wall time the running round times out at. (The round time only advances with the ticks of the session)
+    inline std::chrono::steady_clock::time_point GetRoundDeadline() const
+    {
+        return LastTickUpdateTime + std::chrono::milliseconds((int64_t)GameTime * 1000) - RoundTimeElapsed;
+    }
+
+    // End the running round with RoundResultType::Timeout on the next tick, without simulating it.
+    // Call between ticks. (The round timer of the reactor fires at the deadline. Replays end the round on the recorded tick)
+    void EndRoundByTimeout();
+
+    // Timers of the session in the timing wheel of its reactor. Unlinked when the session is deleted.
+    inline TimerNode& GetRoundTimer() { return RoundTimer; }
+
+    inline TimerNode& GetExpiryTimer() { return ExpiryTimer; }
+
+    inline uint64_t GetCollisionIterationCount() const { return CollisionIterationCount; }
+
 public:
     // Player Input State
     enum class PlayerID
@@ -93,6 +272,16 @@ public:
         InputType Type;
     };
 
+public:
+    // Object State Stream
+    enum class StreamMode
+    {
+        PerSession = 0, //< One ObjectPos datagram per session
+        Aggregated = 1, //< Sessions sharing the destination are packed into the same datagrams
+        QuantizedDelta = 2, //< Quantized fields delta encoded against the last acknowledged snapshot
+        EventDriven = 3 //< Position and velocity, only on discontinuities of the motion plus a heartbeat
+    };
+
 public:
     // Round Result
     enum class RoundResultType
@@ -102,9 +291,141 @@ public:
         WinPlayerB = 2
     };
 
+public:
+    // Serialized session state. Plain little endian data, sent between servers as is.
+    struct __attribute__((packed)) Snapshot
+    {
+        uint32_t Version; //< SESSION_SNAPSHOT_VERSION
+
+        // Parameters
+        uint32_t FieldWidth;
+        uint32_t FieldHeight;
+        uint32_t WinScore;
+        uint32_t GameTime;
+        uint32_t BallSpeed;
+        uint32_t BallRadius;
+        uint32_t PaddleSpeed;
+        uint32_t PaddleSize;
+        uint32_t PaddleOffsetFromWall;
+
+        // Stream
+        uint32_t StreamSessionID;
+        uint32_t StreamAddr;      //< Network byte order
+        uint16_t StreamPort;      //< Network byte order. 0: Stream disabled
+        uint8_t  StreamMode;
+        uint32_t StreamInterval;
+        uint32_t MulticastAddr;   //< Network byte order
+        uint16_t MulticastPort;   //< Network byte order
+        uint8_t  bMulticastEnabled;
+
+        // Input
+        uint8_t  PlayerA_InputKey;  //< Last input not applied yet. (Resumed for a bot. Queued inputs of a player are below)
+        uint8_t  PlayerA_InputType;
+        uint8_t  PlayerB_InputKey;
+        uint8_t  PlayerB_InputType;
+        uint8_t  NumQueuedInputs;
+        struct __attribute__((packed)) QueuedInput
+        {
+            uint32_t OffsetUs; //< Time since the last tick when received
+            uint8_t  PlayerID;
+            uint8_t  Key;
+            uint8_t  Type;
+        } QueuedInputs[INPUT_EVENT_QUEUE_SIZE]; //< Inputs of the players queued for the next tick, oldest first
+        uint8_t  bUdpInputEnabled;
+        uint32_t PlayerA_LastInputSeq;
+        uint32_t PlayerB_LastInputSeq;
+        uint8_t  bBotPlayerA;
+        uint8_t  bBotPlayerB;
+        float    PlayerA_BotAimError;
+        float    PlayerB_BotAimError;
+
+        // RNG (Pcg32)
+        uint64_t RandomState;
+        uint64_t RandomIncrement;
+
+        // Game State
+        uint32_t ScoreA;
+        uint32_t ScoreB;
+        float    BallPos[2];
+        float    BallVel[2];
+        float    PlayerA_PaddlePos;
+        float    PlayerB_PaddlePos;
+        uint8_t  PlayerA_PaddleDir;
+        uint8_t  PlayerB_PaddleDir;
+        uint32_t TickNumber;
+        int64_t  RoundTimeElapsedMs;
+        int64_t  SinceLastTickUs; //< Wall time since the last tick when saved. The next tick also simulates the transfer time.
+        uint8_t  bRoundRunning;
+        uint8_t  bSessionEnded;
+        uint8_t  LastRoundResult;
+        uint64_t CollisionIterationCount;
+    };
+
+private:
+    // Queue an input without recording it. Call between ticks.
+    bool PushInputEvent(PlayerID playerID, const PlayerInput& input, uint32_t offsetUs);
+
+    // Last input of the player not applied yet. (Queued, or the decision of a bot)
+    PlayerInput GetPendingInput(PlayerID playerID) const;
+
+    // Move the paddles in their current directions
+    void MovePaddles(float deltaTime_Sec);
+
+    void UpdateBotInput(PlayerID playerID);
+
+    // Result of the round that ended on this tick, for the replay log
+    void RecordRoundEnd() const;
+
+    bool SendQuantizedDeltaState();
+
+    bool SendEventDrivenState();
+
+    // Send the serialized state packet to the owner stream (If bSendToOwner), the multicast group and all subscribers
+    bool SendStatePacket(const void* packet, size_t packetSize, bool bSendToOwner);
+
+    // Unlink the subscription from the session and its client, and delete it
+    void RemoveSubscription(Subscription* subscription);
+
+    // Input received between ticks
+    struct InputEvent
+    {
+        uint32_t OffsetUs; //< Time since the start of the tick it is applied in. (Since LastTickUpdateTime when received)
+        uint8_t  PlayerID; //< PlayerID
+        uint8_t  Key;      //< InputKey
+        uint8_t  Type;     //< InputType
+    };
+
+    // Reasons of an event driven state packet. 0: Heartbeat
+    enum StreamEventFlag : uint8_t
+    {
+        StreamEvent_Bounce     = 1 << 0, //< Ball velocity changed by a wall or a paddle
+        StreamEvent_PaddleDir  = 1 << 1, //< Direction of a paddle changed
+        StreamEvent_RoundBegin = 1 << 2,
+        StreamEvent_RoundEnd   = 1 << 3,
+        StreamEvent_Resync     = 1 << 4  //< Stream mode changed
+    };
+
+    struct QuantizedState
+    {
+        uint32_t Tick;
+        uint16_t BallX;   //< [0, FieldWidth]  -> [0, 65535]
+        uint16_t BallY;   //< [0, FieldHeight] -> [0, 65535]
+        int16_t  PaddleA; //< [-FieldHeight/2, FieldHeight/2] -> [-32767, 32767]
+        int16_t  PaddleB;
+        uint32_t PlayerA_LastInputSeq;
+        uint32_t PlayerB_LastInputSeq;
+    };
+
 private:
     uint32_t SessionID;
+    uint32_t ReplayID;
+    uint32_t StreamSessionID; //< ID in the state stream. Kept across migration, so that clients keep matching packets
+    bool     bMigrated;
+    bool     bDetached; //< Created with DetachedIdPartition. SessionID is UINT32_MAX
     Client*  OwnerClient;
+    Session* OwnerPrev;  //< Owned session list of the owner client. Unlinked when the session is deleted
+    Session* OwnerNext;
+    uint32_t ListIndex;  //< Position in the SessionList of its reactor. UINT32_MAX: Not listed
     std::chrono::steady_clock::time_point LastTickUpdateTime; //< Time point of started last tick processing
 
     // Parameters
@@ -119,12 +440,50 @@ private:
     uint32_t PaddleOffsetFromWall;
     int UdpSocket_ObjectPos_Stream;
     sockaddr_in Addr_ObjectPos_Stream;
-    uint16_t RecvPort_ObjectPos_Stream;
+    uint16_t RecvPort_ObjectPos_Stream; //< 0: Stream disabled
+    StreamMode CurrentStreamMode;
+    uint32_t StreamInterval; //< Stream every N ticks
+
+    // Spectators
+    std::vector<Subscription*> Subscribers;
+    sockaddr_in Addr_Multicast;
+    bool bMulticastEnabled;
+
+    // Quantized Delta Stream
+    QuantizedState StreamHistory[STREAM_V2_SNAPSHOT_HISTORY]; //< Sent snapshots. Indexed by (Tick % STREAM_V2_SNAPSHOT_HISTORY)
+    uint32_t StreamAckedTick;
+    bool bStreamAcked;          //< StreamAckedTick is valid
+    uint32_t StreamLastKeyframeTick;
+    bool bStreamKeyframeSent;
+
+    // Event Driven Stream
+    uint8_t StreamEventFlags; //< Events since the last sent packet (StreamEventFlag)
+    std::chrono::milliseconds StreamLastEventTime; //< Round time of the last sent packet
 
     // Player Input
+    // Lock-free single-producer single-consumer ring. The reactor queues the received inputs, the worker ticking the session applies them.
+    InputEvent InputEvents[INPUT_EVENT_QUEUE_SIZE];
+    std::atomic<uint32_t> InputEventHead; //< Total inputs queued. Only stored by the producer
+    std::atomic<uint32_t> InputEventTail; //< Total inputs applied. Only stored by the consumer (And by BeginRound() between ticks)
+
+    // Bot Input (Decided at the end of a tick, and applied right away)
     PlayerInput PlayerA_Input;
     PlayerInput PlayerB_Input;
 
+    // Sequenced UDP Input
+    bool bUdpInputEnabled;
+    uint32_t PlayerA_LastInputSeq; //< Last applied input sequence. Echoed in the state stream.
+    uint32_t PlayerB_LastInputSeq;
+
+    // Bot Player
+    bool bBotPlayerA;
+    bool bBotPlayerB;
+    float PlayerA_BotAimError; //< Offset from the predicted ball position. 0: Not decided for this approach
+    float PlayerB_BotAimError;
+
+    // Ball directions and bot aim errors. Seeded per session, so that a replay draws the same numbers
+    Pcg32 Random;
+
     // Game State
     uint32_t ScoreA;
     uint32_t ScoreB ;
@@ -134,12 +493,71 @@ private:
     float PlayerB_PaddlePos;
     InputKey PlayerA_PaddleDir; // Direction at last tick
     InputKey PlayerB_PaddleDir;
+    uint32_t TickNumber; //< Number of simulated ticks
     std::chrono::milliseconds RoundTimeElapsed;
     bool bRoundRunning;
     bool bSessionEnded;
     RoundResultType LastRoundResult;
 
+    // Timers (See Reactor)
+    TimerNode RoundTimer;  //< Round timeout
+    TimerNode ExpiryTimer; //< Deletes the session. (Not reclaimed after recovery)
+
+    // Statistics
+    uint64_t CollisionIterationCount; //< Total iterations of the collision detection loop
+
+private:
+    static uint32_t sessionIdBase;
+    static uint32_t sessionIdPartitionSize;
+    static uint32_t sessionIdPoolTop[MAX_REACTOR]; //< Per partition
+    static uint32_t sessionIdPool[MAX_SESSION];    //< Partition p uses [p * sessionIdPartitionSize, +sessionIdPoolTop[p])
+    static Session* sessionTable[MAX_SESSION]; //< Indexed by SessionID - sessionIdBase
+    static std::atomic<uint32_t> numLiveSessions;
+    static uint64_t serverSeed;
+    static std::atomic<uint32_t> nextReplayID;
+
+    friend class SessionList;
+};
+
+/**
+ * Sessions of a reactor. Unordered: A session is removed in O(1) by moving the last one into its place.
+ * Each session keeps its position in the list, so removing doesn't search it.
+ * A session is in at most one list. Remove it from the list before deleting it.
+ * */
+class SessionList
+{
+public:
+    inline void push_back(Session* session)
+    {
+        assert(session->ListIndex == UINT32_MAX);
+        session->ListIndex = (uint32_t)Items.size();
+        Items.push_back(session);
+    }
+
+    inline void Remove(Session* session)
+    {
+        assert(Contains(session));
+        Session* const last = Items.back();
+        Items[session->ListIndex] = last;
+        last->ListIndex = session->ListIndex;
+        Items.pop_back();
+        session->ListIndex = UINT32_MAX;
+    }
+
+    inline bool Contains(const Session* session) const { return session->ListIndex < Items.size() && Items[session->ListIndex] == session; }
+
+    inline void reserve(size_t capacity) { Items.reserve(capacity); }
+
+    inline size_t size() const { return Items.size(); }
+
+    inline bool empty() const { return Items.empty(); }
+
+    inline Session* operator[](size_t i) const { return Items[i]; }
+
+    inline std::vector<Session*>::const_iterator begin() const { return Items.begin(); }
+
+    inline std::vector<Session*>::const_iterator end() const { return Items.end(); }
+
 private:
-    static uint32_t sessionIdPoolTop;
-    static uint32_t sessionIdPool[MAX_SESSION];
+    std::vector<Session*> Items;
 };
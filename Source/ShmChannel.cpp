@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "ShmChannel.hpp"
+
+ShmChannel::ShmChannel()
+    : Block(nullptr)
+    , Fd(-1)
+{
+    PseudoClient.socket = -1;
+
+    // Streams of the sessions created through the channel go to the local host
+    memset(&PseudoClient.address, 0, sizeof(PseudoClient.address));
+    PseudoClient.address.sin_family = AF_INET;
+    PseudoClient.address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+ShmChannel::~ShmChannel()
+{
+    if (Block != nullptr) {
+        munmap(Block, sizeof(ShmControlBlock));
+        shm_unlink(Name.c_str());
+    }
+    if (Fd != -1) {
+        close(Fd);
+    }
+}
+
+bool ShmChannel::Open(const char* name)
+{
+    // Start from a clean object, not from the rings of a previous run
+    shm_unlink(name);
+
+    const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        std::cerr << "Failed to create shared memory: " << name << ". errno: " << errno << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, sizeof(ShmControlBlock)) == -1) {
+        std::cerr << "Failed to size shared memory. errno: " << errno << std::endl;
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, sizeof(ShmControlBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map shared memory. errno: " << errno << std::endl;
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    Fd = fd;
+
+    // ftruncate zero-fills the object, construct the positions in place
+    Block = static_cast<ShmControlBlock*>(mapped);
+    new (&Block->Command.Head) std::atomic<uint64_t>(0);
+    new (&Block->Command.Tail) std::atomic<uint64_t>(0);
+    new (&Block->Response.Head) std::atomic<uint64_t>(0);
+    new (&Block->Response.Tail) std::atomic<uint64_t>(0);
+    Block->RingSize = SHM_RING_SIZE;
+    Block->Version = SHM_CHANNEL_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    Block->Magic = SHM_CHANNEL_MAGIC;
+
+    Name = name;
+    std::cout << "[LOG] Shared memory control channel: " << name << std::endl;
+    return true;
+}
+
+bool ShmChannel::Adopt(int fd, const char* name)
+{
+    void* mapped = mmap(nullptr, sizeof(ShmControlBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map shared memory. errno: " << errno << std::endl;
+        return false;
+    }
+    ShmControlBlock* block = static_cast<ShmControlBlock*>(mapped);
+    if (block->Magic != SHM_CHANNEL_MAGIC || block->Version != SHM_CHANNEL_VERSION || block->RingSize != SHM_RING_SIZE) {
+        std::cerr << "Inherited shared memory has another layout" << std::endl;
+        munmap(mapped, sizeof(ShmControlBlock));
+        return false;
+    }
+
+    Block = block;
+    Fd = fd;
+    Name = name;
+    std::cout << "[LOG] Shared memory control channel: " << name << " (Inherited)" << std::endl;
+    return true;
+}
+
+bool ShmChannel::Poll(QueryContext& context)
+{
+    ShmRing& command = Block->Command;
+
+    const uint64_t head = command.Head.load(std::memory_order_acquire);
+    const uint64_t tail = command.Tail.load(std::memory_order_relaxed);
+    bool bTransferred = false;
+    if (head - tail > SHM_RING_SIZE) {
+        Reset("Command.Head out of the ring");
+        return true;
+    }
+    if (head != tail) {
+        // Copy out of the ring in up to two pieces (Wrap around)
+        const size_t size = (size_t)(head - tail);
+        const size_t begin = (size_t)(tail & (SHM_RING_SIZE - 1));
+        const size_t firstSize = std::min(size, (size_t)SHM_RING_SIZE - begin);
+        std::vector<char>& recvBuffer = PseudoClient.recvBuffer;
+        recvBuffer.insert(recvBuffer.end(), command.Data + begin, command.Data + begin + firstSize);
+        recvBuffer.insert(recvBuffer.end(), command.Data, command.Data + (size - firstSize));
+        command.Tail.store(head, std::memory_order_release);
+
+        HandleQueries(context, PseudoClient);
+        bTransferred = true;
+    }
+
+    // Round results are pushed outside of queries
+    bTransferred |= FlushResponses();
+
+    // Same as the send overflow disconnect of a TCP client, but the channel can't be closed
+    if (PseudoClient.bSendOverflowed) {
+        Reset("Response ring not read");
+        return true;
+    }
+    return bTransferred;
+}
+
+bool ShmChannel::FlushResponses()
+{
+    const size_t queuedBytes = PseudoClient.GetQueuedBytes();
+    if (queuedBytes == 0) {
+        return false;
+    }
+
+    ShmRing& response = Block->Response;
+    const uint64_t head = response.Head.load(std::memory_order_relaxed);
+    const uint64_t tail = response.Tail.load(std::memory_order_acquire);
+    if (head - tail > SHM_RING_SIZE) {
+        Reset("Response.Tail out of the ring");
+        return false;
+    }
+    const size_t freeSize = SHM_RING_SIZE - (size_t)(head - tail);
+    const size_t size = std::min(freeSize, queuedBytes);
+    if (size == 0) {
+        return false;
+    }
+
+    const size_t begin = (size_t)(head & (SHM_RING_SIZE - 1));
+    const size_t firstSize = std::min(size, (size_t)SHM_RING_SIZE - begin);
+    const char* queuedData = PseudoClient.GetQueuedData();
+    memcpy(response.Data + begin, queuedData, firstSize);
+    memcpy(response.Data, queuedData + firstSize, size - firstSize);
+    response.Head.store(head + size, std::memory_order_release);
+
+    PseudoClient.ConsumeSendBuffer(size);
+    return true;
+}
+
+void ShmChannel::Reset(const char* reason)
+{
+    std::cout << "[LOG] Shared memory channel reset: " << reason << ". Dropped " << PseudoClient.recvBuffer.size() << " command bytes, "
+              << PseudoClient.GetQueuedBytes() << " response bytes" << std::endl;
+
+    PseudoClient.recvBuffer.clear();
+    PseudoClient.ConsumeSendBuffer(PseudoClient.GetQueuedBytes());
+    PseudoClient.bSendOverflowed = false;
+
+    Block->Command.Tail.store(Block->Command.Head.load(std::memory_order_acquire), std::memory_order_release);
+    Block->Response.Head.store(Block->Response.Tail.load(std::memory_order_acquire), std::memory_order_release);
+}
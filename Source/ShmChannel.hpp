@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+#include "config.hpp"
+#include "Client.hpp"
+#include "Query.hpp"
+
+/**
+ * Shared memory control channel for an orchestrator on the same host.
+ *
+ * A pair of single-producer single-consumer byte rings carries the same byte stream as the TCP control connection.
+ * (Queries in v1 or v2 framing, responses and round results)
+ * The main loop polls the command ring on every iteration, so a query costs a memory write and no syscall.
+ *
+ * The orchestrator maps the object with shm_open(name) + mmap after the server started,
+ * checks Magic / Version / RingSize, then
+ *  - Writes queries to Command.Data[Head % RingSize] and publishes them by storing Command.Head (release)
+ *  - Reads responses from Response.Data[Tail % RingSize] up to Response.Head (acquire), and stores Response.Tail (release)
+ *
+ * The positions written by the orchestrator are not trusted. A ring with more than RingSize bytes between its positions,
+ * or responses left unread past CLIENT_SEND_BUFFER_HARD_LIMIT, resets the channel. (See Reset())
+ * */
+struct ShmRing
+{
+    alignas(CACHE_LINE) std::atomic<uint64_t> Head; //< Total bytes written. Only stored by the producer
+    alignas(CACHE_LINE) std::atomic<uint64_t> Tail; //< Total bytes read. Only stored by the consumer
+    alignas(CACHE_LINE) char Data[SHM_RING_SIZE];
+};
+
+struct ShmControlBlock
+{
+    uint32_t Magic;    //< SHM_CHANNEL_MAGIC
+    uint32_t Version;  //< SHM_CHANNEL_VERSION
+    uint32_t RingSize; //< SHM_RING_SIZE
+    ShmRing  Command;  //< Orchestrator -> Server
+    ShmRing  Response; //< Server -> Orchestrator
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Ring positions are shared between processes");
+static_assert((SHM_RING_SIZE & (SHM_RING_SIZE - 1)) == 0, "SHM_RING_SIZE must be a power of two");
+
+class ShmChannel
+{
+public:
+    ShmChannel();
+
+    ~ShmChannel();
+
+    // Create the shared memory object. (e.g. "/pong_control") An existing object of the name is replaced.
+    bool Open(const char* name);
+
+    // Map the object of a previous process (Hot restart), keeping its rings and the mapping of the orchestrator
+    bool Adopt(int fd, const char* name);
+
+    // Descriptor of the shared memory object. (Passed on by hot restart)
+    inline int GetFd() const { return Fd; }
+
+    inline bool IsOpen() const { return Block != nullptr; }
+
+    // Handle the queries in the command ring, and move pending responses to the response ring.
+    // Returns true if anything was transferred.
+    bool Poll(QueryContext& context);
+
+    // Owner of the sessions created through the channel
+    inline Client& GetClient() { return PseudoClient; }
+
+private:
+    // Move as much of the send buffer of the pseudo client as fits into the response ring
+    bool FlushResponses();
+
+    // Protocol error. Drop the buffered bytes of both directions and restart both rings from the positions of the orchestrator.
+    // (Command.Tail = Command.Head, Response.Head = Response.Tail) The sessions of the channel are kept.
+    void Reset(const char* reason);
+
+private:
+    ShmControlBlock* Block;
+    int              Fd;
+    std::string      Name;
+    Client           PseudoClient; //< Has no socket. Never registered to select()
+};
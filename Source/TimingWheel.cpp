@@ -0,0 +1,108 @@
+#include <cassert>
+
+#include "TimingWheel.hpp"
+
+static_assert((TIMING_WHEEL_SLOTS & (TIMING_WHEEL_SLOTS - 1)) == 0, "TIMING_WHEEL_SLOTS must be a power of two");
+
+namespace
+{
+    constexpr uint32_t slotBits = __builtin_ctz(TIMING_WHEEL_SLOTS);
+    constexpr uint64_t slotMask = TIMING_WHEEL_SLOTS - 1;
+    constexpr uint64_t wheelSpan = 1ull << (slotBits * TIMING_WHEEL_LEVELS); //< Ticks covered by all the levels
+
+    static_assert(slotBits * TIMING_WHEEL_LEVELS < 64, "Timing wheel span overflows the tick");
+}
+
+TimingWheel::TimingWheel()
+    : CurrentTick(0)
+{
+    for (uint32_t level = 0; level < TIMING_WHEEL_LEVELS; level++) {
+        for (uint32_t slot = 0; slot < TIMING_WHEEL_SLOTS; slot++) {
+            TimerNode& head = Slots[level][slot];
+            head.Prev = &head;
+            head.Next = &head;
+        }
+    }
+}
+
+TimingWheel::~TimingWheel()
+{
+    // Leave the timers still scheduled unlinked, they may outlive the wheel
+    for (uint32_t level = 0; level < TIMING_WHEEL_LEVELS; level++) {
+        for (uint32_t slot = 0; slot < TIMING_WHEEL_SLOTS; slot++) {
+            TimerNode& head = Slots[level][slot];
+            while (head.Next != &head) {
+                head.Next->Cancel();
+            }
+            head.Prev = nullptr;
+            head.Next = nullptr;
+        }
+    }
+}
+
+void TimingWheel::Schedule(TimerNode& node, uint64_t expiry, uint8_t kind)
+{
+    node.Cancel();
+    node.Expiry = (expiry > CurrentTick) ? expiry : CurrentTick + 1; //< The slot of the current tick already fired
+    node.Kind = kind;
+    Insert(node);
+}
+
+void TimingWheel::Advance(uint64_t tick, std::vector<TimerNode*>& expired)
+{
+    while (CurrentTick < tick)
+    {
+        CurrentTick += 1;
+
+        // Entering a new slot of a level moves its timers down, before the level 0 slot of the tick fires
+        for (uint32_t level = 1; level < TIMING_WHEEL_LEVELS; level++) {
+            if ((CurrentTick & ((1ull << (slotBits * level)) - 1)) != 0) {
+                break;
+            }
+            Cascade(level, (uint32_t)((CurrentTick >> (slotBits * level)) & slotMask));
+        }
+
+        TimerNode& head = Slots[0][CurrentTick & slotMask];
+        while (head.Next != &head) {
+            TimerNode* const node = head.Next;
+            assert(node->Expiry <= CurrentTick);
+            node->Cancel();
+            expired.push_back(node);
+        }
+    }
+}
+
+void TimingWheel::Insert(TimerNode& node)
+{
+    assert(node.Expiry >= CurrentTick);
+
+    // Parked in the top level until it is in reach
+    const uint64_t expiry = (node.Expiry - CurrentTick < wheelSpan) ? node.Expiry : CurrentTick + wheelSpan - 1;
+    const uint64_t delta = expiry - CurrentTick;
+
+    uint32_t level = 0;
+    while (level + 1 < TIMING_WHEEL_LEVELS && delta >= (1ull << (slotBits * (level + 1)))) {
+        level += 1;
+    }
+    PushBack(Slots[level][(expiry >> (slotBits * level)) & slotMask], node);
+}
+
+void TimingWheel::Cascade(uint32_t level, uint32_t slot)
+{
+    TimerNode& head = Slots[level][slot];
+    if (head.Next == &head) {
+        return;
+    }
+
+    // Detach the list first. A parked timer may go back into the same slot.
+    TimerNode* node = head.Next;
+    head.Prev->Next = nullptr;
+    head.Prev = &head;
+    head.Next = &head;
+
+    while (node != nullptr) {
+        TimerNode* const next = node->Next;
+        Insert(*node);
+        node = next;
+    }
+}
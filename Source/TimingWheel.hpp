@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "config.hpp"
+
+/**
+ * Timer of a timing wheel. Embedded in the object it times, so scheduling allocates nothing.
+ * A node is in at most one wheel. Cancel() and the destructor unlink it in O(1) without the wheel.
+ * */
+struct TimerNode
+{
+    TimerNode* Prev;
+    TimerNode* Next;    //< nullptr: Not scheduled
+    uint64_t   Expiry;  //< Wheel tick the timer fires on
+    uint32_t   OwnerID; //< Set by the owner of the node. (e.g. Session ID)
+    uint8_t    Kind;    //< Set by the scheduler, to tell the timers of a wheel apart
+
+    inline TimerNode()
+        : Prev(nullptr)
+        , Next(nullptr)
+        , Expiry(0)
+        , OwnerID(0)
+        , Kind(0)
+    {
+    }
+
+    TimerNode(const TimerNode&) = delete;
+    TimerNode& operator=(const TimerNode&) = delete;
+
+    inline ~TimerNode()
+    {
+        Cancel();
+    }
+
+    inline bool IsScheduled() const { return Next != nullptr; }
+
+    inline void Cancel()
+    {
+        if (Next != nullptr) {
+            Prev->Next = Next;
+            Next->Prev = Prev;
+            Prev = nullptr;
+            Next = nullptr;
+        }
+    }
+};
+
+/**
+ * Hierarchical timing wheel. (Varghese & Lauck)
+ *
+ * Time is in wheel ticks. The owner maps its clock to them. (A reactor uses its tick duration)
+ * Level L has TIMING_WHEEL_SLOTS slots of TIMING_WHEEL_SLOTS^L ticks each. A timer goes to the lowest level covering its expiry,
+ * and moves down a level when the wheel reaches its slot, so that schedule, cancel and expiry are O(1) per timer.
+ * Timers further than the top level covers are parked in it, and moved again until they are due.
+ *
+ * Not thread-safe. Only the owning thread schedules, cancels and advances.
+ * */
+class TimingWheel
+{
+public:
+    TimingWheel();
+
+    ~TimingWheel();
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    inline uint64_t GetCurrentTick() const { return CurrentTick; }
+
+    // Schedule (Or reschedule) the timer. An expiry not after the current tick fires on the next tick.
+    void Schedule(TimerNode& node, uint64_t expiry, uint8_t kind = 0);
+
+    // Move the wheel up to the tick, and append the timers that expired on the way. (Unlinked, in the order of expiry)
+    void Advance(uint64_t tick, std::vector<TimerNode*>& expired);
+
+private:
+    // Put the node into the slot of its expiry. (Expiry may be the current tick while cascading)
+    void Insert(TimerNode& node);
+
+    // Move the timers of the slot down to the lower levels
+    void Cascade(uint32_t level, uint32_t slot);
+
+    static inline void PushBack(TimerNode& head, TimerNode& node)
+    {
+        node.Prev = head.Prev;
+        node.Next = &head;
+        head.Prev->Next = &node;
+        head.Prev = &node;
+    }
+
+private:
+    uint64_t  CurrentTick;
+    TimerNode Slots[TIMING_WHEEL_LEVELS][TIMING_WHEEL_SLOTS]; //< Heads of circular lists
+};
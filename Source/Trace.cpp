@@ -0,0 +1,108 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "Helper.hpp"
+#include "Trace.hpp"
+
+std::atomic<bool> Tracer::bEnabled(false);
+const std::chrono::steady_clock::time_point Tracer::Epoch = std::chrono::steady_clock::now();
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* Name;
+        uint64_t    BeginUs;
+        uint64_t    DurationUs;
+        uint32_t    Arg;
+    };
+
+    struct TraceBuffer
+    {
+        uint32_t                ThreadIdx;
+        std::string             ThreadName;
+        std::vector<TraceEvent> Events;
+    };
+
+    // Buffers are owned by the registry so that spans of exited threads survive until dump.
+    std::mutex                                traceBufferRegistryMutex;
+    std::vector<std::unique_ptr<TraceBuffer>> traceBufferRegistry;
+
+    TraceBuffer* GetThreadTraceBuffer()
+    {
+        thread_local TraceBuffer* threadBuffer = nullptr;
+        if (threadBuffer == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(traceBufferRegistryMutex);
+            traceBufferRegistry.emplace_back(new TraceBuffer);
+            threadBuffer = traceBufferRegistry.back().get();
+            threadBuffer->ThreadIdx = (uint32_t)traceBufferRegistry.size() - 1;
+            threadBuffer->ThreadName = "thread" + std::to_string(threadBuffer->ThreadIdx);
+            threadBuffer->Events.reserve(TRACE_MAX_EVENTS_PER_THREAD);
+        }
+        return threadBuffer;
+    }
+}
+
+void Tracer::SetEnabled(bool bEnable)
+{
+    bEnabled.store(bEnable, std::memory_order_relaxed);
+}
+
+void Tracer::SetThreadName(const char* name)
+{
+    TraceBuffer* buffer = GetThreadTraceBuffer();
+    std::lock_guard<std::mutex> lock(traceBufferRegistryMutex);
+    buffer->ThreadName = name;
+}
+
+void Tracer::RecordSpan(const char* name, uint64_t beginUs, uint64_t endUs, uint32_t arg)
+{
+    TraceBuffer* buffer = GetThreadTraceBuffer();
+
+    // Drop spans instead of growing without bound while tracing is left on
+    if (buffer->Events.size() >= TRACE_MAX_EVENTS_PER_THREAD) {
+        return;
+    }
+
+    buffer->Events.push_back({ name, beginUs, endUs - beginUs, arg });
+}
+
+bool Tracer::DumpChromeTrace(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        std::cerr << "Failed to open trace file: " << path << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(traceBufferRegistryMutex);
+
+    size_t numEvents = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (const std::unique_ptr<TraceBuffer>& buffer : traceBufferRegistry)
+    {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            (numEvents == 0) ? "" : ",\n", buffer->ThreadIdx, buffer->ThreadName.c_str());
+        numEvents += 1;
+
+        for (const TraceEvent& event : buffer->Events)
+        {
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%llu",
+                event.Name, buffer->ThreadIdx, (unsigned long long)event.BeginUs, (unsigned long long)event.DurationUs);
+            if (event.Arg != UINT32_MAX) {
+                fprintf(file, ",\"args\":{\"n\":%u}", event.Arg);
+            }
+            fprintf(file, "}");
+            numEvents += 1;
+        }
+        buffer->Events.clear();
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    std::cout << "[LOG] Trace dumped: " << path << " (" << numEvents << " events)" << std::endl;
+    return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+#include "config.hpp"
+
+/**
+ * Tick phase tracer.
+ * Records begin/end spans into per-thread buffers and dumps them as Chrome trace JSON
+ * (load the file in chrome://tracing or https://ui.perfetto.dev).
+ *
+ * Recording is a no-op while the tracer is disabled, so the spans can stay in the hot path.
+ * */
+class Tracer
+{
+public:
+    static inline bool IsEnabled() { return bEnabled.load(std::memory_order_relaxed); }
+
+    static void SetEnabled(bool bEnable);
+
+    // Microseconds since the tracer epoch
+    static inline uint64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Epoch).count();
+    }
+
+    // Name shown for the calling thread in the trace viewer
+    static void SetThreadName(const char* name);
+
+    // Record complete span to the buffer of the calling thread.
+    // Name must be a string literal (Only the pointer is stored)
+    static void RecordSpan(const char* name, uint64_t beginUs, uint64_t endUs, uint32_t arg = UINT32_MAX);
+
+    // Write all recorded spans as Chrome trace JSON and clear the buffers.
+    // Must be called while no other thread is recording. (e.g. Between ticks)
+    static bool DumpChromeTrace(const char* path);
+
+private:
+    static std::atomic<bool> bEnabled;
+    static const std::chrono::steady_clock::time_point Epoch;
+};
+
+class TraceScope
+{
+public:
+    inline TraceScope(const char* name, uint32_t arg = UINT32_MAX)
+        : Name(name)
+        , Arg(arg)
+        , BeginUs(Tracer::IsEnabled() ? Tracer::Now() : 0)
+    {
+    }
+
+    inline ~TraceScope()
+    {
+        if (BeginUs != 0 && Tracer::IsEnabled()) {
+            Tracer::RecordSpan(Name, BeginUs, Tracer::Now(), Arg);
+        }
+    }
+
+private:
+    const char* Name;
+    uint32_t Arg;
+    uint64_t BeginUs;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(__VA_ARGS__)
@@ -1,11 +1,57 @@
 #pragma once
 
 #define PORT 9180
-#define MAX_SESSION 1000
+#define CLIENT_SEND_BUFFER_LIMIT (256 * 1024)           // Queued response bytes of a client before the overflow policy applies
+#define CLIENT_SEND_BUFFER_HARD_LIMIT (4 * 1024 * 1024) // Queued response bytes of a client before it is disconnected with any policy
+#define CLIENT_SEND_BUFFER_COMPACT_SIZE (64 * 1024)     // Sent prefix of a send buffer erased at once
+#define CLIENT_METRICS_REPORT_INTERVAL_SEC 5            // Period of the send backlog report (Only printed while there is a backlog)
+#define UDP_INPUT_PORT 9181 // Optional UDP channel for player input (See EnableUdpInput_v1)
+#define UDP_INPUT_MAX_REDUNDANCY 8 // Max number of recent inputs repeated in a UDP input packet
+#define INPUT_EVENT_QUEUE_SIZE 16 // Inputs a session queues between two ticks. Power of two
+#define SHM_RING_SIZE (1 << 20) // Bytes of each ring of the shared memory control channel (`--shm`). Power of two
+#define SHM_CHANNEL_MAGIC 0x474E4F50 // "PONG"
+#define SHM_CHANNEL_VERSION 1
+#ifndef MAX_SESSION
+#define MAX_SESSION 1000 // Override with -DMAX_SESSION=N (e.g. Checkpoint benchmark)
+#endif
+#define SESSION_ID_SHARD_SHIFT 20 // SessionID = (ShardID << SESSION_ID_SHARD_SHIFT) + Local ID (See `--shard`)
+#define MAX_SHARD (1u << (32 - SESSION_ID_SHARD_SHIFT))
+#define ROUTER_STATUS_INTERVAL_MS 500 // Period of the shard utilization polling of `--router`
+#define SESSION_SNAPSHOT_VERSION 3 // Layout of Session::Snapshot. Servers only import their own version
+#define CHECKPOINT_MAGIC 0x54504B43 // "CKPT"
+#define CHECKPOINT_VERSION 1 // Layout of the session checkpoint file (`--checkpoint`)
+#define CHECKPOINT_RECLAIM_TIMEOUT_SEC 60 // Recovered sessions not reclaimed by a client by then are aborted
+#define TIMING_WHEEL_SLOTS 64 // Slots of each level of the timing wheel of a reactor. Power of two
+#define TIMING_WHEEL_LEVELS 4 // Covers TIMING_WHEEL_SLOTS^TIMING_WHEEL_LEVELS ticks. Further timers are parked in the top level
+#define REPLAY_LOG_MAGIC 0x594C5052 // "RPLY"
+#define REPLAY_LOG_VERSION 4 // Layout of the replay log records (`--record`)
+#define REPLAY_BUFFER_SIZE (1 << 20) // Bytes of the record buffer of each recording thread. Power of two
+#define REPLAY_FLUSH_INTERVAL_MS 100 // Period of the replay log writer. (Records of the last period are lost on a crash)
+#define HOT_RESTART_MAGIC 0x54535248 // "HRST"
+#define HOT_RESTART_VERSION 2 // Layout of the hot restart image (`--hot-restart`). Both processes must match
+#define HOT_RESTART_FREEZE_TIMEOUT_MS 2000 // Give up the handoff if no tick boundary without queries in flight is found
+#define HOT_RESTART_ACK_TIMEOUT_MS 5000 // The old process resumes if the new one didn't take over by then
+#define HOT_RESTART_FDS_PER_MESSAGE 128 // Descriptors per SCM_RIGHTS message (Below SCM_MAX_FD)
+#define QUERY_ID_TABLE_SIZE 512 // QueryIDs must be below this (Dense dispatch table)
+#define QUERY_V2_MAX_FRAME_LENGTH (64 * 1024) // Larger v2 query frames close the connection
 #define NUM_SESSION_WORKER_THREAD 8 // Typically, twice the number of CPU cores
 // or std::min<uint32>(NUM_SESSION_WORKER_THREAD, std::thread::hardware_concurrency());
+#define MAX_REACTOR 8 // Event loop threads. Each one owns a partition of the session IDs and a share of the workers
 #define CACHE_LINE 64
 #define SERVER_TICK_RATE 30 // Per Sec
+#define STREAM_AGGREGATE_MAX_DATAGRAM 1472 // Ethernet MTU - IPv4/UDP header. Max size of an aggregated state datagram
+#define STREAM_V2_SNAPSHOT_HISTORY 32  // Ticks of sent snapshots kept as delta base of the quantized stream
+#define STREAM_V2_KEYFRAME_INTERVAL 30 // Ticks between forced keyframes of the quantized stream
+#define STREAM_HEARTBEAT_MS 250 // Max interval of the event driven stream while nothing changes (Round time)
+#define MAX_SUBSCRIBER_PER_SESSION 4096 // Spectators receiving the state stream of a session
+
+// Bot player aim error (Ratio of the paddle size). Bigger makes bots miss more often.
+#define BOT_AIM_ERROR_FACTOR 0.7f
+#define CAPACITY_REPORT_INTERVAL_SEC 5 // Capacity report period of `--bots` mode
+
+// Tick tracing (Toggle at runtime with SIGUSR1, or start enabled with `--trace <path>`)
+#define TRACE_DEFAULT_OUTPUT_PATH "pong_trace.json"
+#define TRACE_MAX_EVENTS_PER_THREAD (1 << 20)
 
 // Only support x86 or x86_64 architecture
 #if !defined(__x86_64__) && !defined(__i386__)
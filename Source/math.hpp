@@ -98,3 +98,42 @@ inline vec2 LineNormalVector(const vec2 p1, const vec2 p2, bool bClockwise = fal
     }
     return vec2::normalize(normal);
 }
+
+
+// PCG32 random number generator (https://www.pcg-random.org)
+// 16 bytes of state, so every session carries its own sequence and a replay reproduces it from the seed.
+struct Pcg32
+{
+    uint64_t State;
+    uint64_t Increment; //< Selects the stream. Always odd
+
+    inline void Seed(uint64_t seed, uint64_t stream = 0) {
+        State = 0;
+        Increment = (stream << 1) | 1;
+        Next();
+        State += seed;
+        Next();
+    }
+
+    inline uint32_t Next() {
+        const uint64_t oldState = State;
+        State = oldState * 6364136223846793005ULL + Increment;
+        const uint32_t xorShifted = (uint32_t)(((oldState >> 18) ^ oldState) >> 27);
+        const uint32_t rotation = (uint32_t)(oldState >> 59);
+        return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+    }
+
+    // Uniform in [0, 1]
+    inline float NextUnit() {
+        return (float)(Next() & 0xFFFF) / 0xFFFF;
+    }
+};
+
+// Spread a seed over all bits (SplitMix64), so that consecutive seeds start unrelated sequences
+inline uint64_t MixSeed(uint64_t seed)
+{
+    seed += 0x9E3779B97F4A7C15ULL;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+    return seed ^ (seed >> 31);
+}
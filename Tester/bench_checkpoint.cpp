@@ -0,0 +1,202 @@
+/**
+ * Benchmark of the session checkpoint. (`--checkpoint`)
+ * Runs N sessions through Session::Simulate() and saves each one to a checkpoint file after its tick, like the session workers do.
+ * Then drops the sessions without freeing their slots, as a crash would, and recovers them from the file like a restarted server.
+ *
+ * Reports the checkpoint cost per tick next to the simulation cost, and the recovery time.
+ * The recovered sessions are compared with the state saved at the last tick.
+ *
+ * Build: g++ -std=c++17 -O2 -DMAX_SESSION=10000 Tester/bench_checkpoint.cpp Source/Session.cpp Source/Checkpoint.cpp Source/Recorder.cpp Source/Helper.cpp -o bench_checkpoint -lpthread
+ * Run:   ./bench_checkpoint [--sessions N] [--ticks T] [--file <path>]
+ * */
+#include <iostream>
+#include <algorithm>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../Source/Session.hpp"
+#include "../Source/Checkpoint.hpp"
+
+#define DEFAULT_NUM_SESSION MAX_SESSION
+#define DEFAULT_NUM_TICK 300
+#define DEFAULT_CHECKPOINT_PATH "bench_checkpoint.bin"
+#define BENCH_RANDOM_SEED 42
+#define INPUT_TOGGLE_INTERVAL_TICK 7 // Scripted players flip their paddle direction at this interval
+
+static int64_t ElapsedNs(std::chrono::steady_clock::time_point beginTime)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - beginTime).count();
+}
+
+// Same session state, except the wall time since the last tick
+static bool IsSameState(const Session::Snapshot& expected, const Session::Snapshot& actual)
+{
+    Session::Snapshot lhs = expected;
+    Session::Snapshot rhs = actual;
+    lhs.SinceLastTickUs = 0;
+    rhs.SinceLastTickUs = 0;
+    return memcmp(&lhs, &rhs, sizeof(lhs)) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    int         numSession = DEFAULT_NUM_SESSION;
+    int         numTick = DEFAULT_NUM_TICK;
+    const char* checkpointPath = DEFAULT_CHECKPOINT_PATH;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc) {
+            numSession = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            numTick = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--sessions N] [--ticks T] [--file <path>]" << std::endl;
+            return 1;
+        }
+    }
+    if (numSession <= 0 || numSession > MAX_SESSION || numTick <= 0) {
+        std::cerr << "sessions must be in [1, " << MAX_SESSION << "] (Build with -DMAX_SESSION=N for more) and ticks must be positive" << std::endl;
+        return 1;
+    }
+
+    // Start from an empty file
+    unlink(checkpointPath);
+
+    Session::InitSessionIdPool();
+    Session::SetServerSeed(BENCH_RANDOM_SEED);
+
+    Checkpoint* checkpoint = new Checkpoint();
+    if (!checkpoint->Open(checkpointPath, 0)) {
+        return 1;
+    }
+
+    // Sessions don't stream. (Only the simulation and the checkpoint are measured)
+    sockaddr_in noStreamAddr;
+    memset(&noStreamAddr, 0, sizeof(noStreamAddr));
+    noStreamAddr.sin_family = AF_INET;
+    noStreamAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::vector<Session*> sessions;
+    sessions.reserve(numSession);
+    for (int i = 0; i < numSession; i++) {
+        Session* session = new Session(nullptr, 800, 400, UINT32_MAX, UINT32_MAX / 1000, 400, 20, 600, 150, 100, -1, noStreamAddr, 0);
+        session->BeginRound();
+        sessions.push_back(session);
+    }
+
+    /* ------------------------------ Checkpoint Cost ------------------------------ */
+    // Like a session worker, every session is saved right after its tick. The cost is the difference to ticks without saving.
+    const std::chrono::milliseconds tickDuration(1000 / SERVER_TICK_RATE);
+    int64_t simulateNs = 0;
+    int64_t simulateSaveNs = 0;
+    int64_t sweepNs = 0;
+    for (int tick = 0; tick < numTick * 2; tick++)
+    {
+        // Alternate the two kinds of ticks, so that both see the same game states
+        const bool bSave = (tick % 2 == 1);
+
+        std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < numSession; i++)
+        {
+            Session* session = sessions[i];
+
+            const int phase = tick / 2 + i;
+            if (phase % INPUT_TOGGLE_INTERVAL_TICK == 0) {
+                const Session::InputKey key = ((phase / INPUT_TOGGLE_INTERVAL_TICK) % 2 == 0) ? Session::InputKey::Left : Session::InputKey::Right;
+                session->SetPlayerInput(Session::PlayerID::PlayerA, key, Session::InputType::Press);
+                session->SetPlayerInput(Session::PlayerID::PlayerB, key, Session::InputType::Press);
+            }
+            session->Simulate(tickDuration);
+
+            if (bSave) {
+                checkpoint->Save(*session);
+            }
+        }
+        (bSave ? simulateSaveNs : simulateNs) += ElapsedNs(beginTime);
+
+        if (bSave) {
+            beginTime = std::chrono::steady_clock::now();
+            checkpoint->Sweep(0);
+            sweepNs += ElapsedNs(beginTime);
+        }
+    }
+    const int64_t saveNs = std::max<int64_t>(0, simulateSaveNs - simulateNs);
+
+    const double fileSizeMB = (double)(sizeof(CheckpointHeader) + sizeof(CheckpointSlot) * MAX_SESSION) / (1024 * 1024);
+    std::cout << "sessions=" << numSession << " ticks=" << numTick << " tickRate=" << SERVER_TICK_RATE
+              << " slot=" << sizeof(CheckpointSlot) << "B file=" << std::fixed << std::setprecision(1) << fileSizeMB << "MB" << std::endl;
+    std::cout << "simulate:   " << std::setw(8) << std::setprecision(1) << (double)simulateNs / ((double)numSession * numTick) << " ns/session-tick  "
+              << std::setw(8) << (double)simulateNs / numTick / 1000 << " us/tick" << std::endl;
+    std::cout << "checkpoint: " << std::setw(8) << (double)saveNs / ((double)numSession * numTick) << " ns/session-tick  "
+              << std::setw(8) << (double)saveNs / numTick / 1000 << " us/tick" << std::endl;
+    std::cout << "sweep:      " << std::setw(8) << (double)sweepNs / numTick / 1000 << " us/tick" << std::endl;
+    std::cout << "checkpoint share of the tick budget (" << 1000000 / SERVER_TICK_RATE << "us): "
+              << std::setprecision(2) << 100.0 * ((double)(saveNs + sweepNs) / numTick) / (1000000000.0 / SERVER_TICK_RATE) << "% on one core" << std::endl;
+
+    /* ---------------------------------- Crash ---------------------------------- */
+    // The state the recovered sessions must have
+    std::vector<Session::Snapshot> expected(numSession);
+    std::vector<uint32_t> sessionIDs(numSession);
+    for (int i = 0; i < numSession; i++) {
+        sessions[i]->SaveSnapshot(expected[i]);
+        sessionIDs[i] = sessions[i]->GetSessionID();
+    }
+
+    // Nothing is freed in the file, like a killed process
+    for (Session* session : sessions) {
+        delete session;
+    }
+    sessions.clear();
+    delete checkpoint;
+    Session::InitSessionIdPool();
+
+    /* --------------------------------- Recovery -------------------------------- */
+    const std::chrono::steady_clock::time_point recoverBeginTime = std::chrono::steady_clock::now();
+    checkpoint = new Checkpoint();
+    if (!checkpoint->Open(checkpointPath, 0)) {
+        return 1;
+    }
+    const int64_t openNs = ElapsedNs(recoverBeginTime);
+
+    for (uint32_t i = 0; i < MAX_SESSION; i++)
+    {
+        Session::Snapshot snapshot;
+        if (!checkpoint->Load(i, snapshot) || !Session::ReserveSessionId(i)) {
+            continue;
+        }
+        sessions.push_back(new Session(nullptr, snapshot, -1));
+    }
+    const int64_t recoverNs = ElapsedNs(recoverBeginTime);
+
+    int numVerified = 0;
+    for (int i = 0; i < numSession; i++) {
+        Session* session = Session::FindSession(sessionIDs[i]);
+        Session::Snapshot actual;
+        if (session != nullptr) {
+            session->SaveSnapshot(actual);
+            numVerified += IsSameState(expected[i], actual) ? 1 : 0;
+        }
+    }
+
+    std::cout << "recovery:   " << std::setw(8) << std::setprecision(1) << (double)recoverNs / 1000 << " us total (open + scan " << (double)openNs / 1000 << " us, "
+              << std::setprecision(1) << (double)recoverNs / std::max<size_t>(1, sessions.size()) << " ns/session)" << std::endl;
+    std::cout << "recovered " << sessions.size() << "/" << numSession << " sessions, " << numVerified << " with the state of the last tick" << std::endl;
+
+    for (Session* session : sessions) {
+        delete session;
+    }
+    delete checkpoint;
+    unlink(checkpointPath);
+
+    return (numVerified == numSession) ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+/**
+ * Headless benchmark of the session simulation core.
+ * Runs N sessions through Session::Simulate() with a fixed tick step and scripted inputs,
+ * without any TCP client. The object state stream goes to a local UDP sink that is never read.
+ * With --record, the sessions are also recorded to a replay log. (Compare with a run without it for the recording cost)
+ *
+ * Build: g++ -std=c++17 -O2 Tester/bench_session.cpp Source/Session.cpp Source/Recorder.cpp Source/Helper.cpp -o bench_session -lpthread
+ * Run:   ./bench_session [--sessions N] [--ticks T] [--no-send] [--record <path>]
+ * */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../Source/Session.hpp"
+#include "../Source/Recorder.hpp"
+
+#define DEFAULT_NUM_SESSION MAX_SESSION
+#define DEFAULT_NUM_TICK 300
+#define BENCH_RANDOM_SEED 42
+#define INPUT_TOGGLE_INTERVAL_TICK 7 // Scripted players flip their paddle direction at this interval
+
+struct BenchParam
+{
+    uint32_t BallSpeed;
+    uint32_t BallRadius;
+    uint32_t FieldWidth;
+    uint32_t FieldHeight;
+    uint32_t PaddleSize;
+};
+
+struct BenchResult
+{
+    double   NsPerSessionTick;
+    double   CollisionIterPerTick;
+    uint64_t NumRoundEnded;
+};
+
+static BenchResult RunBench(const BenchParam& benchParam, int numSession, int numTick, bool bSend, int udpSinkSocket, sockaddr_in sinkAddr)
+{
+    const std::chrono::milliseconds tickDuration(1000 / SERVER_TICK_RATE);
+
+    std::vector<Session*> sessions;
+    sessions.reserve(numSession);
+    for (int i = 0; i < numSession; i++)
+    {
+        Session* session = new Session(nullptr,
+                                       benchParam.FieldWidth,
+                                       benchParam.FieldHeight,
+                                       UINT32_MAX,   //< WinScore (Never ends)
+                                       UINT32_MAX / 1000, //< GameTime (Never times out)
+                                       benchParam.BallSpeed,
+                                       benchParam.BallRadius,
+                                       600,          //< PaddleSpeed
+                                       benchParam.PaddleSize,
+                                       100,          //< PaddleOffsetFromWall
+                                       udpSinkSocket,
+                                       sinkAddr,
+                                       sinkAddr.sin_port);
+        session->BeginRound();
+        sessions.push_back(session);
+    }
+
+    uint64_t numRoundEnded = 0;
+
+    int64_t totalNs = 0;
+    for (int tick = 0; tick < numTick; tick++)
+    {
+        const std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < numSession; i++)
+        {
+            Session* session = sessions[i];
+
+            // Scripted input. Each session is phase shifted so that not all paddles turn on the same tick.
+            const int phase = tick + i;
+            if (phase % INPUT_TOGGLE_INTERVAL_TICK == 0) {
+                const Session::InputKey key = ((phase / INPUT_TOGGLE_INTERVAL_TICK) % 2 == 0) ? Session::InputKey::Left : Session::InputKey::Right;
+                session->SetPlayerInput(Session::PlayerID::PlayerA, key, Session::InputType::Press);
+                session->SetPlayerInput(Session::PlayerID::PlayerB, key, Session::InputType::Press);
+            }
+
+            session->Simulate(tickDuration);
+            if (bSend) {
+                session->SendObjectState();
+            }
+
+            // Keep every session busy
+            if (!session->IsRoundRunning()) {
+                numRoundEnded += 1;
+                session->BeginRound();
+            }
+        }
+        totalNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - beginTime).count();
+
+        // The ticks run back to back, much faster than the writer thread of the server is paced for. (Not measured, it runs on another core)
+        if (Recorder::IsEnabled()) {
+            Recorder::Flush();
+        }
+    }
+
+    uint64_t totalCollisionIter = 0;
+    for (Session* session : sessions) {
+        totalCollisionIter += session->GetCollisionIterationCount();
+        delete session;
+    }
+
+    BenchResult result;
+    result.NsPerSessionTick = (double)totalNs / ((double)numSession * numTick);
+    result.CollisionIterPerTick = (double)totalCollisionIter / ((double)numSession * numTick);
+    result.NumRoundEnded = numRoundEnded;
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int  numSession = DEFAULT_NUM_SESSION;
+    int  numTick = DEFAULT_NUM_TICK;
+    bool bSend = true;
+    const char* recordPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc) {
+            numSession = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            numTick = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-send") == 0) {
+            bSend = false;
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--sessions N] [--ticks T] [--no-send] [--record <path>]" << std::endl;
+            return 1;
+        }
+    }
+    if (numSession <= 0 || numSession > MAX_SESSION || numTick <= 0) {
+        std::cerr << "sessions must be in [1, " << MAX_SESSION << "] and ticks must be positive" << std::endl;
+        return 1;
+    }
+
+    // Dummy UDP sink. Bound but never read, so the kernel drops the datagrams once its buffer is full.
+    int udpSinkSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udpSinkSocket == -1) {
+        std::cerr << "Failed to create UDP socket" << std::endl;
+        return 1;
+    }
+
+    sockaddr_in sinkAddr;
+    memset(&sinkAddr, 0, sizeof(sinkAddr));
+    sinkAddr.sin_family = AF_INET;
+    sinkAddr.sin_port = 0;
+    sinkAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t sinkAddrLen = sizeof(sinkAddr);
+    if (bind(udpSinkSocket, (sockaddr*)&sinkAddr, sizeof(sinkAddr)) == -1
+        || getsockname(udpSinkSocket, (sockaddr*)&sinkAddr, &sinkAddrLen) == -1) {
+        std::cerr << "Failed to bind UDP socket" << std::endl;
+        close(udpSinkSocket);
+        return 1;
+    }
+
+    Session::InitSessionIdPool();
+
+    // Same ball directions for every run. (Session RNGs are derived from the server seed in the order of creation)
+    Session::SetServerSeed(BENCH_RANDOM_SEED);
+    if (recordPath != nullptr && !Recorder::Open(recordPath, SERVER_TICK_RATE, BENCH_RANDOM_SEED, 0)) {
+        close(udpSinkSocket);
+        return 1;
+    }
+
+    const uint32_t ballSpeeds[]  = { 200, 400, 800, 1600 };
+    const uint32_t ballRadii[]   = { 10, 30 };
+    const uint32_t fieldSizes[][2] = { { 800, 400 }, { 1600, 800 } };
+    const uint32_t paddleSizes[] = { 100, 200 };
+
+    std::cout << "sessions=" << numSession << " ticks=" << numTick << " tickRate=" << SERVER_TICK_RATE << " send=" << (bSend ? "on" : "off") << " record=" << (recordPath != nullptr ? "on" : "off") << std::endl;
+    std::cout << std::setw(10) << "BallSpeed" << std::setw(8) << "Radius" << std::setw(12) << "Field" << std::setw(8) << "Paddle"
+              << std::setw(14) << "ns/sess-tick" << std::setw(14) << "collIter/tick" << std::setw(10) << "rounds" << std::endl;
+
+    double sumNsPerSessionTick = 0.0;
+    int numBench = 0;
+    for (uint32_t ballSpeed : ballSpeeds) {
+        for (uint32_t ballRadius : ballRadii) {
+            for (const auto& fieldSize : fieldSizes) {
+                for (uint32_t paddleSize : paddleSizes) {
+                    const BenchParam benchParam = { ballSpeed, ballRadius, fieldSize[0], fieldSize[1], paddleSize };
+                    const BenchResult result = RunBench(benchParam, numSession, numTick, bSend, udpSinkSocket, sinkAddr);
+
+                    const std::string field = std::to_string(fieldSize[0]) + "x" + std::to_string(fieldSize[1]);
+                    std::cout << std::setw(10) << ballSpeed << std::setw(8) << ballRadius << std::setw(12) << field << std::setw(8) << paddleSize
+                              << std::setw(14) << std::fixed << std::setprecision(1) << result.NsPerSessionTick
+                              << std::setw(14) << std::setprecision(3) << result.CollisionIterPerTick
+                              << std::setw(10) << result.NumRoundEnded << std::endl;
+
+                    sumNsPerSessionTick += result.NsPerSessionTick;
+                    numBench += 1;
+                }
+            }
+        }
+    }
+
+    std::cout << "mean ns/session-tick: " << std::setprecision(1) << sumNsPerSessionTick / numBench << std::endl;
+
+    Recorder::Flush();
+    close(udpSinkSocket);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/bash
+# Hot restart of the server under load. The load generator must not see a disconnect or a failed query.
+# Run from the repository root: ./Tester/hot_restart_test.sh [num restarts] [loadgen options...]
+
+NUM_RESTART=${1:-2}
+shift
+HOT_RESTART_SOCKET=/tmp/pong_hot_restart.sock
+
+echo "Building server and loadgen"
+g++ -std=c++17 -O2 Source/*.cpp -o server -lpthread || exit 1
+g++ -std=c++17 -O2 Tester/loadgen.cpp -o loadgen -lpthread || exit 1
+
+./server --hot-restart $HOT_RESTART_SOCKET > hot_restart0.log 2>&1 &
+sleep 0.5
+
+DURATION=$((NUM_RESTART * 5 + 5))
+./loadgen --conns 150 --duration $DURATION "$@" &
+LOADGEN_PID=$!
+
+# Every new process takes over from the previous one, which exits
+for i in $(seq 1 $NUM_RESTART); do
+    sleep 5
+    echo "---- Restart $i ----"
+    ./server --hot-restart $HOT_RESTART_SOCKET > hot_restart$i.log 2>&1 &
+    LAST_PID=$!
+done
+
+wait $LOADGEN_PID
+RESULT=$?
+
+echo
+echo "---- Handoffs ----"
+grep -h "Handed off\|Took over\|Hot restart" hot_restart*.log
+
+kill $LAST_PID
+exit $RESULT
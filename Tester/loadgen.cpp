@@ -0,0 +1,574 @@
+/**
+ * Closed-loop load generator.
+ * Opens many control connections across threads. Each connection owns one session, plays it with
+ * randomized human-like ActionPlayerInput_v1 streams, and begins a new round whenever one ends.
+ *
+ * Measured:
+ *  - Query round-trip latency (ActionPlayerInput_v1, BeginRound_v1)
+ *  - UDP object state stream inter-packet gap, jitter and estimated drop rate
+ *    (A gap of k tick intervals counts as k - 1 dropped packets)
+ *    Also per session, reported as the distribution across sessions and the worst sessions,
+ *    since a few starved sessions hardly move the totals.
+ *
+ * Build: g++ -std=c++17 -O2 Tester/loadgen.cpp -o loadgen -lpthread
+ * Run:   ./loadgen [--host 127.0.0.1] [--port 9180] [--threads 4] [--conns 200] [--duration 30] [--input-rate 4]
+ * */
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../Source/config.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+struct LoadGenOption
+{
+    const char* Host      = "127.0.0.1";
+    uint16_t    Port      = PORT;
+    int         NumThread = 4;
+    int         NumConn   = 200;
+    int         Duration  = 30;   // Sec
+    double      InputRate = 4.0;  // Key presses per second per player
+    uint32_t    Seed      = 0;
+};
+
+// Latency samples in microseconds
+struct LatencyStat
+{
+    std::vector<uint32_t> Samples;
+
+    inline void Add(Clock::duration d) {
+        Samples.push_back((uint32_t)std::min<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count(), UINT32_MAX));
+    }
+
+    inline void Merge(const LatencyStat& rhs) {
+        Samples.insert(Samples.end(), rhs.Samples.begin(), rhs.Samples.end());
+    }
+
+    void Print(const char* name) {
+        if (Samples.empty()) {
+            std::cout << std::setw(22) << std::left << name << std::right << " (no samples)" << std::endl;
+            return;
+        }
+        std::sort(Samples.begin(), Samples.end());
+        auto percentile = [&](double p) -> uint32_t {
+            return Samples[std::min<size_t>(Samples.size() - 1, (size_t)(p * Samples.size()))];
+        };
+        std::cout << std::setw(22) << std::left << name << std::right
+                  << " n=" << std::setw(9) << Samples.size()
+                  << " p50=" << std::setw(7) << percentile(0.50)
+                  << " p90=" << std::setw(7) << percentile(0.90)
+                  << " p99=" << std::setw(7) << percentile(0.99)
+                  << " p99.9=" << std::setw(7) << percentile(0.999)
+                  << " max=" << std::setw(8) << Samples.back() << " (us)" << std::endl;
+    }
+};
+
+// UDP object state stream of one session
+struct StreamStat
+{
+    uint32_t SessionID       = 0;
+    double   SumJitterUs     = 0.0;
+    uint64_t NumJitterSample = 0;
+    uint32_t MaxGapUs        = 0;
+    uint64_t NumUdpRecv      = 0;
+    uint64_t NumUdpDropped   = 0;
+
+    inline double GetMeanJitterUs() const {
+        return (NumJitterSample == 0) ? 0.0 : SumJitterUs / NumJitterSample;
+    }
+
+    inline double GetDropRate() const {
+        return (NumUdpRecv == 0) ? 0.0 : (double)NumUdpDropped / (NumUdpRecv + NumUdpDropped);
+    }
+};
+
+// Distribution of a per-session value across sessions
+static void PrintSessionDistribution(const char* name, std::vector<double> values, const char* unit)
+{
+    if (values.empty()) {
+        std::cout << std::setw(22) << std::left << name << std::right << " (no sessions)" << std::endl;
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    auto percentile = [&](double p) -> double {
+        return values[std::min<size_t>(values.size() - 1, (size_t)(p * values.size()))];
+    };
+    std::cout << std::setw(22) << std::left << name << std::right
+              << " n=" << std::setw(9) << values.size()
+              << " p50=" << std::setw(7) << percentile(0.50)
+              << " p90=" << std::setw(7) << percentile(0.90)
+              << " p99=" << std::setw(7) << percentile(0.99)
+              << " max=" << std::setw(8) << values.back() << " (" << unit << ")" << std::endl;
+}
+
+struct ThreadStat
+{
+    LatencyStat InputRtt;
+    LatencyStat BeginRoundRtt;
+    LatencyStat UdpGap;
+    double      SumJitterUs       = 0.0;
+    uint64_t    NumJitterSample   = 0;
+    uint64_t    NumQuerySent      = 0;
+    uint64_t    NumResponse       = 0;
+    uint64_t    NumUdpRecv        = 0;
+    uint64_t    NumUdpDropped     = 0;
+    uint64_t    NumRoundEnded     = 0;
+    uint64_t    NumError          = 0;
+
+    std::vector<StreamStat> Streams;
+};
+
+// One control connection owning one session.
+// (The v1 BeginRound response and the round result share QueryID 201, so one session per connection
+//  keeps the response stream unambiguous)
+struct Conn
+{
+    int      TcpSocket = -1;
+    int      UdpSocket = -1;
+    uint32_t SessionID = 0;
+    bool     bRoundRunning = false;
+
+    std::vector<char> RecvBuffer;
+
+    // Sent queries awaiting response, in order
+    struct PendingQuery { uint32_t QueryID; Clock::time_point SentTime; };
+    std::deque<PendingQuery> PendingQueries;
+
+    // Scripted player state
+    struct PlayerState { bool bHolding = false; uint8_t Key = 0; Clock::time_point NextActionTime; };
+    PlayerState Players[2];
+
+    // UDP stream state of current round
+    Clock::time_point LastUdpTime;
+    uint64_t          NumUdpInRound = 0;
+
+    StreamStat Stream;
+};
+
+static bool SendAll(int socket, const void* data, size_t size)
+{
+    size_t offset = 0;
+    while (offset < size) {
+        const ssize_t n = send(socket, (const char*)data + offset, size - offset, 0);
+        if (n <= 0) {
+            return false;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+static bool RecvAll(int socket, void* data, size_t size)
+{
+    size_t offset = 0;
+    while (offset < size) {
+        const ssize_t n = recv(socket, (char*)data + offset, size - offset, 0);
+        if (n <= 0) {
+            return false;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+static bool SetupConn(Conn& conn, const LoadGenOption& option)
+{
+    // Open UDP receiving socket
+    conn.UdpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (conn.UdpSocket == -1) {
+        return false;
+    }
+    sockaddr_in udpAddr;
+    memset(&udpAddr, 0, sizeof(udpAddr));
+    udpAddr.sin_family = AF_INET;
+    udpAddr.sin_port = 0;
+    udpAddr.sin_addr.s_addr = INADDR_ANY;
+    socklen_t udpAddrLen = sizeof(udpAddr);
+    if (bind(conn.UdpSocket, (sockaddr*)&udpAddr, sizeof(udpAddr)) == -1
+        || getsockname(conn.UdpSocket, (sockaddr*)&udpAddr, &udpAddrLen) == -1) {
+        return false;
+    }
+
+    // Connect control channel
+    conn.TcpSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn.TcpSocket == -1) {
+        return false;
+    }
+    int opt = 1;
+    setsockopt(conn.TcpSocket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(option.Port);
+    serverAddr.sin_addr.s_addr = inet_addr(option.Host);
+    if (connect(conn.TcpSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
+        return false;
+    }
+
+    // CreateSession_v1 (blocking)
+    struct __attribute__((packed)) CreateSession_Param
+    {
+        uint32_t QueryID = 101;
+        uint32_t FieldWidth = 800;
+        uint32_t FieldHeight = 400;
+        uint32_t WinScore = 5;
+        uint32_t GameTime;
+        uint32_t BallSpeed = 400;
+        uint32_t BallRadius = 20;
+        uint32_t PaddleSpeed = 600;
+        uint32_t PaddleSize = 150;
+        uint32_t PaddleOffsetFromWall = 100;
+        uint16_t UdpPort_Recv_Stream;
+    } param;
+    param.GameTime = option.Duration + 5;
+    param.UdpPort_Recv_Stream = udpAddr.sin_port;
+
+    struct __attribute__((packed)) CreateSession_Response
+    {
+        uint32_t QueryID;
+        uint8_t Result;
+        uint32_t SessionID;
+    } response;
+
+    if (!SendAll(conn.TcpSocket, &param, sizeof(param)) || !RecvAll(conn.TcpSocket, &response, sizeof(response))) {
+        return false;
+    }
+    if (response.QueryID != 101 || response.Result != 0) {
+        return false;
+    }
+    conn.SessionID = response.SessionID;
+
+    fcntl(conn.TcpSocket, F_SETFL, fcntl(conn.TcpSocket, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(conn.UdpSocket, F_SETFL, fcntl(conn.UdpSocket, F_GETFL, 0) | O_NONBLOCK);
+    return true;
+}
+
+static void SendQuery(Conn& conn, ThreadStat& stat, uint32_t queryID, const void* data, size_t size)
+{
+    // Queries are tiny, the socket buffer never fills in practice. Treat it as an error if it does.
+    if (!SendAll(conn.TcpSocket, data, size)) {
+        stat.NumError += 1;
+        return;
+    }
+    conn.PendingQueries.push_back({ queryID, Clock::now() });
+    stat.NumQuerySent += 1;
+}
+
+static void SendBeginRound(Conn& conn, ThreadStat& stat)
+{
+    struct __attribute__((packed)) BeginRound_Param
+    {
+        uint32_t QueryID = 201;
+        uint32_t SessionID;
+    } param;
+    param.SessionID = conn.SessionID;
+    SendQuery(conn, stat, 201, &param, sizeof(param));
+}
+
+// Parse all complete responses in the receive buffer
+static void HandleResponses(Conn& conn, ThreadStat& stat)
+{
+    size_t offset = 0;
+    while (true)
+    {
+        uint32_t queryID;
+        if (conn.RecvBuffer.size() - offset < sizeof(queryID)) {
+            break;
+        }
+        memcpy(&queryID, conn.RecvBuffer.data() + offset, sizeof(queryID));
+
+        // Round result (201 + WinPlayer) can only arrive while the round is running and no BeginRound is pending
+        const bool bRoundResult = (queryID == 201) && conn.bRoundRunning
+            && std::none_of(conn.PendingQueries.begin(), conn.PendingQueries.end(), [](const Conn::PendingQuery& q) { return q.QueryID == 201; });
+        const size_t responseSize = bRoundResult ? 8 : 5;
+        if (conn.RecvBuffer.size() - offset < responseSize) {
+            break;
+        }
+
+        if (bRoundResult) {
+            conn.bRoundRunning = false;
+            stat.NumRoundEnded += 1;
+            conn.NumUdpInRound = 0;
+            SendBeginRound(conn, stat);
+        }
+        else {
+            const uint8_t result = (uint8_t)conn.RecvBuffer[offset + 4];
+            if (conn.PendingQueries.empty() || conn.PendingQueries.front().QueryID != queryID) {
+                stat.NumError += 1;
+            }
+            else {
+                const Conn::PendingQuery pending = conn.PendingQueries.front();
+                conn.PendingQueries.pop_front();
+                LatencyStat& latencyStat = (queryID == 201) ? stat.BeginRoundRtt : stat.InputRtt;
+                latencyStat.Add(Clock::now() - pending.SentTime);
+                stat.NumResponse += 1;
+
+                if (result != 0) {
+                    stat.NumError += 1;
+                }
+                else if (queryID == 201) {
+                    conn.bRoundRunning = true;
+                }
+            }
+        }
+        offset += responseSize;
+    }
+    conn.RecvBuffer.erase(conn.RecvBuffer.begin(), conn.RecvBuffer.begin() + offset);
+}
+
+static void RunThread(const LoadGenOption& option, int threadIdx, int numConn, ThreadStat& stat)
+{
+    const double tickIntervalUs = 1000.0 * (1000 / SERVER_TICK_RATE);
+    const double meanIdleSec = 1.0 / option.InputRate;
+
+    std::mt19937 rng(option.Seed + threadIdx);
+    std::exponential_distribution<double> idleDist(1.0 / meanIdleSec);
+    std::uniform_int_distribution<int> holdMsDist(80, 400);
+    std::uniform_int_distribution<int> keyDist(1, 2);
+
+    std::vector<Conn> conns(numConn);
+    for (Conn& conn : conns) {
+        if (!SetupConn(conn, option)) {
+            std::cerr << "[thread " << threadIdx << "] Failed to set up connection. errno: " << errno << std::endl;
+            stat.NumError += 1;
+            return;
+        }
+    }
+
+    const Clock::time_point beginTime = Clock::now();
+    const Clock::time_point endTime = beginTime + std::chrono::seconds(option.Duration);
+    for (Conn& conn : conns) {
+        SendBeginRound(conn, stat);
+        for (Conn::PlayerState& player : conn.Players) {
+            player.NextActionTime = beginTime + std::chrono::microseconds((int64_t)(idleDist(rng) * 1e6));
+        }
+    }
+
+    std::vector<pollfd> pollFds(numConn * 2);
+    for (int i = 0; i < numConn; i++) {
+        pollFds[i * 2]     = { conns[i].TcpSocket, POLLIN, 0 };
+        pollFds[i * 2 + 1] = { conns[i].UdpSocket, POLLIN, 0 };
+    }
+
+    while (Clock::now() < endTime)
+    {
+        if (poll(pollFds.data(), pollFds.size(), 1) == -1) {
+            break;
+        }
+
+        const Clock::time_point nowTime = Clock::now();
+        for (int i = 0; i < numConn; i++)
+        {
+            Conn& conn = conns[i];
+
+            // Control responses
+            if (pollFds[i * 2].revents & POLLIN) {
+                char buffer[4096];
+                const ssize_t n = recv(conn.TcpSocket, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    conn.RecvBuffer.insert(conn.RecvBuffer.end(), buffer, buffer + n);
+                    HandleResponses(conn, stat);
+                }
+            }
+
+            // Object state stream
+            if (pollFds[i * 2 + 1].revents & POLLIN) {
+                char datagram[1500];
+                while (recv(conn.UdpSocket, datagram, sizeof(datagram), 0) > 0)
+                {
+                    const Clock::time_point arrivalTime = Clock::now();
+                    stat.NumUdpRecv += 1;
+                    if (conn.NumUdpInRound != 0) {
+                        const Clock::duration gap = arrivalTime - conn.LastUdpTime;
+                        const double gapUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(gap).count();
+                        stat.UdpGap.Add(gap);
+                        stat.SumJitterUs += std::abs(gapUs - tickIntervalUs);
+                        stat.NumJitterSample += 1;
+                        stat.NumUdpDropped += (uint64_t)std::max<int64_t>(0, std::llround(gapUs / tickIntervalUs) - 1);
+
+                        conn.Stream.SumJitterUs += std::abs(gapUs - tickIntervalUs);
+                        conn.Stream.NumJitterSample += 1;
+                        conn.Stream.MaxGapUs = std::max(conn.Stream.MaxGapUs, (uint32_t)std::min<double>(gapUs, UINT32_MAX));
+                        conn.Stream.NumUdpDropped += (uint64_t)std::max<int64_t>(0, std::llround(gapUs / tickIntervalUs) - 1);
+                    }
+                    conn.Stream.NumUdpRecv += 1;
+                    conn.LastUdpTime = arrivalTime;
+                    conn.NumUdpInRound += 1;
+                }
+            }
+
+            // Scripted players
+            if (!conn.bRoundRunning) {
+                continue;
+            }
+            for (uint32_t playerIdx = 0; playerIdx < 2; playerIdx++)
+            {
+                Conn::PlayerState& player = conn.Players[playerIdx];
+                if (nowTime < player.NextActionTime) {
+                    continue;
+                }
+
+                struct __attribute__((packed)) ActionPlayerInput_Param
+                {
+                    uint32_t QueryID = 301;
+                    uint32_t SessionID;
+                    uint32_t PlayerID;
+                    uint8_t  InputKey;
+                    uint8_t  InputType;
+                } param;
+                param.SessionID = conn.SessionID;
+                param.PlayerID = playerIdx + 1;
+
+                if (player.bHolding) {
+                    param.InputKey = player.Key;
+                    param.InputType = 2; // Release
+                    player.bHolding = false;
+                    player.NextActionTime = nowTime + std::chrono::microseconds((int64_t)(idleDist(rng) * 1e6));
+                }
+                else {
+                    player.Key = (uint8_t)keyDist(rng);
+                    param.InputKey = player.Key;
+                    param.InputType = 1; // Press
+                    player.bHolding = true;
+                    player.NextActionTime = nowTime + std::chrono::milliseconds(holdMsDist(rng));
+                }
+                SendQuery(conn, stat, 301, &param, sizeof(param));
+            }
+        }
+    }
+
+    for (Conn& conn : conns) {
+        conn.Stream.SessionID = conn.SessionID;
+        stat.Streams.push_back(conn.Stream);
+        close(conn.TcpSocket);
+        close(conn.UdpSocket);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    LoadGenOption option;
+    option.Seed = (uint32_t)time(nullptr);
+    for (int i = 1; i < argc; i++) {
+        const bool bHasValue = (i + 1 < argc);
+        if (strcmp(argv[i], "--host") == 0 && bHasValue) {
+            option.Host = argv[++i];
+        }
+        else if (strcmp(argv[i], "--port") == 0 && bHasValue) {
+            option.Port = (uint16_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && bHasValue) {
+            option.NumThread = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--conns") == 0 && bHasValue) {
+            option.NumConn = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--duration") == 0 && bHasValue) {
+            option.Duration = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--input-rate") == 0 && bHasValue) {
+            option.InputRate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && bHasValue) {
+            option.Seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--host H] [--port P] [--threads T] [--conns C] [--duration SEC] [--input-rate HZ] [--seed S]" << std::endl;
+            return 1;
+        }
+    }
+    if (option.NumThread <= 0 || option.NumConn < option.NumThread || option.Duration <= 0 || option.InputRate <= 0.0) {
+        std::cerr << "Invalid option" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Load: " << option.NumConn << " connections/sessions on " << option.NumThread << " threads for " << option.Duration
+              << "s, " << option.InputRate << " presses/s per player" << std::endl;
+
+    std::vector<ThreadStat> threadStats(option.NumThread);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < option.NumThread; i++) {
+        const int numConn = option.NumConn / option.NumThread + ((i < option.NumConn % option.NumThread) ? 1 : 0);
+        threads.emplace_back(RunThread, std::cref(option), i, numConn, std::ref(threadStats[i]));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    ThreadStat total;
+    for (const ThreadStat& stat : threadStats) {
+        total.InputRtt.Merge(stat.InputRtt);
+        total.BeginRoundRtt.Merge(stat.BeginRoundRtt);
+        total.UdpGap.Merge(stat.UdpGap);
+        total.SumJitterUs     += stat.SumJitterUs;
+        total.NumJitterSample += stat.NumJitterSample;
+        total.NumQuerySent    += stat.NumQuerySent;
+        total.NumResponse     += stat.NumResponse;
+        total.NumUdpRecv      += stat.NumUdpRecv;
+        total.NumUdpDropped   += stat.NumUdpDropped;
+        total.NumRoundEnded   += stat.NumRoundEnded;
+        total.NumError        += stat.NumError;
+        total.Streams.insert(total.Streams.end(), stat.Streams.begin(), stat.Streams.end());
+    }
+
+    const double duration = option.Duration;
+    const double dropRate = (total.NumUdpRecv == 0) ? 0.0 : (double)total.NumUdpDropped / (total.NumUdpRecv + total.NumUdpDropped);
+
+    std::cout << std::endl << "---- Report ----" << std::endl;
+    std::cout << "Queries sent:      " << total.NumQuerySent << " (" << std::fixed << std::setprecision(1) << total.NumQuerySent / duration << "/s)" << std::endl;
+    std::cout << "Responses:         " << total.NumResponse << " (" << total.NumResponse / duration << "/s)" << std::endl;
+    std::cout << "Rounds ended:      " << total.NumRoundEnded << std::endl;
+    std::cout << "Errors:            " << total.NumError << std::endl;
+    std::cout << "UDP packets:       " << total.NumUdpRecv << " (" << total.NumUdpRecv / duration << "/s)" << std::endl;
+    std::cout << "UDP drop rate:     " << std::setprecision(3) << dropRate * 100.0 << "% (estimated from inter-packet gaps)" << std::endl;
+    std::cout << "UDP jitter (mean): " << std::setprecision(1) << ((total.NumJitterSample == 0) ? 0.0 : total.SumJitterUs / total.NumJitterSample) << "us" << std::endl;
+    total.InputRtt.Print("RTT ActionPlayerInput");
+    total.BeginRoundRtt.Print("RTT BeginRound");
+    total.UdpGap.Print("UDP inter-packet gap");
+
+    // Per session
+    std::vector<double> dropRates, jitters, maxGaps;
+    for (const StreamStat& stream : total.Streams) {
+        dropRates.push_back(stream.GetDropRate() * 100.0);
+        jitters.push_back(stream.GetMeanJitterUs());
+        maxGaps.push_back(stream.MaxGapUs);
+    }
+    std::cout << std::endl << "---- Per session ----" << std::endl << std::setprecision(1);
+    PrintSessionDistribution("UDP drop rate", dropRates, "%");
+    PrintSessionDistribution("UDP jitter (mean)", jitters, "us");
+    std::cout << std::setprecision(0);
+    PrintSessionDistribution("UDP max gap", maxGaps, "us");
+
+    const size_t numWorst = std::min<size_t>(5, total.Streams.size());
+    std::partial_sort(total.Streams.begin(), total.Streams.begin() + numWorst, total.Streams.end(), [](const StreamStat& lhs, const StreamStat& rhs) {
+        return (lhs.GetDropRate() != rhs.GetDropRate()) ? lhs.GetDropRate() > rhs.GetDropRate() : lhs.GetMeanJitterUs() > rhs.GetMeanJitterUs();
+    });
+    std::cout << "Worst sessions:" << std::endl;
+    for (size_t i = 0; i < numWorst; i++) {
+        const StreamStat& stream = total.Streams[i];
+        std::cout << "  session " << std::setw(10) << stream.SessionID
+                  << " drop rate: " << std::setw(6) << std::setprecision(3) << stream.GetDropRate() * 100.0 << "%"
+                  << " jitter: " << std::setw(8) << std::setprecision(1) << stream.GetMeanJitterUs() << "us"
+                  << " max gap: " << std::setw(8) << stream.MaxGapUs << "us"
+                  << " packets: " << stream.NumUdpRecv << std::endl;
+    }
+
+    return (total.NumError == 0) ? 0 : 1;
+}
@@ -56,8 +56,6 @@ volatile bool g_bSessionWorkerThreadRunning = true;
 
 int main() 
 {
-    srand(time(nullptr));
-
     // Open UDP receiving socket
     int udpSocket_ObjectPos_Stream = socket(AF_INET, SOCK_DGRAM, 0);
     if (udpSocket_ObjectPos_Stream == -1) {
@@ -0,0 +1,372 @@
+/**
+ * Live session migration between two servers on one host.
+ * A player creates a session on the source server, keeps playing rounds and sending inputs to the source,
+ * and migrates the session to the target server with MigrateSession_v1 at some point.
+ * The player keeps using the old session ID on the source, which relays its queries.
+ * Right before, an intruder connection tries to migrate the session of the player, which must fail.
+ *
+ * Measured:
+ *  - Migration pause reported by the source (Freeze until the target acknowledged the import)
+ *  - Largest UDP object state inter-packet gap before and after the migration
+ *  - Largest ball move between two packets before and after the migration (Continuity of the state)
+ *  - Round results and input acks relayed back through the source
+ *  - MigrateSession_v1 on the session of another client is rejected
+ *
+ * Build: g++ -std=c++17 -O2 Tester/migrate_test.cpp -o migrate_test
+ * Run:   ./migrate_test [--host 127.0.0.1] [--port 9280] [--target-port 9380] [--migrate-at 2] [--duration 6] [--stream-port 9991]
+ * */
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../Source/config.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+struct MigrateTestOption
+{
+    const char* Host       = "127.0.0.1";
+    uint16_t    Port       = 9280;
+    uint16_t    TargetPort = 9380;
+    uint16_t    StreamPort = 9991;
+    double      MigrateAt  = 2.0; // Sec after BeginRound
+    int         Duration   = 6;   // Sec
+    int         TickRate   = SERVER_TICK_RATE;
+};
+
+struct __attribute__((packed)) ObjectPos_Packet
+{
+    float BallPos[2];
+    float PaddlePosA;
+    float PaddlePosB;
+};
+
+struct StreamPhaseStat
+{
+    uint64_t NumPackets = 0;
+    uint64_t NumRounds  = 0;
+    int64_t  MaxGapUs   = 0;
+    float    MaxBallStep = 0.0f;
+};
+
+static int ConnectTcp(const char* host, uint16_t port)
+{
+    const int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) == -1) {
+        std::cerr << "Failed to connect to " << host << ":" << port << std::endl;
+        exit(1);
+    }
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    return sock;
+}
+
+static void SendAll(int sock, const void* data, size_t size)
+{
+    if (send(sock, data, size, MSG_NOSIGNAL) != (ssize_t)size) {
+        std::cerr << "Send failed" << std::endl;
+        exit(1);
+    }
+}
+
+static void RecvAll(int sock, void* data, size_t size)
+{
+    size_t received = 0;
+    while (received < size) {
+        const ssize_t n = recv(sock, (char*)data + received, size - received, 0);
+        if (n <= 0) {
+            std::cerr << "Connection closed" << std::endl;
+            exit(1);
+        }
+        received += (size_t)n;
+    }
+}
+
+// v2 query frame. {uint32 Length; uint32 QueryID; Param}
+template <typename TParam>
+static void SendQuery_v2(int sock, uint32_t queryID, const TParam& param)
+{
+    struct __attribute__((packed))
+    {
+        uint32_t Length;
+        uint32_t QueryID;
+        TParam   Param;
+    } frame = { sizeof(uint32_t) + sizeof(TParam), queryID, param };
+    SendAll(sock, &frame, sizeof(frame));
+}
+
+// Blocking read of the next v2 response frame (QueryID + Result + ...)
+static std::vector<char> RecvResponse_v2(int sock)
+{
+    uint32_t length;
+    RecvAll(sock, &length, sizeof(length));
+    std::vector<char> response(length);
+    RecvAll(sock, response.data(), length);
+    return response;
+}
+
+int main(int argc, char** argv)
+{
+    MigrateTestOption option;
+    for (int i = 1; i < argc; i++) {
+        const bool bHasValue = (i + 1 < argc);
+        if (strcmp(argv[i], "--host") == 0 && bHasValue) {
+            option.Host = argv[++i];
+        }
+        else if (strcmp(argv[i], "--port") == 0 && bHasValue) {
+            option.Port = (uint16_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--target-port") == 0 && bHasValue) {
+            option.TargetPort = (uint16_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stream-port") == 0 && bHasValue) {
+            option.StreamPort = (uint16_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--migrate-at") == 0 && bHasValue) {
+            option.MigrateAt = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--duration") == 0 && bHasValue) {
+            option.Duration = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tick-rate") == 0 && bHasValue) {
+            option.TickRate = atoi(argv[++i]);
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--host H] [--port P] [--target-port P] [--stream-port P] [--migrate-at SEC] [--duration SEC] [--tick-rate HZ]" << std::endl;
+            return 1;
+        }
+    }
+
+    // State stream sink
+    const int udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in streamAddr;
+    memset(&streamAddr, 0, sizeof(streamAddr));
+    streamAddr.sin_family = AF_INET;
+    streamAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    streamAddr.sin_port = htons(option.StreamPort);
+    if (bind(udpSocket, (sockaddr*)&streamAddr, sizeof(streamAddr)) == -1) {
+        std::cerr << "Failed to bind the stream port " << option.StreamPort << std::endl;
+        return 1;
+    }
+    fcntl(udpSocket, F_SETFL, O_NONBLOCK);
+
+    // Player connection in v2 framing, so that the round result push is told apart from the responses
+    const int playerSocket = ConnectTcp(option.Host, option.Port);
+    const uint32_t upgradeQuery[2] = { 1, 2 };
+    SendAll(playerSocket, upgradeQuery, sizeof(upgradeQuery));
+    char upgradeResponse[5];
+    RecvAll(playerSocket, upgradeResponse, sizeof(upgradeResponse));
+
+    struct __attribute__((packed)) CreateSession_Param
+    {
+        uint32_t FieldWidth, FieldHeight, WinScore, GameTime, BallSpeed, BallRadius, PaddleSpeed, PaddleSize, PaddleOffsetFromWall;
+        uint16_t RecvUdpPort_ObjectPos_Stream;
+    } createParam = { 800, 600, 100, 60, 400, 10, 300, 100, 20, htons(option.StreamPort) };
+    SendQuery_v2(playerSocket, 101, createParam);
+    std::vector<char> response = RecvResponse_v2(playerSocket);
+    uint32_t sessionID;
+    if (response.size() < 9 || response[4] != 0) {
+        std::cerr << "CreateSession_v1 failed" << std::endl;
+        return 1;
+    }
+    memcpy(&sessionID, response.data() + 5, sizeof(sessionID));
+
+    SendQuery_v2(playerSocket, 201, sessionID);
+    response = RecvResponse_v2(playerSocket);
+    if (response.size() < 5 || response[4] != 0) {
+        std::cerr << "BeginRound_v1 failed" << std::endl;
+        return 1;
+    }
+    fcntl(playerSocket, F_SETFL, O_NONBLOCK);
+    std::cout << "Session " << sessionID << " running on port " << option.Port << std::endl;
+
+    const Clock::time_point beginTime = Clock::now();
+    const Clock::time_point migrateTime = beginTime + std::chrono::microseconds((int64_t)(option.MigrateAt * 1000000));
+    const Clock::time_point endTime = beginTime + std::chrono::seconds(option.Duration);
+
+    bool bMigrateRequested = false;
+    bool bIntruderRejected = false;
+    bool bMigrated = false;
+    uint32_t newSessionID = 0;
+    uint32_t pauseUs = 0;
+    Clock::time_point migrateRequestTime;
+    int64_t migrateRoundTripUs = 0;
+
+    StreamPhaseStat phases[2]; //< Before / after the migration response
+    Clock::time_point lastPacketTime;
+    ObjectPos_Packet lastPacket;
+    bool bHasLastPacket = false;
+
+    std::vector<char> playerRecvBuffer;
+    uint64_t numInputs = 0;
+    uint64_t numInputAcks = 0;
+    Clock::time_point nextInputTime = beginTime;
+    uint8_t inputKey = 1;
+
+    while (Clock::now() < endTime)
+    {
+        const Clock::time_point now = Clock::now();
+
+        // Inputs keep going to the source server, which relays them after the migration
+        if (now >= nextInputTime) {
+            struct __attribute__((packed)) ActionPlayerInput_Param
+            {
+                uint32_t SessionID;
+                uint32_t PlayerID;
+                uint8_t  InputKey;
+                uint8_t  InputType;
+            } input = { sessionID, (uint32_t)(numInputs % 2) + 1, inputKey, 1 };
+            SendQuery_v2(playerSocket, 301, input);
+            inputKey = (inputKey == 1) ? 2 : 1;
+            numInputs++;
+            nextInputTime += std::chrono::milliseconds(100);
+        }
+
+        if (!bMigrateRequested && now >= migrateTime) {
+            struct __attribute__((packed)) MigrateSession_Param
+            {
+                uint32_t SessionID;
+                uint32_t TargetAddr;
+                uint16_t TargetPort;
+            } migrateParam = { sessionID, 0, htons(option.TargetPort) };
+            inet_pton(AF_INET, option.Host, &migrateParam.TargetAddr);
+
+            // Another client must not be able to take the session away. (v1 framing)
+            const int intruderSocket = ConnectTcp(option.Host, option.Port);
+            const uint32_t intruderQueryID = 105;
+            SendAll(intruderSocket, &intruderQueryID, sizeof(intruderQueryID));
+            SendAll(intruderSocket, &migrateParam, sizeof(migrateParam));
+            char intruderResponse[sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t) * 2];
+            RecvAll(intruderSocket, intruderResponse, sizeof(intruderResponse));
+            close(intruderSocket);
+            bIntruderRejected = (intruderResponse[4] != 0);
+            if (!bIntruderRejected) {
+                std::cerr << "MigrateSession_v1 of another client's session succeeded" << std::endl;
+                return 1;
+            }
+
+            migrateRequestTime = Clock::now();
+            SendQuery_v2(playerSocket, 105, migrateParam);
+            bMigrateRequested = true;
+        }
+
+        // Object state stream
+        ObjectPos_Packet packet;
+        while (recv(udpSocket, &packet, sizeof(packet), 0) >= (ssize_t)sizeof(ObjectPos_Packet)) {
+            const Clock::time_point packetTime = Clock::now();
+            StreamPhaseStat& phase = phases[bMigrated ? 1 : 0];
+            phase.NumPackets++;
+            if (bHasLastPacket) {
+                phase.MaxGapUs = std::max<int64_t>(phase.MaxGapUs, std::chrono::duration_cast<std::chrono::microseconds>(packetTime - lastPacketTime).count());
+                const float step = std::hypot(packet.BallPos[0] - lastPacket.BallPos[0], packet.BallPos[1] - lastPacket.BallPos[1]);
+                if (step < createParam.FieldWidth / 4) { //< Not a reset after a score
+                    phase.MaxBallStep = std::max(phase.MaxBallStep, step);
+                }
+            }
+            lastPacket = packet;
+            lastPacketTime = packetTime;
+            bHasLastPacket = true;
+        }
+
+        // Input acks and the round result
+        char buffer[4096];
+        const ssize_t nBytesRecv = recv(playerSocket, buffer, sizeof(buffer), 0);
+        if (nBytesRecv == 0) {
+            std::cerr << "Player connection closed" << std::endl;
+            return 1;
+        }
+        if (nBytesRecv > 0) {
+            playerRecvBuffer.insert(playerRecvBuffer.end(), buffer, buffer + nBytesRecv);
+            size_t offset = 0;
+            uint32_t length;
+            while (playerRecvBuffer.size() - offset >= sizeof(length)) {
+                memcpy(&length, playerRecvBuffer.data() + offset, sizeof(length));
+                if (playerRecvBuffer.size() - offset - sizeof(length) < length) {
+                    break;
+                }
+                uint32_t queryID;
+                memcpy(&queryID, playerRecvBuffer.data() + offset + sizeof(length), sizeof(queryID));
+                if (queryID == 301) {
+                    numInputAcks++;
+                }
+                else if (queryID == 105) {
+                    struct __attribute__((packed)) MigrateSession_Response
+                    {
+                        uint32_t QueryID;
+                        uint8_t  Result;
+                        uint32_t NewSessionID;
+                        uint32_t PauseUs;
+                    } migrateResponse;
+                    memcpy(&migrateResponse, playerRecvBuffer.data() + offset + sizeof(length), std::min<size_t>(length, sizeof(migrateResponse)));
+                    migrateRoundTripUs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - migrateRequestTime).count();
+                    if (length < sizeof(migrateResponse) || migrateResponse.Result != 0) {
+                        std::cerr << "MigrateSession_v1 failed" << std::endl;
+                        return 1;
+                    }
+                    bMigrated = true;
+                    newSessionID = migrateResponse.NewSessionID;
+                    pauseUs = migrateResponse.PauseUs;
+                }
+                else if (queryID == 201 && length == sizeof(uint32_t) * 2) {
+                    // Round result. Begin the next round with the old session ID.
+                    phases[bMigrated ? 1 : 0].NumRounds++;
+                    SendQuery_v2(playerSocket, 201, sessionID);
+                }
+                offset += sizeof(length) + length;
+            }
+            playerRecvBuffer.erase(playerRecvBuffer.begin(), playerRecvBuffer.begin() + offset);
+        }
+
+        usleep(200);
+    }
+
+    const int64_t tickIntervalUs = 1000000 / option.TickRate;
+    std::cout << std::endl;
+    std::cout << "---- Migration ----" << std::endl;
+    if (!bMigrated) {
+        std::cout << "Not migrated" << std::endl;
+        return 1;
+    }
+    std::cout << "Session " << sessionID << " -> " << newSessionID << " on port " << option.TargetPort << std::endl;
+    std::cout << "MigrateSession_v1 from another client: " << (bIntruderRejected ? "Rejected" : "Accepted") << std::endl;
+    std::cout << "Pause (server): " << pauseUs << " us, MigrateSession round trip: " << migrateRoundTripUs << " us" << std::endl;
+    std::cout << "Tick interval: " << tickIntervalUs << " us" << std::endl;
+    const char* const phaseNames[2] = { "Before", "After " };
+    for (int i = 0; i < 2; i++) {
+        std::cout << phaseNames[i] << ": " << phases[i].NumPackets << " packets, max gap " << phases[i].MaxGapUs
+                  << " us, max ball step " << phases[i].MaxBallStep << ", " << phases[i].NumRounds << " rounds ended" << std::endl;
+    }
+    std::cout << "Inputs: " << numInputs << " sent, " << numInputAcks << " acked" << std::endl;
+
+    // Blocking again for the last response
+    fcntl(playerSocket, F_SETFL, 0);
+    SendQuery_v2(playerSocket, 102, sessionID);
+    while (true) {
+        response = RecvResponse_v2(playerSocket);
+        uint32_t queryID;
+        memcpy(&queryID, response.data(), sizeof(queryID));
+        if (queryID == 102) {
+            break;
+        }
+    }
+    std::cout << "AbortSession_v1 through the old ID: " << (response[4] == 0 ? "Success" : "Fail") << std::endl;
+
+    close(playerSocket);
+    close(udpSocket);
+    return (bIntruderRejected && phases[1].NumPackets != 0 && numInputAcks == numInputs && response[4] == 0) ? 0 : 1;
+}
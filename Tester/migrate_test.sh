@@ -0,0 +1,23 @@
+#!/bin/bash
+# Live migration of a session between two servers on the loopback.
+# Run from the repository root: ./Tester/migrate_test.sh [migrate_test options...]
+
+echo "Building server and migrate_test"
+g++ -std=c++17 -O2 Source/*.cpp -o server -lpthread || exit 1
+g++ -std=c++17 -O2 Tester/migrate_test.cpp -o migrate_test || exit 1
+
+# Source on 9280, target on 9380 (UDP input on the next ports)
+./server --port 9280 > migrate_source.log 2>&1 &
+PIDS="$!"
+./server --port 9380 > migrate_target.log 2>&1 &
+PIDS="$PIDS $!"
+sleep 0.5
+
+./migrate_test --port 9280 --target-port 9380 "$@"
+RESULT=$?
+
+echo
+grep "migrated" migrate_source.log
+
+kill $PIDS
+exit $RESULT
@@ -0,0 +1,486 @@
+/**
+ * Offline replay of the sessions in a replay log. (`./server --record <path>`)
+ * Re-simulates every recorded session with the Session code of the server, as fast as the CPU allows, on several threads.
+ * A session starts from its recorded parameters and RNG seed (Or snapshot), steps its ticks by the recorded time steps,
+ * and gets every input and round timeout after the same tick as on the server. (Inputs at their recorded time into the next tick)
+ * Every round end and the deletion of the session are checked against the recording. (Tick, result, scores and ball position, bit exact)
+ *
+ * Also a benchmark of the simulation on a recorded workload: reports replayed session-ticks per second.
+ * The replay only reproduces the server built from the same source with the same compiler and flags.
+ *
+ * Build: g++ -std=c++17 -O2 Tester/replay.cpp Source/Session.cpp Source/Recorder.cpp Source/Helper.cpp -o replay -lpthread
+ * Run:   ./replay <log> [--threads N] [--repeat R] [--dump <SessionID>]
+ * */
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+#include "../Source/Session.hpp"
+#include "../Source/Recorder.hpp"
+
+#define MAX_REPORTED_MISMATCH 10
+
+struct ReplaySegment
+{
+    ReplayPayload_Segment Header;
+    bool bSupported; //< Written by a server of the same log and snapshot version
+    bool bGap;       //< Records were dropped while it was written
+};
+
+// Record applied between two ticks
+struct ReplayEvent
+{
+    uint8_t     Type;
+    uint8_t     Rank; //< Order of the records of the same tick. (Creation first)
+    uint32_t    Tick;
+    const char* Payload;
+};
+
+struct RecordedSession
+{
+    size_t   SegmentIndex;
+    bool     bCreated;
+    uint32_t SessionID;
+    uint32_t LastTick;
+    std::vector<ReplayEvent> Events;
+    std::vector<std::pair<uint32_t, uint32_t>> Steps; //< Tick, DeltaMs
+    std::vector<std::pair<uint32_t, ReplayPayload_RoundEnd>> RoundEnds;
+};
+
+struct ReplayOutcome
+{
+    uint64_t    NumTicks;
+    uint64_t    NumRounds;
+    bool        bMatched;
+    std::string Mismatch; //< First difference to the recording
+};
+
+static bool ReadLog(const char* path, std::vector<char>& log)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open replay log: " << path << std::endl;
+        return false;
+    }
+    log.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Group the records by session. Sessions are told apart by the process (ID and start time) and the replay ID.
+static bool ParseLog(const std::vector<char>& log, std::vector<ReplaySegment>& segments, std::vector<RecordedSession>& sessions, size_t& numRecords)
+{
+    std::unordered_map<std::string, size_t> sessionIndex;
+    std::string processKey;
+    numRecords = 0;
+
+    size_t offset = 0;
+    while (offset + sizeof(ReplayRecord) <= log.size())
+    {
+        ReplayRecord header;
+        memcpy(&header, log.data() + offset, sizeof(header));
+        size_t payloadSize;
+        if (!Recorder::GetPayloadSize(header.Type, payloadSize)) {
+            std::cerr << "Unknown record type " << (int)header.Type << " at offset " << offset << std::endl;
+            return false;
+        }
+        if (offset + sizeof(header) + payloadSize > log.size()) {
+            break;
+        }
+        const char* const payload = log.data() + offset + sizeof(header);
+        offset += sizeof(header) + payloadSize;
+        numRecords += 1;
+
+        const ReplayRecordType type = (ReplayRecordType)header.Type;
+        if (type == ReplayRecordType::Segment) {
+            ReplaySegment segment;
+            memcpy(&segment.Header, payload, sizeof(segment.Header));
+            segment.bSupported = (segment.Header.Magic == REPLAY_LOG_MAGIC && segment.Header.Version == REPLAY_LOG_VERSION
+                                  && segment.Header.SnapshotVersion == SESSION_SNAPSHOT_VERSION);
+            segment.bGap = false;
+            if (!segment.bSupported) {
+                std::cerr << "Skipping a segment of another log or snapshot version. (Process " << segment.Header.ProcessID << ")" << std::endl;
+            }
+            segments.push_back(segment);
+            processKey = std::to_string(segment.Header.ProcessID) + "/" + std::to_string(segment.Header.StartTime) + "/";
+            continue;
+        }
+        if (segments.empty() || !segments.back().bSupported) {
+            continue;
+        }
+        if (type == ReplayRecordType::Gap) {
+            segments.back().bGap = true;
+            continue;
+        }
+
+        const std::string key = processKey + std::to_string(header.ReplayID);
+        std::unordered_map<std::string, size_t>::iterator it = sessionIndex.find(key);
+        if (it == sessionIndex.end()) {
+            RecordedSession session;
+            session.SegmentIndex = segments.size() - 1;
+            session.bCreated = false;
+            session.SessionID = 0;
+            session.LastTick = 0;
+            it = sessionIndex.emplace(key, sessions.size()).first;
+            sessions.push_back(session);
+        }
+        RecordedSession& session = sessions[it->second];
+        if (type == ReplayRecordType::Create) {
+            ReplayPayload_Create create;
+            memcpy(&create, payload, sizeof(create));
+            session.bCreated = true;
+            session.SessionID = create.SessionID;
+        }
+        const uint32_t tick = header.Tick;
+        session.LastTick = std::max(session.LastTick, tick);
+
+        if (type == ReplayRecordType::Step) {
+            ReplayPayload_Step step;
+            memcpy(&step, payload, sizeof(step));
+            session.Steps.emplace_back(tick, (uint32_t)step.DeltaMs);
+        }
+        else if (type == ReplayRecordType::RoundEnd) {
+            ReplayPayload_RoundEnd roundEnd;
+            memcpy(&roundEnd, payload, sizeof(roundEnd));
+            session.RoundEnds.emplace_back(tick, roundEnd);
+        }
+        else {
+            const uint8_t rank = (type == ReplayRecordType::Create) ? 0 : (type == ReplayRecordType::Resume ? 1 : 2);
+            session.Events.push_back({ header.Type, rank, tick, payload });
+        }
+    }
+    if (offset != log.size()) {
+        std::cerr << "Ignoring a truncated record at the end of the log. (Offset " << offset << ")" << std::endl;
+    }
+
+    // Only a creation starts a session. (The rest of a session created before the log was opened is left out)
+    sessions.erase(std::remove_if(sessions.begin(), sessions.end(), [](const RecordedSession& session) { return !session.bCreated; }), sessions.end());
+
+    // The records of a session come from its reactor and from the workers that ticked it, so they are only ordered per thread.
+    // (A worker may write the first tick of a session before the reactor writes its creation)
+    for (RecordedSession& session : sessions) {
+        std::stable_sort(session.Events.begin(), session.Events.end(), [](const ReplayEvent& lhs, const ReplayEvent& rhs) {
+            return (lhs.Tick != rhs.Tick) ? lhs.Tick < rhs.Tick : lhs.Rank < rhs.Rank;
+        });
+        std::sort(session.Steps.begin(), session.Steps.end());
+        std::stable_sort(session.RoundEnds.begin(), session.RoundEnds.end(), [](const std::pair<uint32_t, ReplayPayload_RoundEnd>& lhs, const std::pair<uint32_t, ReplayPayload_RoundEnd>& rhs) {
+            return lhs.first < rhs.first;
+        });
+    }
+    return true;
+}
+
+// State of a new session, as the server creates it. (Replayed sessions are all resumed from a snapshot)
+static void MakeCreateSnapshot(const ReplayPayload_Create& create, Session::Snapshot& snapshot)
+{
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.Version = SESSION_SNAPSHOT_VERSION;
+    snapshot.FieldWidth = create.FieldWidth;
+    snapshot.FieldHeight = create.FieldHeight;
+    snapshot.WinScore = create.WinScore;
+    snapshot.GameTime = create.GameTime;
+    snapshot.BallSpeed = create.BallSpeed;
+    snapshot.BallRadius = create.BallRadius;
+    snapshot.PaddleSpeed = create.PaddleSpeed;
+    snapshot.PaddleSize = create.PaddleSize;
+    snapshot.PaddleOffsetFromWall = create.PaddleOffsetFromWall;
+    snapshot.StreamSessionID = create.SessionID;
+    snapshot.StreamInterval = 1;
+
+    Pcg32 random;
+    random.Seed(create.Seed);
+    snapshot.RandomState = random.State;
+    snapshot.RandomIncrement = random.Increment;
+}
+
+static void DumpTick(const Session& session, std::ostream& out)
+{
+    Session::Snapshot state;
+    session.SaveSnapshot(state);
+    out << std::setw(8) << state.TickNumber << std::fixed << std::setprecision(3)
+        << std::setw(12) << state.BallPos[0] << std::setw(12) << state.BallPos[1]
+        << std::setw(12) << state.BallVel[0] << std::setw(12) << state.BallVel[1]
+        << std::setw(10) << state.PlayerA_PaddlePos << std::setw(10) << state.PlayerB_PaddlePos
+        << std::setw(6) << state.ScoreA << std::setw(6) << state.ScoreB << std::endl;
+}
+
+static ReplayOutcome ReplaySession(const RecordedSession& recorded, const ReplaySegment& segment, std::ostream* dump)
+{
+    ReplayOutcome outcome = { 0, 0, true, "" };
+    const auto mismatch = [&outcome](const std::string& message) {
+        if (outcome.bMatched) {
+            outcome.bMatched = false;
+            outcome.Mismatch = message;
+        }
+    };
+
+    Session* session = nullptr;
+    size_t stepIndex = 0;
+    size_t roundEndIndex = 0;
+
+    // The state of the session at the end of a round, against the recording
+    const auto checkRoundEnd = [&](uint32_t tick, uint32_t recordedTick, const ReplayPayload_RoundEnd& expected) {
+        Session::Snapshot state;
+        session->SaveSnapshot(state);
+        outcome.NumRounds += 1;
+        if (recordedTick != tick || expected.Result != state.LastRoundResult || expected.ScoreA != state.ScoreA || expected.ScoreB != state.ScoreB
+            || memcmp(expected.BallPos, state.BallPos, sizeof(expected.BallPos)) != 0) {
+            std::ostringstream message;
+            message << "Round ended on tick " << tick << " with result " << (int)state.LastRoundResult << " " << state.ScoreA << ":" << state.ScoreB
+                    << " ball (" << state.BallPos[0] << ", " << state.BallPos[1] << "). Recorded: tick " << recordedTick << " result " << (int)expected.Result
+                    << " " << expected.ScoreA << ":" << expected.ScoreB << " ball (" << expected.BallPos[0] << ", " << expected.BallPos[1] << ")";
+            mismatch(message.str());
+        }
+    };
+
+    // Tick the running round up to the tick. Goals end rounds by themselves, like on the server. (Timeouts are recorded)
+    const auto advance = [&](uint32_t tick) {
+        while (session != nullptr && session->IsRoundRunning() && session->GetTickNumber() < tick)
+        {
+            const uint32_t nextTick = session->GetTickNumber() + 1;
+            while (stepIndex < recorded.Steps.size() && recorded.Steps[stepIndex].first < nextTick) {
+                stepIndex += 1;
+            }
+            const bool bRecordedStep = (stepIndex < recorded.Steps.size() && recorded.Steps[stepIndex].first == nextTick);
+            const uint32_t deltaMs = bRecordedStep ? recorded.Steps[stepIndex].second : segment.Header.NominalStepMs;
+            session->Simulate(std::chrono::milliseconds(deltaMs));
+            outcome.NumTicks += 1;
+            if (dump != nullptr) {
+                DumpTick(*session, *dump);
+            }
+            if (session->IsRoundRunning()) {
+                continue;
+            }
+
+            if (roundEndIndex == recorded.RoundEnds.size()) {
+                outcome.NumRounds += 1;
+                mismatch("Round ended on tick " + std::to_string(nextTick) + ", not recorded");
+                continue;
+            }
+            checkRoundEnd(nextTick, recorded.RoundEnds[roundEndIndex].first, recorded.RoundEnds[roundEndIndex].second);
+            roundEndIndex += 1;
+        }
+    };
+
+    for (const ReplayEvent& event : recorded.Events)
+    {
+        advance(event.Tick);
+        if (session != nullptr && session->GetTickNumber() != event.Tick && event.Type != (uint8_t)ReplayRecordType::Resume) {
+            mismatch("Record of tick " + std::to_string(event.Tick) + " reached on tick " + std::to_string(session->GetTickNumber()));
+        }
+
+        switch ((ReplayRecordType)event.Type)
+        {
+        case ReplayRecordType::Create:
+        {
+            ReplayPayload_Create create;
+            memcpy(&create, event.Payload, sizeof(create));
+            Session::Snapshot snapshot;
+            MakeCreateSnapshot(create, snapshot);
+            delete session;
+            session = new Session(nullptr, snapshot, -1, Session::DetachedIdPartition);
+            break;
+        }
+        case ReplayRecordType::Resume:
+        {
+            Session::Snapshot snapshot;
+            memcpy(&snapshot, event.Payload, sizeof(snapshot));
+            delete session;
+            session = new Session(nullptr, snapshot, -1, Session::DetachedIdPartition);
+            break;
+        }
+        case ReplayRecordType::Bot:
+        {
+            ReplayPayload_Bot bot;
+            memcpy(&bot, event.Payload, sizeof(bot));
+            session->SetBotPlayer((Session::PlayerID)bot.PlayerID, bot.bBot != 0);
+            break;
+        }
+        case ReplayRecordType::BeginRound:
+            if (!session->BeginRound()) {
+                mismatch("BeginRound on tick " + std::to_string(event.Tick) + " refused. (Round still running)");
+            }
+            break;
+        case ReplayRecordType::Input:
+        {
+            ReplayPayload_Input input;
+            memcpy(&input, event.Payload, sizeof(input));
+            const std::chrono::steady_clock::time_point receiveTime = session->GetLastTickUpdateTime() + std::chrono::microseconds(input.OffsetUs);
+            if (!session->SetPlayerInput((Session::PlayerID)input.PlayerID, (Session::InputKey)input.Key, (Session::InputType)input.Type, receiveTime)) {
+                mismatch("Input on tick " + std::to_string(event.Tick) + " refused. (Round not running, or input queue full)");
+            }
+            break;
+        }
+        case ReplayRecordType::RoundTimeout:
+        {
+            ReplayPayload_RoundEnd timeout;
+            memcpy(&timeout, event.Payload, sizeof(timeout));
+            if (!session->IsRoundRunning()) {
+                mismatch("Round timeout on tick " + std::to_string(event.Tick) + " without a running round");
+                break;
+            }
+            session->EndRoundByTimeout();
+            if (dump != nullptr) {
+                DumpTick(*session, *dump);
+            }
+            checkRoundEnd(session->GetTickNumber(), event.Tick + 1, timeout);
+            break;
+        }
+        case ReplayRecordType::Close:
+        {
+            ReplayPayload_Close close;
+            memcpy(&close, event.Payload, sizeof(close));
+            Session::Snapshot state;
+            session->SaveSnapshot(state);
+            if (close.ScoreA != state.ScoreA || close.ScoreB != state.ScoreB || memcmp(close.BallPos, state.BallPos, sizeof(close.BallPos)) != 0) {
+                std::ostringstream message;
+                message << "Closed on tick " << event.Tick << " with " << state.ScoreA << ":" << state.ScoreB << " ball (" << state.BallPos[0] << ", " << state.BallPos[1]
+                        << "). Recorded: " << close.ScoreA << ":" << close.ScoreB << " ball (" << close.BallPos[0] << ", " << close.BallPos[1] << ")";
+                mismatch(message.str());
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // Up to the last recorded tick. (A session not closed was alive when the process stopped recording)
+    advance(recorded.LastTick);
+    if (roundEndIndex < recorded.RoundEnds.size()) {
+        mismatch("Recorded round end on tick " + std::to_string(recorded.RoundEnds[roundEndIndex].first) + " not reached. (Replay stopped on tick "
+                 + std::to_string(session != nullptr ? session->GetTickNumber() : 0) + ")");
+    }
+
+    delete session;
+    return outcome;
+}
+
+int main(int argc, char** argv)
+{
+    const char* logPath = nullptr;
+    uint32_t    numThread = std::max(1u, std::thread::hardware_concurrency());
+    int         numRepeat = 1;
+    int64_t     dumpSessionID = -1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThread = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            numRepeat = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dumpSessionID = strtoll(argv[++i], nullptr, 10);
+        }
+        else if (logPath == nullptr && argv[i][0] != '-') {
+            logPath = argv[i];
+        }
+        else {
+            logPath = nullptr;
+            break;
+        }
+    }
+    if (logPath == nullptr) {
+        std::cerr << "Usage: " << argv[0] << " <log> [--threads N] [--repeat R] [--dump <SessionID>]" << std::endl;
+        return 1;
+    }
+    if (numThread == 0 || numRepeat <= 0) {
+        std::cerr << "threads and repeat must be positive" << std::endl;
+        return 1;
+    }
+
+    std::vector<char> log;
+    std::vector<ReplaySegment> segments;
+    std::vector<RecordedSession> sessions;
+    size_t numRecords;
+    if (!ReadLog(logPath, log) || !ParseLog(log, segments, sessions, numRecords)) {
+        return 1;
+    }
+
+    // Dump the sessions of the ID tick by tick, in the order of the log
+    if (dumpSessionID >= 0) {
+        int numMismatch = 0;
+        for (const RecordedSession& recorded : sessions) {
+            if (recorded.SessionID != (uint32_t)dumpSessionID) {
+                continue;
+            }
+            const ReplaySegment& segment = segments[recorded.SegmentIndex];
+            std::cout << "# Session " << recorded.SessionID << " of process " << segment.Header.ProcessID << std::endl;
+            std::cout << "#   tick       ballX       ballY       velX       velY   paddleA   paddleB    sA    sB" << std::endl;
+            const ReplayOutcome outcome = ReplaySession(recorded, segment, &std::cout);
+            std::cout << "# " << outcome.NumTicks << " ticks, " << outcome.NumRounds << " rounds. " << (outcome.bMatched ? "Matches the recording" : outcome.Mismatch) << std::endl;
+            numMismatch += outcome.bMatched ? 0 : 1;
+        }
+        return (numMismatch == 0) ? 0 : 1;
+    }
+
+    std::vector<ReplayOutcome> outcomes(sessions.size());
+    std::atomic<size_t> nextSession(0);
+    const std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < numThread; t++) {
+        threads.emplace_back([&]() {
+            while (true) {
+                const size_t job = nextSession.fetch_add(1, std::memory_order_relaxed);
+                if (job >= sessions.size() * numRepeat) {
+                    break;
+                }
+                const size_t i = job % sessions.size();
+                const ReplayOutcome outcome = ReplaySession(sessions[i], segments[sessions[i].SegmentIndex], nullptr);
+                if (job < sessions.size()) {
+                    outcomes[i] = outcome;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    const double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+
+    uint64_t numTicks = 0;
+    uint64_t numRounds = 0;
+    size_t numMatched = 0;
+    size_t numUnverifiable = 0;
+    int numReported = 0;
+    for (size_t i = 0; i < sessions.size(); i++) {
+        numTicks += outcomes[i].NumTicks;
+        numRounds += outcomes[i].NumRounds;
+        if (outcomes[i].bMatched) {
+            numMatched += 1;
+            continue;
+        }
+        const ReplaySegment& segment = segments[sessions[i].SegmentIndex];
+        if (segment.bGap) {
+            numUnverifiable += 1;
+            continue;
+        }
+        if (numReported++ < MAX_REPORTED_MISMATCH) {
+            std::cout << "mismatch: session " << sessions[i].SessionID << " of process " << segment.Header.ProcessID << ": " << outcomes[i].Mismatch << std::endl;
+        }
+    }
+    numTicks *= numRepeat;
+
+    std::cout << "log: " << log.size() << " bytes, " << numRecords << " records, " << segments.size() << " segments, " << sessions.size() << " sessions" << std::endl;
+    std::cout << "replayed " << numTicks << " session-ticks in " << std::fixed << std::setprecision(1) << elapsedSec * 1000 << "ms on " << numThread << " threads"
+              << (numRepeat > 1 ? " (x" + std::to_string(numRepeat) + ")" : "") << ": "
+              << std::setprecision(0) << (double)numTicks / elapsedSec << " session-ticks/s ("
+              << std::setprecision(1) << elapsedSec * 1e9 * numThread / std::max<uint64_t>(1, numTicks) << " ns/session-tick per thread)" << std::endl;
+    std::cout << "verified " << numMatched << "/" << sessions.size() << " sessions, " << numRounds << " rounds";
+    if (numUnverifiable != 0) {
+        std::cout << ". " << numUnverifiable << " differ in segments with dropped records";
+    }
+    std::cout << std::endl;
+
+    return (numMatched + numUnverifiable == sessions.size()) ? 0 : 1;
+}
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Sharded servers behind a router on the loopback. Runs the load generator through the router.
+# Run from the repository root: ./Tester/shard_test.sh [num shards] [loadgen options...]
+
+NUM_SHARD=${1:-3}
+shift
+
+echo "Building server and loadgen"
+g++ -std=c++17 -O2 Source/*.cpp -o server -lpthread || exit 1
+g++ -std=c++17 -O2 Tester/loadgen.cpp -o loadgen -lpthread || exit 1
+
+# Shard i listens on 9180 + i * 100 (UDP input on the next port), the router on 9180
+SHARDS=""
+PIDS=""
+for i in $(seq 1 $NUM_SHARD); do
+    PORT=$((9180 + i * 100))
+    ./server --port $PORT --shard $i > shard$i.log 2>&1 &
+    PIDS="$PIDS $!"
+    SHARDS="$SHARDS${SHARDS:+,}127.0.0.1:$PORT"
+done
+sleep 0.5
+
+echo "Router in front of $SHARDS"
+./server --port 9180 --router $SHARDS > router.log 2>&1 &
+PIDS="$PIDS $!"
+sleep 1
+
+./loadgen --port 9180 --conns 150 --duration 15 "$@"
+
+echo
+echo "---- Sessions created per shard ----"
+for i in $(seq 1 $NUM_SHARD); do
+    echo "shard $i: $(grep -c "CreateSession" shard$i.log)"
+done
+tail -n 2 router.log
+
+kill $PIDS
@@ -20,8 +20,6 @@
 
 int main() 
 {
-    srand(time(nullptr));
-
     class Session {
     public:
         int udpSock;